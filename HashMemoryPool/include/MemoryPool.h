@@ -2,56 +2,170 @@
 
 #include <atomic>
 #include <utility>
-#include <mutex>    
+#include <cstddef>
 #include <cstdint>  
 #include <cassert>
+#include <new>
+
+#include "HeapProfiler.h"
 
 namespace Pool 
 {
 #define MEMORY_POOL_NUM 64
 #define SLOT_BASE_SIZE 8
 #define MAX_SLOT_SIZE 512
+#define MAGAZINE_SIZE 32
+// 每个块中第一个 slot 按 64 字节对齐 slot 大小是 A 的倍数的 pool 就能满足 alignof(T) == A (A <= 64)
+#define MAX_SLOT_ALIGN 64
+
+// initMemoryPool 的参数
+struct MemoryPoolOptions
+{
+    size_t  blockSize = 4096;           // 每个 pool 第一个块的大小
+    size_t  maxBlockSize = 1 << 20;     // 之后每个块翻倍 直到这个上限
+    bool    useMagazine = true;         // false 时所有线程直接使用共享的 MemoryPool
+};
+
+// 弹匣: 固定容量的一组空闲 slot 线程之间整个交换
+struct Magazine
+{
+    Magazine*   next;                       // 在 MemoryPool 的仓库中串成链表
+    size_t      count;                      // 当前装了多少个
+    void*       rounds[MAGAZINE_SIZE];
+};
 
 // 不将 pool 作为模板类 因为最下面的两个函数才是作为对外的接口的
 // 将最下面的两个函数作为模板即可
 class MemoryPool
 {
 public:
-    MemoryPool(size_t BlockSize = 4096);
+    MemoryPool(size_t BlockSize = 4096, size_t MaxBlockSize = 1 << 20);
     ~MemoryPool();
 
     void init(size_t slotSize);
+    // 第一个块 blockSize 之后每次翻倍 直到 maxBlockSize 都向上取整到整页
+    void setBlockSize(size_t blockSize, size_t maxBlockSize);
 
     void* allocate();
     void deallocate(void*);
 
-private:
-    void allocateBlock();
-    // 对齐
-    size_t padPointer(char* p, size_t align);
-    
+    // 弹匣仓库 供 ThreadMagazines 使用 每次交换只需要一两次 CAS
+    // 交出一个空弹匣 (可以为 nullptr) 换一个满弹匣 仓库里没有满弹匣时返回 nullptr 空弹匣不会被收下
+    Magazine* swapForFull(Magazine* empty);
+    // 交出一个满弹匣 (可以为 nullptr) 换一个空弹匣 仓库里没有空弹匣时新建一个
+    Magazine* swapForEmpty(Magazine* full);
+    // 线程退出时归还弹匣 不满的弹匣先把里面的 slot 放回空闲链表
+    void returnMagazine(Magazine* magazine);
+
 private:
     union Slot
     {
         std::atomic<Slot*> next;
     };
 
-    int                     BlockSize_; // 一整个内存块的大小
+    // 块头 后面紧跟着 slot
+    struct Block
+    {
+        Block*              next;   // 所有块串成链表 析构时释放
+        std::atomic<char*>  cursor; // 下一个可分配的 slot 各线程 fetch_add 抢占
+        char*               end;    // 最后一个 slot 的下一个位置 类似于 iterator 中的 end()
+        size_t              size;   // 整个块的大小 munmap 时使用
+    };
+
+    static const size_t SYSTEM_PAGE_SIZE = 4096;
+    static size_t roundUpPage(size_t size) {
+        return (size + SYSTEM_PAGE_SIZE - 1) & ~(SYSTEM_PAGE_SIZE - 1);
+    }
+
+    // 当前块用完时 分配一个新块并用 CAS 装上 返回新块中的第一个 slot
+    void* allocateBlock(Block* current);
+    // 对齐
+    size_t padPointer(char* p, size_t align);
+
+    // 空闲链表头是一个带版本号的指针
+    // x86-64 / aarch64 用户态地址只用到低 48 位 高 16 位放版本号 每次修改都加一
+    // 这样 A 被弹出又压回之后 head 的值也不同了 CAS 不会误判 (ABA)
+    static const int        TAG_SHIFT = 48;
+    static const uint64_t   POINTER_MASK = (uint64_t(1) << TAG_SHIFT) - 1;
+    static_assert(sizeof(void*) == 8, "tagged pointer needs a 64-bit address space");
+
+    static uint64_t pack(const void* ptr, uint64_t tag) {
+        return reinterpret_cast<uintptr_t>(ptr) | (tag << TAG_SHIFT);
+    }
+    template <typename T>
+    static T* unpack(uint64_t head) {
+        return reinterpret_cast<T*>(head & POINTER_MASK);
+    }
+    static uint64_t unpackTag(uint64_t head) {
+        return head >> TAG_SHIFT;
+    }
+
+private:
+    size_t                  BlockSize_; // 第一个内存块的大小
+    size_t                  MaxBlockSize_; // 内存块大小的上限
     int                     SlotSize_; // 一个插槽的大小
+    std::atomic<size_t>     nextBlockSize_; // 下一个内存块的大小 每装上一个新块就翻倍
+
+    // 两个都是无锁的 分开放在不同的缓存行 避免释放和切分互相干扰
+    alignas(64) std::atomic<uint64_t>   freeListHead_;  // 空闲链表头，回收的 slot (Treiber 栈)
+    alignas(64) std::atomic<Block*>     currentBlock_;  // 最近分配的内存块 也是块链表的表头
+
+    // 弹匣仓库 同样是带版本号的 Treiber 栈 弹匣只在析构时释放
+    static Magazine* popMagazine(std::atomic<uint64_t>& stack);
+    static void pushMagazine(std::atomic<uint64_t>& stack, Magazine* magazine);
+
+    alignas(64) std::atomic<uint64_t>   fullMagazines_;
+    std::atomic<uint64_t>               emptyMagazines_;
+};
+
+// 每个线程每个 size class 两个弹匣 (loaded / previous) Bonwick 的做法
+// 绝大多数 useMemory / freeMemory 只在自己的弹匣上操作 不碰共享的 MemoryPool
+// 两个弹匣都空 (满) 时才用一个空 (满) 弹匣去仓库整个交换
+// 保留两个而不是一个 是为了在弹匣边界上反复申请释放时不会每次都去仓库
+class ThreadMagazines
+{
+public:
+    // 线程退出 析构之后返回 nullptr 调用者直接使用 MemoryPool
+    static ThreadMagazines* getInstance() {
+        if (destroyed_) return nullptr;
+        static thread_local ThreadMagazines instance;
+        return &instance;
+    }
+
+    void* allocate(int index) {
+        Magazine* loaded = loaded_[index];
+        if (loaded && loaded->count > 0) {
+            return loaded->rounds[--loaded->count];
+        }
+        return allocateSlow(index);
+    }
+
+    void deallocate(int index, void* ptr) {
+        Magazine* loaded = loaded_[index];
+        if (loaded && loaded->count < MAGAZINE_SIZE) {
+            loaded->rounds[loaded->count++] = ptr;
+            return;
+        }
+        deallocateSlow(index, ptr);
+    }
+
+private:
+    ThreadMagazines() = default;
+    ~ThreadMagazines();
+
+    void* allocateSlow(int index);
+    void deallocateSlow(int index, void* ptr);
 
-    Slot*                   blockListHead_;      // 最近分配的内存块链表头
-    Slot*                   currentBlockEnd_;    // 当前块中最后一个可用 slot 的下一个位置 类似于 iterator 中的 end()
-    Slot*                   nextAvailableSlot_;  // 当前块中下一个可分配的 slot
-    Slot*                   freeListHead_;       // 空闲链表头，回收的 slot
-    
-    std::mutex              mutexForFreeList_;
-    std::mutex              mutexForBlock_;
+private:
+    Magazine*                       loaded_[MEMORY_POOL_NUM] = {};
+    Magazine*                       previous_[MEMORY_POOL_NUM] = {};
+    static thread_local bool        destroyed_;
 };
 
 class HashBucket
 {
 public:
-    static void initMemoryPool();
+    static void initMemoryPool(const MemoryPoolOptions& options = MemoryPoolOptions());
     // 从 Bucket 中取对应大小的 pool
     static MemoryPool& getMemoryPool(int index);
 
@@ -64,8 +178,51 @@ public:
     // ptr 地址
     // size 大小
     static void freeMemory(void* ptr, size_t size);
+
+    // 大小 -> pool 下标 向上取整 编译期也可以计算
+    static constexpr int getIndex(size_t size) {
+        return static_cast<int>((size + SLOT_BASE_SIZE - 1) / SLOT_BASE_SIZE) - 1;
+    }
+
+private:
+    // 已经知道下标时的快速路径 ObjectPool 在编译期算好下标后直接内联到这里
+    // 打开 HeapProfiler 时 useMemory 和 ObjectPool 的分配释放都在这里采样
+    static void* allocateAt(int index) {
+        void* ptr = allocateFromPool(index);
+        HeapProfiler::recordAllocation(ptr, static_cast<size_t>(index + 1) * SLOT_BASE_SIZE);
+        return ptr;
+    }
+
+    static void deallocateAt(int index, void* ptr) {
+        HeapProfiler::recordFree(ptr);
+        deallocateToPool(index, ptr);
+    }
+
+    static void* allocateFromPool(int index) {
+        if (useMagazine_) {
+            if (ThreadMagazines* magazines = ThreadMagazines::getInstance()) {
+                return magazines->allocate(index);
+            }
+        }
+        return pools_[index].allocate();
+    }
+
+    static void deallocateToPool(int index, void* ptr) {
+        if (useMagazine_) {
+            if (ThreadMagazines* magazines = ThreadMagazines::getInstance()) {
+                magazines->deallocate(index, ptr);
+                return;
+            }
+        }
+        pools_[index].deallocate(ptr);
+    }
+
 private:
     static MemoryPool pools_[MEMORY_POOL_NUM];
+    static bool       useMagazine_;
+
+    template<typename T>
+    friend class ObjectPool;
 
     // 通过声明为模板友元函数 兼顾模板T和对类内私有成员的访问权限
     template<typename T, typename... Args>
@@ -75,28 +232,141 @@ private:
     friend void deleteElement(T* p);
 };
 
-// 这里的
-template<typename T, typename... Args>
-T* newElement(Args&&... args) {
-    T* p = nullptr;
-    if ((p = reinterpret_cast<T*>(HashBucket::useMemory(sizeof(T)))) != nullptr) {
+// 按类型分配
+// sizeof(T) alignof(T) 都是编译期常量 所以 pool 下标 走不走内存池 都在编译期决定
+// 快速路径内联之后只剩 弹匣上的一次出栈 / 入栈
+// alignof(T) > 8 时 把大小向上取整到 alignof(T) 的倍数 这样的 pool 中每个 slot 都满足对齐 (见 MAX_SLOT_ALIGN)
+// 超过 MAX_SLOT_SIZE 或 MAX_SLOT_ALIGN 的类型交给 operator new
+template<typename T>
+class ObjectPool
+{
+public:
+    static constexpr size_t ALIGN = alignof(T) > SLOT_BASE_SIZE ? alignof(T) : SLOT_BASE_SIZE;
+    static constexpr size_t SIZE = (sizeof(T) + ALIGN - 1) / ALIGN * ALIGN;
+    static constexpr bool   USE_POOL = SIZE <= MAX_SLOT_SIZE && ALIGN <= MAX_SLOT_ALIGN;
+    static constexpr int    INDEX = HashBucket::getIndex(SIZE);
+
+    template<typename... Args>
+    static T* create(Args&&... args) {
+        void* p = allocateBytes(SIZE);
+        if (p == nullptr) return nullptr;
         // 常用于完美转发（perfect forwarding）中。
         // 它的主要作用是保证参数按照调用站点的形式进行转发，
         // 不引入额外的类型转换。
         // 这对于实现函数模板尤其有用，
         // 可以确保接收泛型参数的函数能够正确地将这些参数传递给其他函数，
         // 而不会因为类型导致参数的丢失或误用。
-        new(p) T(std::forward<Args>(args)...);
+        try {
+            return new(p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocateBytes(p, SIZE);
+            throw;
+        }
+    }
+
+    static void destroy(T* p) {
+        if (p) {
+            p->~T();
+            deallocateBytes(p, SIZE);
+        }
+    }
+
+    // 数组的大小只有运行时才知道 释放时需要传回同样的 n
+    static T* createArray(size_t n) {
+        T* p = reinterpret_cast<T*>(allocate(n));
+        if (p == nullptr) return nullptr;
+
+        size_t constructed = 0;
+        try {
+            for (; constructed < n; ++constructed) {
+                new(p + constructed) T();
+            }
+        } catch (...) {
+            while (constructed > 0) {
+                p[--constructed].~T();
+            }
+            deallocate(p, n);
+            throw;
+        }
+        return p;
+    }
+
+    static void destroyArray(T* p, size_t n) {
+        if (p == nullptr) return;
+        for (size_t i = n; i > 0; --i) {
+            p[i - 1].~T();
+        }
+        deallocate(p, n);
     }
-    return p;
+
+    // 只分配 / 释放 n 个 T 的内存 不构造 供 PoolAllocator 使用
+    // n == 1 时全部在编译期决定
+    static void* allocate(size_t n = 1) {
+        if (n == 1) return allocateBytes(SIZE);
+        if (n == 0 || n > SIZE_MAX / sizeof(T)) return nullptr;
+        return allocateBytes(arrayBytes(n));
+    }
+
+    static void deallocate(void* p, size_t n = 1) {
+        if (p == nullptr) return;
+        deallocateBytes(p, n == 1 ? SIZE : arrayBytes(n));
+    }
+
+private:
+    static size_t arrayBytes(size_t n) {
+        return (n * sizeof(T) + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+    static void* allocateBytes(size_t bytes) {
+        if (USE_POOL && bytes == SIZE) {
+            return HashBucket::allocateAt(INDEX);
+        }
+        if (ALIGN <= MAX_SLOT_ALIGN && bytes <= MAX_SLOT_SIZE) {
+            return HashBucket::allocateAt(HashBucket::getIndex(bytes));
+        }
+        if constexpr (ALIGN > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return operator new(bytes, std::align_val_t(ALIGN));
+        } else {
+            return operator new(bytes);
+        }
+    }
+
+    static void deallocateBytes(void* p, size_t bytes) {
+        if (USE_POOL && bytes == SIZE) {
+            HashBucket::deallocateAt(INDEX, p);
+            return;
+        }
+        if (ALIGN <= MAX_SLOT_ALIGN && bytes <= MAX_SLOT_SIZE) {
+            HashBucket::deallocateAt(HashBucket::getIndex(bytes), p);
+            return;
+        }
+        if constexpr (ALIGN > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            operator delete(p, std::align_val_t(ALIGN));
+        } else {
+            operator delete(p);
+        }
+    }
+};
+
+template<typename T, typename... Args>
+T* newElement(Args&&... args) {
+    return ObjectPool<T>::create(std::forward<Args>(args)...);
 }
 
 template<typename T>
 void deleteElement(T* p) {
-    if (p) {
-        p->~T();
-        HashBucket::freeMemory(reinterpret_cast<void*>(p), sizeof(T));
-    }
+    ObjectPool<T>::destroy(p);
+}
+
+// 默认构造 n 个元素 释放时要传回同样的 n
+template<typename T>
+T* newArray(size_t n) {
+    return ObjectPool<T>::createArray(n);
+}
+
+template<typename T>
+void deleteArray(T* p, size_t n) {
+    ObjectPool<T>::destroyArray(p, n);
 }
 
 } // namespace Pool
\ No newline at end of file
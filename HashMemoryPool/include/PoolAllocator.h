@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "MemoryPool.h"
+
+namespace Pool
+{
+
+// 让 STL 容器直接使用 HashBucket 不用手写 newElement
+
+// std::pmr 接口 大小和对齐都只有运行时才知道
+// 对齐不超过 MAX_SLOT_ALIGN 时把大小向上取整到对齐的倍数 这样的 pool 中每个 slot 都满足对齐
+class PoolResource : public std::pmr::memory_resource
+{
+public:
+    // 所有 PoolResource 共用同一组 pool 一个就够了
+    static PoolResource* getInstance() {
+        static PoolResource instance;
+        return &instance;
+    }
+
+private:
+    static size_t roundUp(size_t bytes, size_t alignment) {
+        alignment = alignment < SLOT_BASE_SIZE ? SLOT_BASE_SIZE : alignment;
+        return (bytes + alignment - 1) / alignment * alignment;
+    }
+
+    static bool usePool(size_t bytes, size_t alignment) {
+        return alignment <= MAX_SLOT_ALIGN && roundUp(bytes, alignment) <= MAX_SLOT_SIZE;
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        if (bytes == 0) bytes = 1;
+        if (!usePool(bytes, alignment)) {
+            return operator new(bytes, std::align_val_t(alignment));
+        }
+        void* p = HashBucket::useMemory(roundUp(bytes, alignment));
+        if (p == nullptr) throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        if (bytes == 0) bytes = 1;
+        if (!usePool(bytes, alignment)) {
+            operator delete(p, std::align_val_t(alignment));
+            return;
+        }
+        HashBucket::freeMemory(p, roundUp(bytes, alignment));
+    }
+
+    // 背后都是同一组全局的 pool 任意两个 PoolResource 分配的内存都可以互相释放
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return dynamic_cast<const PoolResource*>(&other) != nullptr;
+    }
+};
+
+// 满足 Allocator 要求的分配器
+// 容器 rebind 到节点类型之后 绝大多数是 n == 1 的申请 这时走 ObjectPool<T> 编译期决定的快速路径
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        void* p = ObjectPool<T>::allocate(n);
+        if (p == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        ObjectPool<T>::deallocate(p, n);
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+} // namespace Pool
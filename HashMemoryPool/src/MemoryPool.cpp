@@ -1,27 +1,39 @@
 #include "MemoryPool.h"
 
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
+
 namespace Pool
 {
 
 // MemoryPool 成员函数实现
-MemoryPool::MemoryPool(size_t BlockSize)
-    : BlockSize_(BlockSize)
+MemoryPool::MemoryPool(size_t BlockSize, size_t MaxBlockSize)
+    : BlockSize_(roundUpPage(BlockSize))
+    , MaxBlockSize_(std::max(roundUpPage(MaxBlockSize), roundUpPage(BlockSize)))
     , SlotSize_(0)
-    , blockListHead_(nullptr)
-    , currentBlockEnd_(nullptr)
-    , nextAvailableSlot_(nullptr)
-    , freeListHead_(nullptr)
+    , nextBlockSize_(roundUpPage(BlockSize))
+    , freeListHead_(0)
+    , currentBlock_(nullptr)
+    , fullMagazines_(0)
+    , emptyMagazines_(0)
 {}
 
 
 // 析构函数 遍历 删除指针
 MemoryPool::~MemoryPool() {
-    Slot* cur = blockListHead_;
+    Block* cur = currentBlock_.load(std::memory_order_relaxed);
     while (cur) {
-        Slot* next = cur->next;
-        operator delete(reinterpret_cast<void*>(cur));
+        Block* next = cur->next;
+        munmap(cur, cur->size);
         cur = next;
     }
+
+    for (auto* stack : {&fullMagazines_, &emptyMagazines_}) {
+        while (Magazine* magazine = popMagazine(*stack)) {
+            delete magazine;
+        }
+    }
 }
 
 // 初始化 Slot 的 size 为后面的 hashbucket 做准备
@@ -30,66 +42,150 @@ void MemoryPool::init(size_t slotSize) {
     SlotSize_ = slotSize;
 }
 
+void MemoryPool::setBlockSize(size_t blockSize, size_t maxBlockSize) {
+    BlockSize_ = roundUpPage(blockSize);
+    MaxBlockSize_ = std::max(roundUpPage(maxBlockSize), BlockSize_);
+    nextBlockSize_.store(BlockSize_, std::memory_order_relaxed);
+}
+
 // 在块中分配内存
+// 原来先在锁外读 freeListHead_ 再加锁弹出 每次分配都要过一次互斥锁 而且锁外的检查本身就是竞态
+// 现在两条路径都是无锁的:
+// 1. 空闲链表是 Treiber 栈 CAS 弹出栈顶
+// 2. 空闲链表为空时 在当前块上 fetch_add 切出一个 slot
 void* MemoryPool::allocate() {
-    if (freeListHead_ != nullptr) {
-        std::lock_guard<std::mutex> lock(mutexForFreeList_);
-
-        Slot* result = reinterpret_cast<Slot*>(freeListHead_);
-        freeListHead_ = freeListHead_->next;
-        return result;
-    } else {
-        std::lock_guard<std::mutex> lock(mutexForBlock_);
-        
-        if (nextAvailableSlot_ >= currentBlockEnd_) {
-            allocateBlock();
+    uint64_t head = freeListHead_.load(std::memory_order_acquire);
+    while (Slot* slot = unpack<Slot>(head)) {
+        // slot 可能已经被别的线程弹出并交给用户 这里读到的 next 可能是垃圾
+        // 但那样的话 head 的版本号一定变了 下面的 CAS 会失败 重新来过
+        // 块只在析构时才还给系统 所以读它本身是安全的
+        Slot* next = slot->next.load(std::memory_order_relaxed);
+        if (freeListHead_.compare_exchange_weak(head, pack(next, unpackTag(head) + 1),
+                std::memory_order_acquire, std::memory_order_acquire)) {
+            return slot;
         }
-        Slot* result = nextAvailableSlot_;
-        // 更新下一个 可用的内存槽
-        nextAvailableSlot_ = reinterpret_cast<Slot*>(reinterpret_cast<char*>(nextAvailableSlot_) + SlotSize_);
-        return result; // return 一个可用的内存槽地址
     }
+
+    Block* block = currentBlock_.load(std::memory_order_acquire);
+    if (block) {
+        char* result = block->cursor.fetch_add(SlotSize_, std::memory_order_relaxed);
+        if (result < block->end) {
+            return result;
+        }
+    }
+    // 当前块用完了 (多个线程可能同时走到这里 cursor 越过 end 也没有关系)
+    return allocateBlock(block);
 }
 
-// 释放块中的一块内存
+// 释放块中的一块内存 压回 Treiber 栈
 void MemoryPool::deallocate(void* ptr) {
     if (ptr == nullptr) return;
 
-    std::lock_guard<std::mutex> lock(mutexForFreeList_);
-
-    reinterpret_cast<Slot*>(ptr)->next = freeListHead_;
-    freeListHead_ = reinterpret_cast<Slot*>(ptr);
+    Slot* slot = reinterpret_cast<Slot*>(ptr);
+    uint64_t head = freeListHead_.load(std::memory_order_relaxed);
+    do {
+        slot->next.store(unpack<Slot>(head), std::memory_order_relaxed);
+    } while (!freeListHead_.compare_exchange_weak(head, pack(slot, unpackTag(head) + 1),
+                std::memory_order_release, std::memory_order_relaxed));
 }
 
 
 // 为内存池分配一个新的内存块
-void MemoryPool::allocateBlock() {
-    // 1. 分配一块大小为 BlockSize_ 的原始内存（不调用构造函数）
-    // 强转为 char* 方便后续按字节偏移计算
-    char* newBlock = reinterpret_cast<char*>(operator new(BlockSize_));
+// 不加锁: 先把新块准备好 再 CAS 装到 currentBlock_ 上
+// 如果别的线程抢先装好了 就把自己的新块删掉 回到别人的新块上切分
+void* MemoryPool::allocateBlock(Block* current) {
+    for (;;) {
+        // 1. 块的大小从 BlockSize_ 开始翻倍 原来固定 4096 字节 512 字节的 pool 一次只能切出 7 个 slot
+        // 块至少要放得下块头和一个 slot
+        size_t size = nextBlockSize_.load(std::memory_order_relaxed);
+        size = std::max(size, roundUpPage(sizeof(Block) + MAX_SLOT_ALIGN + SlotSize_));
+
+        // 直接向系统 mmap 按页对齐 不经过 operator new
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return nullptr;
+        // 强转为 char* 方便后续按字节偏移计算
+        char* newBlock = static_cast<char*>(memory);
+
+        // 2. 内存块布局：[块头 Block][对齐填充][实际存储槽位的区域]
+        // 可用区域的起始地址按 MAX_SLOT_ALIGN 对齐 slot 大小是 A 的倍数时每个 slot 都按 A 对齐
+        char* body = newBlock + sizeof(Block);
+        body += padPointer(body, MAX_SLOT_ALIGN);
+
+        // 3. 第一个 slot 直接留给自己 其余的交给 cursor
+        Block* block = new (newBlock) Block;
+        block->next = current;
+        block->cursor.store(body + SlotSize_, std::memory_order_relaxed);
+        // 公式含义：新块总大小 - 最后一个槽位的大小 + 1（指向最后一个槽位的下一位）
+        block->end = newBlock + size - SlotSize_ + 1;
+        block->size = size;
 
-    // 2. 将新块加入内存块链表头部
-    reinterpret_cast<Slot*>(newBlock)->next = blockListHead_;
-    // 再将链表头更新为新块，完成新块的插入
-    blockListHead_ = reinterpret_cast<Slot*>(newBlock);
+        // 4. 装到 currentBlock_ 上 同时也就插入了块链表的头部
+        if (currentBlock_.compare_exchange_strong(current, block,
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+            nextBlockSize_.store(std::min(size * 2, MaxBlockSize_), std::memory_order_relaxed);
+            return body;
+        }
 
-    // 3. 计算内存块中实际可用区域的起始位置
-    // 内存块布局：[块链表指针（Slot*）][实际存储槽位的区域]
-    // 跳过块链表指针占用的空间（sizeof(Slot*)），得到可用区域起始地址
-    char* body = newBlock + sizeof(Slot*);
+        // 别人已经换了新块 current 被更新为它
+        munmap(newBlock, size);
+        char* result = current->cursor.fetch_add(SlotSize_, std::memory_order_relaxed);
+        if (result < current->end) {
+            return result;
+        }
+    }
+}
 
-    // 4. 计算可用区域的对齐填充字节数
-    // 确保可用区域的起始地址满足 Slot 类型的对齐要求（alignof(Slot)）
-    // padPointer 返回需要填充的字节数，使 body + bodyPadding 地址对齐
-    size_t bodyPadding = padPointer(body, alignof(Slot));
+Magazine* MemoryPool::swapForFull(Magazine* empty) {
+    Magazine* full = popMagazine(fullMagazines_);
+    if (full && empty) {
+        pushMagazine(emptyMagazines_, empty);
+    }
+    return full;
+}
 
-    // 5. 设置下一个可分配槽位的地址
-    // 将对齐后的地址强转为 Slot*，作为当前块的首个可用槽位
-    nextAvailableSlot_ = reinterpret_cast<Slot*>(body + bodyPadding);
+Magazine* MemoryPool::swapForEmpty(Magazine* full) {
+    if (full) {
+        pushMagazine(fullMagazines_, full);
+    }
+    Magazine* empty = popMagazine(emptyMagazines_);
+    if (!empty) {
+        empty = new (std::nothrow) Magazine;
+        if (empty) empty->count = 0;
+    }
+    return empty;
+}
 
-    // 6. 计算当前块的可用区域结束位置
-    // 公式含义：新块总大小 - 最后一个槽位的大小 + 1（指向最后一个槽位的下一位）
-    currentBlockEnd_ = reinterpret_cast<Slot*>(newBlock + BlockSize_ - SlotSize_ + 1);
+void MemoryPool::returnMagazine(Magazine* magazine) {
+    if (!magazine) return;
+    if (magazine->count == MAGAZINE_SIZE) {
+        pushMagazine(fullMagazines_, magazine);
+        return;
+    }
+    while (magazine->count > 0) {
+        deallocate(magazine->rounds[--magazine->count]);
+    }
+    pushMagazine(emptyMagazines_, magazine);
+}
+
+// 和空闲链表一样 读 top->next 时 top 可能已经被别人弹出 但版本号会让 CAS 失败
+Magazine* MemoryPool::popMagazine(std::atomic<uint64_t>& stack) {
+    uint64_t head = stack.load(std::memory_order_acquire);
+    while (Magazine* top = unpack<Magazine>(head)) {
+        if (stack.compare_exchange_weak(head, pack(top->next, unpackTag(head) + 1),
+                std::memory_order_acquire, std::memory_order_acquire)) {
+            return top;
+        }
+    }
+    return nullptr;
+}
+
+void MemoryPool::pushMagazine(std::atomic<uint64_t>& stack, Magazine* magazine) {
+    uint64_t head = stack.load(std::memory_order_relaxed);
+    do {
+        magazine->next = unpack<Magazine>(head);
+    } while (!stack.compare_exchange_weak(head, pack(magazine, unpackTag(head) + 1),
+                std::memory_order_release, std::memory_order_relaxed));
 }
 
 // 计算从地址 p 开始按 align 对齐所需要的填充字节数（返回相对于 p 的偏移）
@@ -98,14 +194,76 @@ size_t MemoryPool::padPointer(char* p, size_t align) {
     return (align - result) % align;
 }
 
+// ThreadMagazines 成员函数实现
+thread_local bool ThreadMagazines::destroyed_ = false;
+
+// 线程退出 把弹匣还给仓库 否则里面的 slot 就再也用不到了
+ThreadMagazines::~ThreadMagazines() {
+    for (int i = 0; i < MEMORY_POOL_NUM; ++i) {
+        HashBucket::getMemoryPool(i).returnMagazine(loaded_[i]);
+        HashBucket::getMemoryPool(i).returnMagazine(previous_[i]);
+        loaded_[i] = previous_[i] = nullptr;
+    }
+    destroyed_ = true;
+}
+
+void* ThreadMagazines::allocateSlow(int index) {
+    Magazine*& loaded = loaded_[index];
+    Magazine*& previous = previous_[index];
+
+    // 1. 上一个弹匣还有 交换一下
+    if (previous && previous->count > 0) {
+        std::swap(loaded, previous);
+        return loaded->rounds[--loaded->count];
+    }
+
+    // 2. 两个都空了 用空的 previous 去仓库换一个满的
+    MemoryPool& pool = HashBucket::getMemoryPool(index);
+    if (Magazine* full = pool.swapForFull(previous)) {
+        previous = loaded;
+        loaded = full;
+        return loaded->rounds[--loaded->count];
+    }
+
+    // 3. 仓库里也没有 直接向 MemoryPool 申请
+    return pool.allocate();
+}
+
+void ThreadMagazines::deallocateSlow(int index, void* ptr) {
+    Magazine*& loaded = loaded_[index];
+    Magazine*& previous = previous_[index];
+
+    // 1. 上一个弹匣没满 交换一下
+    if (previous && previous->count < MAGAZINE_SIZE) {
+        std::swap(loaded, previous);
+        loaded->rounds[loaded->count++] = ptr;
+        return;
+    }
+
+    // 2. 两个都满了 把满的 previous 交给仓库 换一个空的
+    MemoryPool& pool = HashBucket::getMemoryPool(index);
+    Magazine* empty = pool.swapForEmpty(previous);
+    if (!empty) {
+        previous = nullptr;
+        pool.deallocate(ptr);
+        return;
+    }
+    previous = loaded;
+    loaded = empty;
+    loaded->rounds[loaded->count++] = ptr;
+}
+
 // HashBucket 静态成员定义和实现
 MemoryPool HashBucket::pools_[MEMORY_POOL_NUM];  // 定义静态成员
+bool       HashBucket::useMagazine_ = true;
 
-void HashBucket::initMemoryPool() {
+void HashBucket::initMemoryPool(const MemoryPoolOptions& options) {
+    useMagazine_ = options.useMagazine;
     for (int i = 0; i < MEMORY_POOL_NUM; ++i) {
         // 这里最多到 512 字节 如果超过 512 字节就直接用 new/malloc 这些系统调用
         // 内存池解决的是小内存带来的内存碎片问题
         getMemoryPool(i).init((i + 1) * SLOT_BASE_SIZE);
+        getMemoryPool(i).setBlockSize(options.blockSize, options.maxBlockSize);
     }
 }
 
@@ -120,7 +278,7 @@ void* HashBucket::useMemory(size_t size) {
     if (size > MAX_SLOT_SIZE) return operator new(size);
 
     // 向上取整
-    return getMemoryPool((size + 7) / SLOT_BASE_SIZE - 1).allocate();
+    return allocateAt(getIndex(size));
 }
 
 void HashBucket::freeMemory(void* ptr, size_t size) {
@@ -129,7 +287,7 @@ void HashBucket::freeMemory(void* ptr, size_t size) {
         operator delete(ptr);
         return;
     }
-    getMemoryPool((size + 7) / SLOT_BASE_SIZE - 1).deallocate(ptr);
+    deallocateAt(getIndex(size), ptr);
 }
 
 } // namespace Pool
\ No newline at end of file
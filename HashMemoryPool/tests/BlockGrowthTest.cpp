@@ -0,0 +1,123 @@
+// 块大小按几何级数增长
+// 第一个块 blockSize 之后每个块翻倍 到 maxBlockSize 为止 块直接 mmap 析构时 munmap
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "MemoryPool.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t PAGE = 4096;
+// 块头放在块的开头 第一个 slot 按 MAX_SLOT_ALIGN 对齐
+static const size_t HEADER = MAX_SLOT_ALIGN;
+
+// 同一个块里切出来的 slot 首尾相接 换块时地址不连续
+// 返回每个块切出了多少个 slot 以及每个块的起始地址
+static std::vector<size_t> carveBlocks(Pool::MemoryPool& pool, size_t slotSize, size_t count,
+                                       std::vector<char*>& blocks) {
+    std::vector<size_t> runs;
+    uintptr_t last = 0;
+    for (size_t i = 0; i < count; ++i) {
+        char* p = static_cast<char*>(pool.allocate());
+        if (reinterpret_cast<uintptr_t>(p) != last + slotSize) {
+            runs.push_back(0);
+            blocks.push_back(p - HEADER);
+        }
+        ++runs.back();
+        last = reinterpret_cast<uintptr_t>(p);
+    }
+    return runs;
+}
+
+void growth_test() {
+    std::cout << "=== 块翻倍 ===" << std::endl;
+    const size_t slotSize = 64;
+    std::vector<char*> blocks;
+    {
+        Pool::MemoryPool pool(4096, 64 * 1024);
+        pool.init(slotSize);
+
+        // 4K 8K 16K 32K 64K 之后一直是 64K
+        std::vector<size_t> expected;
+        size_t total = 0;
+        for (size_t size : {4, 8, 16, 32, 64, 64, 64}) {
+            expected.push_back((size * 1024 - HEADER) / slotSize);
+            total += expected.back();
+        }
+        std::vector<size_t> runs = carveBlocks(pool, slotSize, total, blocks);
+        CHECK(runs == expected);
+
+        // 每个块都是单独 mmap 的 按页对齐
+        for (char* block : blocks) {
+            CHECK(reinterpret_cast<uintptr_t>(block) % PAGE == 0);
+        }
+    }
+
+    // 析构时每个块都 munmap 了
+    unsigned char vec;
+    for (char* block : blocks) {
+        errno = 0;
+        CHECK(mincore(block, PAGE, &vec) == -1 && errno == ENOMEM);
+    }
+}
+
+// 大小向上取整到整页 上限小于第一个块时不再增长
+// slot 比块还大时 块至少放得下块头和一个 slot
+void rounding_test() {
+    std::cout << "=== 取整 ===" << std::endl;
+    std::vector<char*> blocks;
+
+    Pool::MemoryPool pool(5000, 1000);
+    pool.init(128);
+    std::vector<size_t> runs = carveBlocks(pool, 128, 3 * ((8192 - HEADER) / 128), blocks);
+    CHECK(runs == std::vector<size_t>(3, (8192 - HEADER) / 128));
+
+    Pool::MemoryPool small(64, 1 << 20);
+    small.init(MAX_SLOT_SIZE);
+    small.setBlockSize(100, 100);
+    runs = carveBlocks(small, MAX_SLOT_SIZE, 2 * ((PAGE - HEADER) / MAX_SLOT_SIZE), blocks);
+    CHECK(runs == std::vector<size_t>(2, (PAGE - HEADER) / MAX_SLOT_SIZE));
+}
+
+// initMemoryPool 的配置作用到每个 pool 上
+void options_test() {
+    std::cout << "=== MemoryPoolOptions ===" << std::endl;
+    Pool::MemoryPoolOptions options;
+    options.blockSize = 16 * 1024;
+    options.maxBlockSize = 32 * 1024;
+    Pool::HashBucket::initMemoryPool(options);
+
+    const size_t slotSize = 256;
+    std::vector<char*> blocks;
+    size_t first = (16 * 1024 - HEADER) / slotSize;
+    size_t rest = (32 * 1024 - HEADER) / slotSize;
+    std::vector<size_t> runs = carveBlocks(
+        Pool::HashBucket::getMemoryPool(Pool::HashBucket::getIndex(slotSize)),
+        slotSize, first + 2 * rest, blocks);
+    CHECK(runs == std::vector<size_t>({first, rest, rest}));
+}
+
+int main() {
+    growth_test();
+    rounding_test();
+    options_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
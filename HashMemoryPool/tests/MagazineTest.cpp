@@ -0,0 +1,126 @@
+// 线程本地的弹匣
+// 一个线程释放的 slot 装满弹匣之后交给仓库 另一个线程从仓库整个换走
+// 线程退出时手里的弹匣也要还回去 一个 slot 都不能丢
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "MemoryPool.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+// 每一部分用一个别处没有用过的大小 仓库和空闲链表里只有这里放进去的 slot
+static const size_t SIZE = 200;
+
+// 释放的线程: 两个弹匣各留一个在手里 loaded 里放 EXTRA 个 其余的满弹匣都进了仓库
+static const size_t EXTRA = 5;
+static const size_t FREED = MAGAZINE_SIZE * 8 + EXTRA;
+static const size_t IN_DEPOT = FREED - MAGAZINE_SIZE - EXTRA;
+
+void refill_test() {
+    std::cout << "=== 跨线程交换弹匣 ===" << std::endl;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool freed = false;
+    bool exit = false;
+    std::set<void*> slots;
+
+    std::thread worker([&] {
+        std::vector<void*> ptrs(FREED);
+        for (auto& p : ptrs) p = Pool::HashBucket::useMemory(SIZE);
+        for (void* p : ptrs) Pool::HashBucket::freeMemory(p, SIZE);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        slots.insert(ptrs.begin(), ptrs.end());
+        freed = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return exit; });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return freed; });
+    }
+    CHECK(slots.size() == FREED);
+
+    // 仓库里的满弹匣全部换到这个线程 之后仓库空了 只能从块上切新的
+    std::set<void*> got;
+    for (size_t i = 0; i < IN_DEPOT; ++i) {
+        void* p = Pool::HashBucket::useMemory(SIZE);
+        CHECK(slots.count(p) == 1);
+        got.insert(p);
+    }
+    CHECK(got.size() == IN_DEPOT);
+    void* fresh = Pool::HashBucket::useMemory(SIZE);
+    CHECK(slots.count(fresh) == 0);
+
+    // 线程退出 满的 previous 进仓库 不满的 loaded 把 slot 放回空闲链表
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit = true;
+    }
+    cv.notify_all();
+    worker.join();
+
+    for (size_t i = 0; i < MAGAZINE_SIZE + EXTRA; ++i) {
+        void* p = Pool::HashBucket::useMemory(SIZE);
+        CHECK(slots.count(p) == 1);
+        got.insert(p);
+    }
+    CHECK(got == slots);
+    CHECK(slots.count(Pool::HashBucket::useMemory(SIZE)) == 0);
+}
+
+// 弹匣只在本线程里进出 申请释放交替进行时不碰仓库
+void local_test() {
+    std::cout << "=== 本线程的弹匣 ===" << std::endl;
+    const size_t size = 24;
+
+    // 预热 两个弹匣都建好
+    std::vector<void*> ptrs(MAGAZINE_SIZE * 2);
+    for (auto& p : ptrs) p = Pool::HashBucket::useMemory(size);
+    for (void* p : ptrs) Pool::HashBucket::freeMemory(p, size);
+
+    // 后进先出 两个弹匣之内来回都是同一批 slot
+    std::set<void*> warm(ptrs.begin(), ptrs.end());
+    for (int round = 0; round < 100; ++round) {
+        for (auto& p : ptrs) {
+            p = Pool::HashBucket::useMemory(size);
+            CHECK(warm.count(p) == 1);
+        }
+        for (void* p : ptrs) Pool::HashBucket::freeMemory(p, size);
+    }
+
+    // 另一个线程拿不到这些 slot (都在本线程的弹匣里)
+    std::thread([&warm, size] {
+        void* p = Pool::HashBucket::useMemory(size);
+        CHECK(warm.count(p) == 0);
+        Pool::HashBucket::freeMemory(p, size);
+    }).join();
+}
+
+int main() {
+    Pool::HashBucket::initMemoryPool();
+
+    refill_test();
+    local_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
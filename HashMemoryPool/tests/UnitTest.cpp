@@ -5,7 +5,16 @@
 #include <atomic>
 #include <cassert>
 #include <iomanip>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <memory_resource>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "MemoryPool.h"
+#include "HeapProfiler.h"
+#include "PoolAllocator.h"
 
 // 测试用的数据结构
 struct SmallObject {
@@ -29,6 +38,13 @@ struct LargeObject {
     }
 };
 
+struct alignas(64) AlignedObject {
+    char data[80];  // 80 bytes 按 64 对齐 -> 128 字节的 pool
+    AlignedObject() {
+        for (int i = 0; i < 80; i++) data[i] = i % 256;
+    }
+};
+
 class Timer {
 private:
     std::chrono::high_resolution_clock::time_point start_;
@@ -294,22 +310,206 @@ void extreme_stress_test() {
     std::cout << std::endl;
 }
 
+// 多种大小 + 跨线程释放 检查无锁空闲链表不会把同一个 slot 发给两个线程
 void extreme_stress_test_new() {
-    std::cout << "=== 极端压力测试 ===" << std::endl;
+    std::cout << "=== 跨线程释放压力测试 ===" << std::endl;
     
     const size_t nthreads = 8;
     const size_t ntimes = 50000;  // 每个线程5万次
     
-    std::cout << nthreads << " 个线程，每个线程 " << ntimes << " 次快速分配释放" << std::endl;
+    std::cout << nthreads << " 个线程，每个线程 " << ntimes << " 次分配 由下一个线程释放" << std::endl;
     
     std::vector<std::thread> threads;
     std::atomic<bool> error_occurred{false};
+    // 每个线程分配的对象交给下一个线程释放
+    std::vector<std::vector<SmallObject*>> small(nthreads);
+    std::vector<std::vector<MediumObject*>> medium(nthreads);
     
     Timer timer;
     
-    auto worker = [&error_occurred, ntimes](int thread_id) {
+    auto producer = [&](int thread_id) {
+        small[thread_id].reserve(ntimes);
+        medium[thread_id].reserve(ntimes / 10);
+        for (size_t i = 0; i < ntimes; i++) {
+            small[thread_id].push_back(Pool::newElement<SmallObject>(thread_id, i, 0, 0));
+            if (i % 10 == 0) {
+                medium[thread_id].push_back(Pool::newElement<MediumObject>());
+            }
+        }
+    };
+    
+    auto consumer = [&](int thread_id) {
+        int owner = (thread_id + 1) % nthreads;
+        for (size_t i = 0; i < small[owner].size(); i++) {
+            SmallObject* p = small[owner][i];
+            if (p->data[0] != owner || p->data[1] != static_cast<int>(i)) {
+                error_occurred.store(true);
+            }
+            Pool::deleteElement(p);
+        }
+        for (MediumObject* p : medium[owner]) {
+            for (int k = 0; k < 128; k++) {
+                if (p->data[k] != static_cast<char>(k % 256)) {
+                    error_occurred.store(true);
+                    break;
+                }
+            }
+            Pool::deleteElement(p);
+        }
+    };
+    
+    for (size_t i = 0; i < nthreads; i++) {
+        threads.emplace_back(producer, i);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    threads.clear();
+    
+    for (size_t i = 0; i < nthreads; i++) {
+        threads.emplace_back(consumer, i);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    
+    long total_time = timer.elapsed_ms();
+    
+    if (!error_occurred) {
+        std::cout << "跨线程释放压力测试通过! 总耗时: " << total_time << " ms" << std::endl;
+    } else {
+        std::cout << "跨线程释放压力测试失败! 对象内容被覆盖" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+// 对齐的类型和数组
+void aligned_and_array_test() {
+    std::cout << "=== 对齐与数组测试 ===" << std::endl;
+    
+    bool ok = true;
+    std::vector<AlignedObject*> objects;
+    for (int i = 0; i < 10000; i++) {
+        AlignedObject* p = Pool::newElement<AlignedObject>();
+        if (reinterpret_cast<uintptr_t>(p) % alignof(AlignedObject) != 0) ok = false;
+        objects.push_back(p);
+    }
+    for (auto* p : objects) {
+        if (p->data[79] != 79) ok = false;
+        Pool::deleteElement(p);
+    }
+    
+    for (size_t n = 1; n < 200; n++) {
+        MediumObject* arr = Pool::newArray<MediumObject>(n);  // 超过 512 字节后交给 operator new
+        for (size_t i = 0; i < n; i++) {
+            if (arr[i].data[127] != 127) ok = false;
+        }
+        Pool::deleteArray(arr, n);
         
+        AlignedObject* aligned = Pool::newArray<AlignedObject>(n);
+        if (reinterpret_cast<uintptr_t>(aligned) % alignof(AlignedObject) != 0) ok = false;
+        Pool::deleteArray(aligned, n);
+    }
+    
+    std::cout << (ok ? "对齐与数组测试通过!" : "对齐与数组测试失败!") << std::endl;
+    std::cout << std::endl;
+}
+
+// STL 容器 map 插入删除反复进行
+template<typename Map>
+long map_churn(Map& m) {
+    const int nkeys = 10000;
+    const int nrounds = 100;
+    Timer timer;
+    for (int round = 0; round < nrounds; round++) {
+        for (int i = 0; i < nkeys; i++) {
+            m.emplace((i * 7919 + round) % (nkeys * 2), i);
+        }
+        for (int i = 0; i < nkeys; i++) {
+            m.erase((i * 104729 + round) % (nkeys * 2));
+        }
     }
+    return timer.elapsed_ms();
+}
+
+void stl_allocator_test() {
+    std::cout << "=== STL 分配器测试 ===" << std::endl;
+    
+    using Alloc = Pool::PoolAllocator<std::pair<const int, int>>;
+    
+    std::map<int, int> std_map;
+    std::map<int, int, std::less<int>, Alloc> pool_map;
+    std::pmr::map<int, int> pmr_map(Pool::PoolResource::getInstance());
+    
+    long std_time = map_churn(std_map);
+    long pool_time = map_churn(pool_map);
+    long pmr_time = map_churn(pmr_map);
+    
+    std::cout << "std::map + std::allocator: " << std_time << " ms" << std::endl;
+    std::cout << "std::map + PoolAllocator: " << pool_time << " ms" << std::endl;
+    std::cout << "std::pmr::map + PoolResource: " << pmr_time << " ms" << std::endl;
+    
+    bool ok = std_map == std::map<int, int>(pool_map.begin(), pool_map.end()) &&
+              std_map == std::map<int, int>(pmr_map.begin(), pmr_map.end());
+    
+    // 其他常见容器
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Alloc> hash_map;
+    std::list<int, Pool::PoolAllocator<int>> list;
+    std::vector<double, Pool::PoolAllocator<double>> vec;
+    for (int i = 0; i < 100000; i++) {
+        hash_map[i] = i;
+        list.push_back(i);
+        vec.push_back(i);
+    }
+    for (int i = 0; i < 100000; i += 2) {
+        hash_map.erase(i);
+    }
+    ok = ok && hash_map.size() == 50000 && list.size() == 100000 && vec[99999] == 99999;
+    
+    std::cout << (ok ? "STL 分配器测试通过!" : "STL 分配器测试失败!") << std::endl;
+    std::cout << std::endl;
+}
+
+// 折叠栈每行最后是还原后的字节数 全部加起来
+static double folded_total_bytes(bool cumulative) {
+    char* buf = nullptr;
+    size_t len = 0;
+    FILE* out = open_memstream(&buf, &len);
+    Pool::HeapProfiler::dump(out, Pool::ProfileFormat::Folded, cumulative);
+    fclose(out);
+
+    double total = 0;
+    for (char* line = strtok(buf, "\n"); line; line = strtok(nullptr, "\n")) {
+        if (const char* space = strrchr(line, ' ')) total += atof(space + 1);
+    }
+    free(buf);
+    return total;
+}
+
+void heap_profiler_test() {
+    std::cout << "=== 堆分析器测试 ===" << std::endl;
+
+    const size_t size = 256;
+    const size_t count = 64 * 1024;   // 共 16MB
+    Pool::HeapProfiler::start(64 * 1024);
+
+    std::vector<void*> held(count);
+    for (auto& p : held) p = Pool::HashBucket::useMemory(size);
+    double live = folded_total_bytes(false);
+
+    for (void* p : held) Pool::HashBucket::freeMemory(p, size);
+    double afterFree = folded_total_bytes(false);
+    double cumulative = folded_total_bytes(true);
+    Pool::HeapProfiler::stop();
+
+    double expected = static_cast<double>(size * count);
+    std::cout << "存活估计: " << live / 1024 / 1024 << " MB (实际 "
+              << expected / 1024 / 1024 << " MB)" << std::endl;
+    bool ok = live > expected * 0.7 && live < expected * 1.3 &&
+              afterFree == 0 && cumulative >= live;
+
+    std::cout << (ok ? "堆分析器测试通过!" : "堆分析器测试失败!") << std::endl;
+    std::cout << std::endl;
 }
 
 int main() {
@@ -327,6 +527,10 @@ int main() {
         fragmentation_resistance_test();
         multithread_stress_test();
         extreme_stress_test();
+        extreme_stress_test_new();
+        aligned_and_array_test();
+        stl_allocator_test();
+        heap_profiler_test();
         
         std::cout << "==========================================" << std::endl;
         std::cout << "所有性能测试完成!" << std::endl;
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace Pool
+{
+
+enum class ProfileFormat {
+    Pprof,      // gperftools 的 heap profile 文本格式 (heap_v2) pprof 可以直接读 按采样间隔还原
+    Folded,     // flamegraph.pl 的折叠栈 每行 "外层;...;内层 字节数" 字节数已经按采样还原
+};
+
+// 采样的堆分析器
+// 平均每分配 sampleBytes 字节采一次样 间隔服从指数分布 (几何采样) 大块更容易被采到
+// 采到时用 backtrace 记下调用栈 按指针登记为存活的样本 释放时删除
+// dump 按调用栈汇总 输出存活的和开始以来累计的分配
+//
+// 没有打开时快速路径只多一次原子读 打开后每次分配多一次线程局部的减法
+// 释放时先查一个按地址散列的计数表 绝大多数没有被采样的指针不会进锁
+// 样本和调用栈的存储直接 mmap 不会回到内存池里
+class HeapProfiler {
+public:
+    static const size_t DEFAULT_SAMPLE_BYTES = 2 * 1024 * 1024;
+    static const size_t MAX_DEPTH = 32;
+
+    // 已经采到的样本在 stop 之后仍然保留 可以继续 dump 再次 start 接着累计
+    static void start(size_t sampleBytes = DEFAULT_SAMPLE_BYTES);
+    static void stop();
+    static bool isRunning() { return running_.load(std::memory_order_relaxed); }
+
+    static void recordAllocation(void* ptr, size_t size) {
+        if (!isRunning() || ptr == nullptr) return;
+        bytesUntilSample_ -= static_cast<int64_t>(size);
+        if (bytesUntilSample_ < 0) {
+            sample(ptr, size);
+        }
+    }
+
+    static void recordFree(void* ptr) {
+        if (liveSamples_.load(std::memory_order_relaxed) == 0 || ptr == nullptr) return;
+        if (__atomic_load_n(&filter_[filterIndex(ptr)], __ATOMIC_RELAXED) == 0) return;
+        removeSample(ptr);
+    }
+
+    // cumulative 为 false 时只输出还没有释放的样本 (找内存增长) 否则输出开始以来的所有分配 (找分配热点)
+    static void dump(FILE* out, ProfileFormat format = ProfileFormat::Pprof, bool cumulative = false);
+
+private:
+    // 采样的慢速路径 不内联 backtrace 从它的调用者开始记录
+    __attribute__((noinline)) static void sample(void* ptr, size_t size);
+    static void removeSample(void* ptr);
+
+    // 直接取地址的低位 相邻的块落在相邻的位置 释放时访问的计数和块本身一样有局部性
+    static const size_t FILTER_SIZE = size_t(1) << 16;
+    static size_t filterIndex(const void* ptr) {
+        return (reinterpret_cast<uintptr_t>(ptr) >> 4) & (FILTER_SIZE - 1);
+    }
+
+    static std::atomic<bool>        running_;
+    static std::atomic<size_t>      liveSamples_;
+    // 每个散列位置上存活的样本数 只在持有锁时修改
+    static uint16_t                 filter_[FILTER_SIZE];
+    // 距离下一次采样还剩的字节数
+    // 定义在头文件里 编译器看得到它是常量初始化 快速路径上不会调用 TLS 的初始化函数
+    __attribute__((tls_model("initial-exec"))) static inline thread_local int64_t bytesUntilSample_ = 0;
+};
+
+} // namespace Pool
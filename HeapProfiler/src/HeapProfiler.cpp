@@ -0,0 +1,336 @@
+#include <cmath>
+#include <cstring>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../include/HeapProfiler.h"
+
+namespace Pool
+{
+
+std::atomic<bool>       HeapProfiler::running_{false};
+std::atomic<size_t>     HeapProfiler::liveSamples_{0};
+uint16_t                HeapProfiler::filter_[HeapProfiler::FILTER_SIZE];
+
+namespace
+{
+
+// 同一个调用栈的所有样本
+struct StackRecord {
+    StackRecord*    next;
+    uint64_t        hash;
+    size_t          depth;
+    void*           frames[HeapProfiler::MAX_DEPTH];
+    // 采到的样本数和样本的字节数 pprof 自己按采样间隔还原
+    uint64_t        allocSamples;
+    uint64_t        allocBytes;
+    uint64_t        liveSamples;
+    uint64_t        liveBytes;
+    // 按采样概率还原之后的估计值 折叠栈输出用
+    double          allocEstimate;
+    double          liveEstimate;
+};
+
+struct Sample {
+    Sample*         next;
+    void*           ptr;
+    size_t          size;
+    double          estimate;
+    StackRecord*    stack;
+};
+
+// 样本和调用栈直接从 mmap 的大块中切 不经过 malloc 否则采样时会重新走进内存池
+template <typename T>
+class NodeArena {
+public:
+    T* create() {
+        if (freeList_) {
+            T* node = freeList_;
+            freeList_ = node->next;
+            return node;
+        }
+        if (remaining_ == 0) {
+            void* chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk == MAP_FAILED) return nullptr;
+            current_ = static_cast<T*>(chunk);
+            remaining_ = CHUNK_SIZE / sizeof(T);
+        }
+        --remaining_;
+        return current_++;
+    }
+
+    void destroy(T* node) {
+        node->next = freeList_;
+        freeList_ = node;
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    T*      current_ = nullptr;
+    size_t  remaining_ = 0;
+    T*      freeList_ = nullptr;
+};
+
+const size_t STACK_BUCKETS = 4096;
+const size_t SAMPLE_BUCKETS = 16384;
+
+// 以下全部由 profileMutex 保护
+std::mutex              profileMutex;
+StackRecord*            stackTable[STACK_BUCKETS];
+Sample*                 sampleTable[SAMPLE_BUCKETS];
+NodeArena<StackRecord>  stackArena;
+NodeArena<Sample>       sampleArena;
+
+std::atomic<size_t>     sampleBytes{HeapProfiler::DEFAULT_SAMPLE_BYTES};
+// 每次 start 加一 线程发现自己的间隔属于上一轮时重新抽一个
+std::atomic<uint64_t>   epoch{0};
+
+struct ThreadState {
+    uint64_t    epoch = 0;
+    uint64_t    rng = 0;
+    // 本线程正在分析器内部 (dump 中的 fprintf 可能申请释放内存) 不再采样 也不去抢锁
+    bool        busy = false;
+};
+__attribute__((tls_model("initial-exec"))) thread_local ThreadState threadState;
+
+size_t sampleIndex(const void* ptr) {
+    return (reinterpret_cast<uintptr_t>(ptr) >> 4) % SAMPLE_BUCKETS;
+}
+
+// xorshift64* 种子取线程局部变量的地址 每个线程不同
+double uniform(ThreadState& state) {
+    if (state.rng == 0) {
+        state.rng = reinterpret_cast<uintptr_t>(&state) * 0x9E3779B97F4A7C15ULL | 1;
+    }
+    state.rng ^= state.rng >> 12;
+    state.rng ^= state.rng << 25;
+    state.rng ^= state.rng >> 27;
+    uint64_t bits = (state.rng * 0x2545F4914F6CDD1DULL) >> 11;
+    // (0, 1] 避免 log(0)
+    return (static_cast<double>(bits) + 1.0) / 9007199254740992.0;
+}
+
+// 指数分布 均值为 sampleBytes 相当于每个字节以 1 / sampleBytes 的概率被选中
+int64_t nextInterval(ThreadState& state) {
+    double mean = static_cast<double>(sampleBytes.load(std::memory_order_relaxed));
+    return static_cast<int64_t>(-std::log(uniform(state)) * mean) + 1;
+}
+
+uint64_t hashStack(void* const* frames, size_t depth) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < depth; ++i) {
+        hash = (hash ^ reinterpret_cast<uintptr_t>(frames[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+StackRecord* findOrCreateStack(void* const* frames, size_t depth) {
+    uint64_t hash = hashStack(frames, depth);
+    StackRecord*& bucket = stackTable[hash % STACK_BUCKETS];
+    for (StackRecord* record = bucket; record; record = record->next) {
+        if (record->hash == hash && record->depth == depth &&
+                memcmp(record->frames, frames, depth * sizeof(void*)) == 0) {
+            return record;
+        }
+    }
+
+    StackRecord* record = stackArena.create();
+    if (!record) return nullptr;
+    memset(record, 0, sizeof(*record));
+    record->hash = hash;
+    record->depth = depth;
+    memcpy(record->frames, frames, depth * sizeof(void*));
+    record->next = bucket;
+    bucket = record;
+    return record;
+}
+
+// 不用 backtrace_symbols / __cxa_demangle: 它们会申请内存 而这里持有锁
+// 输出的是修饰过的名字 可以交给 c++filt 还原
+void printFrame(FILE* out, void* frame) {
+    Dl_info info;
+    if (dladdr(frame, &info) && info.dli_sname) {
+        fputs(info.dli_sname, out);
+    } else {
+        fprintf(out, "%p", frame);
+    }
+}
+
+void copyMaps(FILE* out) {
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, static_cast<size_t>(n), out);
+    }
+    close(fd);
+}
+
+} // namespace
+
+void HeapProfiler::start(size_t bytes) {
+    // 第一次调用 backtrace 时 glibc 会 dlopen libgcc_s 里面要申请内存 提前在这里做掉
+    void* frames[1];
+    backtrace(frames, 1);
+
+    sampleBytes.store(bytes ? bytes : DEFAULT_SAMPLE_BYTES, std::memory_order_relaxed);
+    epoch.fetch_add(1, std::memory_order_relaxed);
+    running_.store(true, std::memory_order_release);
+}
+
+void HeapProfiler::stop() {
+    running_.store(false, std::memory_order_relaxed);
+}
+
+// 一个样本代表了所有没有被采到的同样大小的分配
+// 大小为 size 的分配被采到的概率是 1 - exp(-size / sampleBytes) 样本的权重是它的倒数
+void HeapProfiler::sample(void* ptr, size_t size) {
+    ThreadState& state = threadState;
+    if (state.busy) {
+        bytesUntilSample_ = nextInterval(state);
+        return;
+    }
+
+    // 本线程还没有抽过间隔 (新线程 或者重新 start 过) 这一次不采样
+    uint64_t current = epoch.load(std::memory_order_relaxed);
+    if (state.epoch != current) {
+        state.epoch = current;
+        bytesUntilSample_ = nextInterval(state);
+        return;
+    }
+    bytesUntilSample_ = nextInterval(state);
+
+    state.busy = true;
+
+    void* frames[MAX_DEPTH + 1];
+    int depth = backtrace(frames, MAX_DEPTH + 1);
+    // 第一帧是 sample 自己
+    void** stack = frames + 1;
+    size_t stackDepth = depth > 1 ? static_cast<size_t>(depth - 1) : 0;
+
+    double mean = static_cast<double>(sampleBytes.load(std::memory_order_relaxed));
+    double probability = 1.0 - std::exp(-static_cast<double>(size) / mean);
+    double estimate = static_cast<double>(size) / probability;
+
+    {
+        std::lock_guard<std::mutex> lock(profileMutex);
+        StackRecord* record = findOrCreateStack(stack, stackDepth);
+        Sample* sample = record ? sampleArena.create() : nullptr;
+        if (sample) {
+            sample->ptr = ptr;
+            sample->size = size;
+            sample->estimate = estimate;
+            sample->stack = record;
+
+            Sample*& bucket = sampleTable[sampleIndex(ptr)];
+            sample->next = bucket;
+            bucket = sample;
+
+            ++record->allocSamples;
+            record->allocBytes += size;
+            record->allocEstimate += estimate;
+            ++record->liveSamples;
+            record->liveBytes += size;
+            record->liveEstimate += estimate;
+
+            uint16_t& slot = filter_[filterIndex(ptr)];
+            __atomic_store_n(&slot, static_cast<uint16_t>(slot + 1), __ATOMIC_RELAXED);
+            liveSamples_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    state.busy = false;
+}
+
+void HeapProfiler::removeSample(void* ptr) {
+    if (threadState.busy) return;
+
+    std::lock_guard<std::mutex> lock(profileMutex);
+    for (Sample** link = &sampleTable[sampleIndex(ptr)]; *link; link = &(*link)->next) {
+        Sample* sample = *link;
+        if (sample->ptr != ptr) continue;
+
+        StackRecord* record = sample->stack;
+        --record->liveSamples;
+        record->liveBytes -= sample->size;
+        record->liveEstimate -= sample->estimate;
+
+        uint16_t& slot = filter_[filterIndex(ptr)];
+        __atomic_store_n(&slot, static_cast<uint16_t>(slot - 1), __ATOMIC_RELAXED);
+        liveSamples_.fetch_sub(1, std::memory_order_relaxed);
+
+        *link = sample->next;
+        sampleArena.destroy(sample);
+        return;
+    }
+}
+
+// pprof 的格式: 每行 "存活样本数: 存活字节数 [累计样本数: 累计字节数] @ 地址..."
+// heap_v2/<间隔> 告诉 pprof 这是按字节采样的 由它按同样的概率还原
+// 最后附上 /proc/self/maps pprof 靠它把地址对应到文件
+void HeapProfiler::dump(FILE* out, ProfileFormat format, bool cumulative) {
+    ThreadState& state = threadState;
+    state.busy = true;
+    {
+        std::lock_guard<std::mutex> lock(profileMutex);
+
+        if (format == ProfileFormat::Pprof) {
+            uint64_t liveSamples = 0, liveBytes = 0, allocSamples = 0, allocBytes = 0;
+            for (StackRecord* bucket : stackTable) {
+                for (StackRecord* record = bucket; record; record = record->next) {
+                    liveSamples += record->liveSamples;
+                    liveBytes += record->liveBytes;
+                    allocSamples += record->allocSamples;
+                    allocBytes += record->allocBytes;
+                }
+            }
+
+            fprintf(out, "heap profile: %6llu: %8llu [%6llu: %8llu] @ heap_v2/%zu\n",
+                    static_cast<unsigned long long>(liveSamples), static_cast<unsigned long long>(liveBytes),
+                    static_cast<unsigned long long>(allocSamples), static_cast<unsigned long long>(allocBytes),
+                    sampleBytes.load(std::memory_order_relaxed));
+
+            for (StackRecord* bucket : stackTable) {
+                for (StackRecord* record = bucket; record; record = record->next) {
+                    if (!cumulative && record->liveSamples == 0) continue;
+                    fprintf(out, "%6llu: %8llu [%6llu: %8llu] @",
+                            static_cast<unsigned long long>(record->liveSamples),
+                            static_cast<unsigned long long>(record->liveBytes),
+                            static_cast<unsigned long long>(record->allocSamples),
+                            static_cast<unsigned long long>(record->allocBytes));
+                    for (size_t i = 0; i < record->depth; ++i) {
+                        fprintf(out, " %p", record->frames[i]);
+                    }
+                    fputc('\n', out);
+                }
+            }
+
+            fputs("\nMAPPED_LIBRARIES:\n", out);
+            copyMaps(out);
+        } else {
+            // 折叠栈从最外层写起
+            for (StackRecord* bucket : stackTable) {
+                for (StackRecord* record = bucket; record; record = record->next) {
+                    double bytes = cumulative ? record->allocEstimate : record->liveEstimate;
+                    if (bytes < 0.5 || record->depth == 0) continue;
+                    for (size_t i = record->depth; i > 0; --i) {
+                        printFrame(out, record->frames[i - 1]);
+                        if (i > 1) fputc(';', out);
+                    }
+                    fprintf(out, " %.0f\n", bytes);
+                }
+            }
+        }
+        fflush(out);
+    }
+    state.busy = false;
+}
+
+} // namespace Pool
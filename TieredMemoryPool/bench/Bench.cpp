@@ -0,0 +1,640 @@
+// 分配器基准测试
+// 同一份代码按宏编译成 bench_tiered / bench_hash / bench_glibc 三个程序 对比同样的负载 见 BenchCommon.h
+//
+// 负载
+//   larson         服务器模型 每个线程随机替换自己的一组块 几轮之后把整组交给新线程
+//   threadtest     每个线程反复分配一批同样大小的块再全部释放
+//   xmalloc        一半线程分配 另一半线程释放
+//   cache-scratch  主线程分配相邻的小块交给各个线程 线程释放后反复分配 写入 (被动的伪共享)
+//   replay         按大小分布随机分配 存活的块越多释放的概率越大
+//   fragmentation  分阶段分配释放 每个阶段结束时记录 RSS 和存活的字节数
+//
+// 每个 (负载, 线程数) 在 fork 出的子进程里跑 峰值 RSS 取子进程的 ru_maxrss
+// 结果每行一个 JSON 对象 写到 stdout 方便和之前的结果对比
+//
+// 用法: bench_tiered [--workload a,b] [--threads 1,2,4] [--sizes file] [--quick]
+//   --sizes file   replay 用的大小分布 每行 "字节数 权重"
+//   --quick        缩小规模 只跑 1 / 2 个线程 用于 ctest
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "BenchCommon.h"
+
+namespace
+{
+
+using namespace Bench;
+
+struct Options {
+    std::vector<int>            threads{1, 2, 4, 8};
+    std::vector<std::string>    workloads;
+    // 各个负载的迭代次数都乘上它
+    double                      scale = 1.0;
+    bool                        quick = false;
+};
+
+// 大小在 [minSize, maxSize] 中均匀分布 按 weight 选择区间
+struct SizeRange {
+    size_t  minSize;
+    size_t  maxSize;
+    double  weight;
+};
+
+// 默认的大小分布 小块占绝大多数 偶尔有几十 KB 的缓冲区
+std::vector<SizeRange> sizeDistribution = {
+    {8, 16, 15}, {17, 32, 20}, {33, 64, 20}, {65, 128, 15}, {129, 256, 10},
+    {257, 512, 8}, {513, 1024, 5}, {1025, 4096, 4}, {4097, 32768, 2}, {32769, 262144, 1},
+};
+
+// xorshift64* 每个线程一个
+class Rng {
+public:
+    explicit Rng(uint64_t seed) : state_(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint64_t next() {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 0x2545F4914F6CDD1DULL;
+    }
+
+    size_t below(size_t n) { return static_cast<size_t>(next() % n); }
+    size_t between(size_t lo, size_t hi) { return lo + below(hi - lo + 1); }
+
+private:
+    uint64_t state_;
+};
+
+// 按 sizeDistribution 抽样 累计权重预先算好
+class SizeSampler {
+public:
+    SizeSampler() {
+        double total = 0;
+        for (const SizeRange& range : sizeDistribution) {
+            total += range.weight;
+            cumulative_.push_back(total);
+        }
+        total_ = total;
+    }
+
+    size_t sample(Rng& rng) {
+        double x = static_cast<double>(rng.next() >> 11) * 0x1.0p-53 * total_;
+        size_t i = std::upper_bound(cumulative_.begin(), cumulative_.end(), x) - cumulative_.begin();
+        const SizeRange& range = sizeDistribution[std::min(i, sizeDistribution.size() - 1)];
+        return rng.between(range.minSize, range.maxSize);
+    }
+
+private:
+    std::vector<double> cumulative_;
+    double              total_;
+};
+
+// 子进程通过管道交回的结果 只能是平凡类型
+struct Result {
+    static const size_t MAX_PHASES = 8;
+
+    uint64_t    ops = 0;
+    double      seconds = 0;
+    uint32_t    p50 = 0;
+    uint32_t    p99 = 0;
+    uint32_t    p999 = 0;
+    bool        corrupted = false;
+    // 只有 fragmentation 使用
+    size_t      phases = 0;
+    uint64_t    rssKb[MAX_PHASES] = {};
+    uint64_t    liveKb[MAX_PHASES] = {};
+};
+
+const char* FRAGMENTATION_PHASES[] = {
+    "start", "small", "sparse", "medium", "free-medium", "free-all", "idle",
+};
+
+size_t scaled(const Options& options, double n) {
+    return std::max<size_t>(1, static_cast<size_t>(n * options.scale));
+}
+
+// 汇总各个线程的计数和延迟样本
+Result summarize(const std::vector<Recorder>& recorders, double seconds) {
+    Result result;
+    result.seconds = seconds;
+    std::vector<uint32_t> latencies;
+    for (const Recorder& recorder : recorders) {
+        result.ops += recorder.ops();
+        result.corrupted |= recorder.corrupted();
+        latencies.insert(latencies.end(), recorder.latencies().begin(), recorder.latencies().end());
+    }
+    result.p50 = percentile(latencies, 0.50);
+    result.p99 = percentile(latencies, 0.99);
+    result.p999 = percentile(latencies, 0.999);
+    return result;
+}
+
+// 先创建所有线程 全部就绪之后同时开始 只计开始到全部结束的时间
+template<typename Fn>
+double runThreads(int count, Fn fn) {
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < count; ++i) {
+        threads.emplace_back([&, i] {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            fn(i);
+        });
+    }
+    while (ready.load() < count) std::this_thread::yield();
+
+    Clock::time_point start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& t : threads) t.join();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// larson: 每个线程持有 SLOTS 个块 每次随机释放一个 换成新分配的随机大小的块
+// 每一代线程结束后 下一代新线程接手同一组块 块总是由另一个线程释放
+Result larson(int threads, const Options& options) {
+    const size_t SLOTS = 1000;
+    const size_t MIN_SIZE = 8;
+    const size_t MAX_SIZE = 1000;
+    const int GENERATIONS = 4;
+    const size_t replacements = scaled(options, 100000);
+
+    struct Block { void* ptr; size_t size; };
+    std::vector<std::vector<Block>> slots(threads, std::vector<Block>(SLOTS));
+    std::vector<Recorder> recorders(threads);
+
+    // 主线程填满 不计入结果
+    Recorder setup;
+    Rng rng(42);
+    for (auto& blocks : slots) {
+        for (Block& block : blocks) {
+            block.size = rng.between(MIN_SIZE, MAX_SIZE);
+            block.ptr = setup.allocate(block.size);
+        }
+    }
+
+    double seconds = 0;
+    for (int generation = 0; generation < GENERATIONS; ++generation) {
+        seconds += runThreads(threads, [&](int i) {
+            Rng rng(generation * 1000 + i);
+            Recorder& recorder = recorders[i];
+            std::vector<Block>& blocks = slots[i];
+            for (size_t n = 0; n < replacements; ++n) {
+                Block& block = blocks[rng.below(SLOTS)];
+                recorder.deallocate(block.ptr, block.size);
+                block.size = rng.between(MIN_SIZE, MAX_SIZE);
+                block.ptr = recorder.allocate(block.size);
+            }
+        });
+    }
+
+    for (auto& blocks : slots) {
+        for (Block& block : blocks) setup.deallocate(block.ptr, block.size);
+    }
+    Result result = summarize(recorders, seconds);
+    result.corrupted |= setup.corrupted();
+    return result;
+}
+
+// threadtest: 每个线程分配 BATCH 个同样大小的块 再全部释放 重复多轮
+Result threadtest(int threads, const Options& options) {
+    const size_t BATCH = 1000;
+    const size_t SIZE = 64;
+    const size_t rounds = scaled(options, 1000);
+
+    std::vector<Recorder> recorders(threads);
+    double seconds = runThreads(threads, [&](int i) {
+        Recorder& recorder = recorders[i];
+        std::vector<void*> batch(BATCH);
+        for (size_t round = 0; round < rounds; ++round) {
+            for (void*& p : batch) p = recorder.allocate(SIZE);
+            for (void* p : batch) recorder.deallocate(p, SIZE);
+        }
+    });
+    return summarize(recorders, seconds);
+}
+
+// 生产者和消费者之间的有界队列 一次传一批
+class BatchQueue {
+public:
+    using Batch = std::vector<std::pair<void*, size_t>>;
+
+    void push(Batch batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return batches_.size() < MAX_BATCHES; });
+        batches_.push_back(std::move(batch));
+        notEmpty_.notify_one();
+    }
+
+    // 生产者全部结束并且队列为空时返回 false
+    bool pop(Batch& batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return !batches_.empty() || producers_ == 0; });
+        if (batches_.empty()) return false;
+        batch = std::move(batches_.front());
+        batches_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void setProducers(int producers) { producers_ = producers; }
+
+    void producerDone() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--producers_ == 0) notEmpty_.notify_all();
+    }
+
+private:
+    static const size_t     MAX_BATCHES = 64;
+    std::mutex              mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::deque<Batch>       batches_;
+    int                     producers_ = 0;
+};
+
+// xmalloc: 前一半线程只分配 后一半线程只释放 一个线程时两个角色各一个线程
+Result xmalloc(int threads, const Options& options) {
+    const size_t BATCH = 256;
+    const size_t MIN_SIZE = 8;
+    const size_t MAX_SIZE = 512;
+    const size_t batches = scaled(options, 2000);
+    int producers = std::max(1, threads / 2);
+    int consumers = std::max(1, threads - producers);
+
+    BatchQueue queue;
+    queue.setProducers(producers);
+    std::vector<Recorder> recorders(producers + consumers);
+    double seconds = runThreads(producers + consumers, [&](int i) {
+        Recorder& recorder = recorders[i];
+        if (i < producers) {
+            Rng rng(i);
+            for (size_t b = 0; b < batches; ++b) {
+                BatchQueue::Batch batch(BATCH);
+                for (auto& block : batch) {
+                    block.second = rng.between(MIN_SIZE, MAX_SIZE);
+                    block.first = recorder.allocate(block.second);
+                }
+                queue.push(std::move(batch));
+            }
+            queue.producerDone();
+        } else {
+            BatchQueue::Batch batch;
+            while (queue.pop(batch)) {
+                for (auto& block : batch) recorder.deallocate(block.first, block.second);
+            }
+        }
+    });
+    return summarize(recorders, seconds);
+}
+
+// cache-scratch: 主线程连续分配的小块很可能在同一条缓存行上 分别交给各个线程释放
+// 之后每个线程反复分配同样大小的块并写入 如果分配器把刚释放的块还给它 线程之间就在同一条缓存行上来回争抢
+Result cacheScratch(int threads, const Options& options) {
+    const size_t SIZE = 8;
+    const size_t WRITES = 100;
+    const size_t iterations = scaled(options, 100000);
+
+    Recorder setup;
+    std::vector<void*> initial(threads);
+    for (void*& p : initial) p = setup.allocate(SIZE);
+
+    std::vector<Recorder> recorders(threads);
+    double seconds = runThreads(threads, [&](int i) {
+        Recorder& recorder = recorders[i];
+        recorder.deallocate(initial[i], SIZE);
+        for (size_t n = 0; n < iterations; ++n) {
+            auto* p = static_cast<volatile unsigned char*>(recorder.allocate(SIZE));
+            unsigned char tag = Recorder::tag(const_cast<unsigned char*>(p));
+            for (size_t w = 0; w < WRITES; ++w) {
+                p[w % SIZE] = tag;
+            }
+            recorder.deallocate(const_cast<unsigned char*>(p), SIZE);
+        }
+    });
+
+    Result result = summarize(recorders, seconds);
+    result.corrupted |= setup.corrupted();
+    return result;
+}
+
+// replay: 按 sizeDistribution 分配 存活的块占 MAX_LIVE 的比例就是下一步释放的概率
+// 存活的块数在 MAX_LIVE / 2 附近波动 大小和寿命都是随机的
+Result replay(int threads, const Options& options) {
+    const size_t MAX_LIVE = 8192;
+    const size_t steps = scaled(options, 1000000);
+
+    std::vector<Recorder> recorders(threads);
+    double seconds = runThreads(threads, [&](int i) {
+        Rng rng(i + 7);
+        SizeSampler sampler;
+        Recorder& recorder = recorders[i];
+        std::vector<std::pair<void*, size_t>> live;
+        live.reserve(MAX_LIVE);
+        for (size_t n = 0; n < steps; ++n) {
+            if (!live.empty() && rng.below(MAX_LIVE) < live.size()) {
+                size_t k = rng.below(live.size());
+                recorder.deallocate(live[k].first, live[k].second);
+                live[k] = live.back();
+                live.pop_back();
+            } else {
+                size_t size = sampler.sample(rng);
+                live.emplace_back(recorder.allocate(size), size);
+            }
+        }
+        for (auto& block : live) recorder.deallocate(block.first, block.second);
+    });
+    return summarize(recorders, seconds);
+}
+
+// 所有线程和主线程会合 可以反复使用
+class PhaseBarrier {
+public:
+    explicit PhaseBarrier(int count) : count_(count) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t generation = generation_;
+        if (++arrived_ == count_) {
+            arrived_ = 0;
+            ++generation_;
+            cv_.notify_all();
+        } else {
+            cv_.wait(lock, [&] { return generation_ != generation; });
+        }
+    }
+
+private:
+    std::mutex              mutex_;
+    std::condition_variable cv_;
+    int                     count_;
+    int                     arrived_ = 0;
+    uint64_t                generation_ = 0;
+};
+
+// fragmentation: 先分配大量小块 释放其中 90% 再分配同样多的中等大小的块
+// 小块留下的空洞能不能被中等大小的块利用 全部释放之后能还回去多少 都体现在每个阶段的 RSS 上
+Result fragmentation(int threads, const Options& options) {
+    const size_t totalBytes = scaled(options, 64.0 * 1024 * 1024);
+    const size_t share = totalBytes / threads;
+
+    std::atomic<size_t> liveBytes{0};
+    std::vector<Recorder> recorders(threads);
+    PhaseBarrier barrier(threads + 1);
+    Result phases;
+
+    auto allocateUntil = [&](Recorder& recorder, Rng& rng, std::vector<std::pair<void*, size_t>>& blocks,
+                             size_t minSize, size_t maxSize) {
+        size_t bytes = 0;
+        while (bytes < share) {
+            size_t size = rng.between(minSize, maxSize);
+            blocks.emplace_back(recorder.allocate(size), size);
+            bytes += size;
+        }
+        liveBytes.fetch_add(bytes, std::memory_order_relaxed);
+    };
+    auto release = [&](Recorder& recorder, std::vector<std::pair<void*, size_t>>& blocks, size_t keepEvery) {
+        size_t bytes = 0;
+        size_t kept = 0;
+        for (size_t k = 0; k < blocks.size(); ++k) {
+            if (keepEvery != 0 && k % keepEvery == 0) {
+                blocks[kept++] = blocks[k];
+                continue;
+            }
+            recorder.deallocate(blocks[k].first, blocks[k].second);
+            bytes += blocks[k].second;
+        }
+        blocks.resize(kept);
+        liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    };
+
+    const size_t PHASES = sizeof(FRAGMENTATION_PHASES) / sizeof(FRAGMENTATION_PHASES[0]);
+    auto samplePhase = [&] {
+        phases.rssKb[phases.phases] = residentKb();
+        phases.liveKb[phases.phases] = liveBytes.load() / 1024;
+        ++phases.phases;
+    };
+
+    // 每个阶段结束时会合两次 主线程在两次之间记录 工作线程这时不会分配释放
+    auto phaseDone = [&barrier] {
+        barrier.wait();
+        barrier.wait();
+    };
+
+    samplePhase();
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            Rng rng(i + 13);
+            Recorder& recorder = recorders[i];
+            std::vector<std::pair<void*, size_t>> small;
+            std::vector<std::pair<void*, size_t>> medium;
+            // 按最小的块预留 增长时的大块分配不算在负载里
+            small.reserve(share / 16 + 1);
+            medium.reserve(share / 256 + 1);
+
+            allocateUntil(recorder, rng, small, 16, 128);
+            phaseDone();
+            release(recorder, small, 10);
+            phaseDone();
+            allocateUntil(recorder, rng, medium, 256, 4096);
+            phaseDone();
+            release(recorder, medium, 0);
+            phaseDone();
+            release(recorder, small, 0);
+            phaseDone();
+        });
+    }
+
+    // start 和 idle 之间的每个阶段
+    for (size_t phase = 1; phase + 1 < PHASES; ++phase) {
+        barrier.wait();
+        samplePhase();
+        barrier.wait();
+    }
+    for (auto& t : workers) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // 空闲一段时间 让后台释放线程 (如果有) 把空闲页还给系统
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.quick ? 10 : 1000));
+    samplePhase();
+
+    Result result = summarize(recorders, seconds);
+    result.phases = phases.phases;
+    std::copy(phases.rssKb, phases.rssKb + phases.phases, result.rssKb);
+    std::copy(phases.liveKb, phases.liveKb + phases.phases, result.liveKb);
+    return result;
+}
+
+struct Workload {
+    const char* name;
+    Result (*run)(int threads, const Options& options);
+};
+
+const Workload WORKLOADS[] = {
+    {"larson", larson},
+    {"threadtest", threadtest},
+    {"xmalloc", xmalloc},
+    {"cache-scratch", cacheScratch},
+    {"replay", replay},
+    {"fragmentation", fragmentation},
+};
+
+// 在子进程里跑一次 峰值 RSS 只算这一次的
+// 子进程异常退出或者检查到块被覆盖时返回 false
+bool runIsolated(const Workload& workload, int threads, const Options& options) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        close(fds[0]);
+        benchInit();
+        calibrateTimer();
+        Result result = workload.run(threads, options);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == static_cast<ssize_t>(sizeof(result)) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    Result result;
+    size_t got = 0;
+    while (got < sizeof(result)) {
+        ssize_t n = read(fds[0], reinterpret_cast<char*>(&result) + got, sizeof(result) - got);
+        if (n <= 0) break;
+        got += static_cast<size_t>(n);
+    }
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    std::memset(&usage, 0, sizeof(usage));
+    wait4(pid, &status, 0, &usage);
+    bool ok = got == sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0 && !result.corrupted;
+
+    printf("{\"allocator\":\"%s\",\"workload\":\"%s\",\"threads\":%d,\"ok\":%s",
+           ALLOCATOR_NAME, workload.name, threads, ok ? "true" : "false");
+    if (got == sizeof(result)) {
+        printf(",\"ops\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.0f,\"p50_ns\":%u,\"p99_ns\":%u,\"p999_ns\":%u",
+               static_cast<unsigned long long>(result.ops), result.seconds,
+               result.seconds > 0 ? static_cast<double>(result.ops) / result.seconds : 0.0,
+               result.p50, result.p99, result.p999);
+    }
+    printf(",\"peak_rss_kb\":%ld", usage.ru_maxrss);
+    if (got == sizeof(result) && result.phases > 0) {
+        const char* separator = "";
+        printf(",\"phases\":[");
+        for (size_t i = 0; i < result.phases; ++i, separator = ",") printf("%s\"%s\"", separator, FRAGMENTATION_PHASES[i]);
+        printf("],\"rss_kb\":[");
+        separator = "";
+        for (size_t i = 0; i < result.phases; ++i, separator = ",") printf("%s%llu", separator, static_cast<unsigned long long>(result.rssKb[i]));
+        printf("],\"live_kb\":[");
+        separator = "";
+        for (size_t i = 0; i < result.phases; ++i, separator = ",") printf("%s%llu", separator, static_cast<unsigned long long>(result.liveKb[i]));
+        printf("]");
+    }
+    printf("}\n");
+    fflush(stdout);
+    return ok;
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// 每行 "字节数 权重" 读成只有一个大小的区间
+bool loadSizes(const char* path) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::vector<SizeRange> ranges;
+    size_t size;
+    double weight;
+    while (in >> size >> weight) {
+        if (size > 0 && weight > 0) ranges.push_back({size, size, weight});
+    }
+    if (ranges.empty()) return false;
+    sizeDistribution = std::move(ranges);
+    return true;
+}
+
+void usage(const char* program) {
+    fprintf(stderr, "用法: %s [--workload a,b] [--threads 1,2,4] [--sizes file] [--quick]\n负载:", program);
+    for (const Workload& workload : WORKLOADS) fprintf(stderr, " %s", workload.name);
+    fprintf(stderr, "\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    bool threadsGiven = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            options.quick = true;
+            options.scale = 0.02;
+        } else if (arg == "--workload" && i + 1 < argc) {
+            options.workloads = splitList(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads.clear();
+            for (const std::string& n : splitList(argv[++i])) options.threads.push_back(std::max(1, atoi(n.c_str())));
+            threadsGiven = true;
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            if (!loadSizes(argv[++i])) {
+                fprintf(stderr, "读取大小分布失败: %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.quick && !threadsGiven) options.threads = {1, 2};
+    for (const std::string& name : options.workloads) {
+        auto known = [&name](const Workload& workload) { return name == workload.name; };
+        if (std::none_of(std::begin(WORKLOADS), std::end(WORKLOADS), known)) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool ok = true;
+    for (const Workload& workload : WORKLOADS) {
+        if (!options.workloads.empty() &&
+            std::find(options.workloads.begin(), options.workloads.end(), workload.name) == options.workloads.end()) {
+            continue;
+        }
+        for (int threads : options.threads) {
+            ok &= runIsolated(workload, threads, options);
+        }
+    }
+    return ok ? 0 : 1;
+}
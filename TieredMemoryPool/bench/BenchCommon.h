@@ -0,0 +1,156 @@
+#pragma once
+
+// bench_* 和 pool_replay_* 共用的部分
+// 同一份代码按宏编译成三个程序 分别使用不同的分配器
+//   BENCH_TIERED  Pool::MemoryPool (TieredMemoryPool)
+//   BENCH_HASH    Pool::HashBucket (HashMemoryPool)
+//   都没有定义    malloc / free  (加上 LD_PRELOAD=libtieredpool.so 就是替换之后的 malloc)
+// 两个内存池都有 Pool::MemoryPool 不能编译进同一个程序
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(BENCH_TIERED)
+#include "MemoryPool.h"
+#elif defined(BENCH_HASH)
+#include "MemoryPool.h"
+#endif
+
+namespace Bench
+{
+
+#if defined(BENCH_TIERED)
+
+inline const char* ALLOCATOR_NAME = "tiered";
+inline void benchInit() {}
+inline void* benchAllocate(size_t size) { return Pool::MemoryPool::allocate(size); }
+inline void benchDeallocate(void* ptr, size_t size) { Pool::MemoryPool::deallocate(ptr, size); }
+
+#elif defined(BENCH_HASH)
+
+inline const char* ALLOCATOR_NAME = "hash";
+inline void benchInit() { Pool::HashBucket::initMemoryPool(); }
+inline void* benchAllocate(size_t size) { return Pool::HashBucket::useMemory(size); }
+inline void benchDeallocate(void* ptr, size_t size) { Pool::HashBucket::freeMemory(ptr, size); }
+
+#else
+
+inline const char* ALLOCATOR_NAME = "glibc";
+inline void benchInit() {}
+inline void* benchAllocate(size_t size) { return malloc(size); }
+inline void benchDeallocate(void* ptr, size_t) { free(ptr); }
+
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+// 两次 Clock::now() 之间本身的耗时 (取中位数) 记录延迟时减去
+inline uint32_t timerOverhead = 0;
+
+inline void calibrateTimer() {
+    std::vector<int64_t> samples(1000);
+    for (int64_t& ns : samples) {
+        Clock::time_point start = Clock::now();
+        ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    timerOverhead = static_cast<uint32_t>(samples[samples.size() / 2]);
+}
+
+// 每个线程的操作计数和延迟样本
+// 每次都计时的话 clock_gettime 本身比一次分配还慢 所以每 SAMPLE_EVERY 次操作计时一次
+// 分配时在块的首尾写入由地址算出的标记 释放前检查 顺便保证页面真的被访问过
+class alignas(64) Recorder {
+public:
+    static const uint64_t SAMPLE_EVERY = 64;
+
+    Recorder() { latencies_.reserve(1 << 16); }
+
+    void* allocate(size_t size) {
+        void* ptr;
+        if (++ops_ % SAMPLE_EVERY != 0) {
+            ptr = benchAllocate(size);
+        } else {
+            Clock::time_point start = Clock::now();
+            ptr = benchAllocate(size);
+            record(start);
+        }
+        if (ptr == nullptr) {
+            corrupted_ = true;
+            return nullptr;
+        }
+        mark(ptr, size);
+        return ptr;
+    }
+
+    void deallocate(void* ptr, size_t size) {
+        if (ptr == nullptr) return;
+        if (!checkMark(ptr, size)) corrupted_ = true;
+        if (++ops_ % SAMPLE_EVERY != 0) {
+            benchDeallocate(ptr, size);
+        } else {
+            Clock::time_point start = Clock::now();
+            benchDeallocate(ptr, size);
+            record(start);
+        }
+    }
+
+    static unsigned char tag(const void* ptr) {
+        return static_cast<unsigned char>(reinterpret_cast<uintptr_t>(ptr) >> 4);
+    }
+
+    uint64_t ops() const { return ops_; }
+    bool corrupted() const { return corrupted_; }
+    const std::vector<uint32_t>& latencies() const { return latencies_; }
+
+private:
+    static void mark(void* ptr, size_t size) {
+        auto* bytes = static_cast<unsigned char*>(ptr);
+        bytes[0] = bytes[size - 1] = tag(ptr);
+    }
+
+    static bool checkMark(const void* ptr, size_t size) {
+        auto* bytes = static_cast<const unsigned char*>(ptr);
+        return bytes[0] == tag(ptr) && bytes[size - 1] == tag(ptr);
+    }
+
+    void record(Clock::time_point start) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        ns = std::max<int64_t>(0, ns - timerOverhead);
+        latencies_.push_back(static_cast<uint32_t>(std::min<int64_t>(ns, UINT32_MAX)));
+    }
+
+    uint64_t                ops_ = 0;
+    bool                    corrupted_ = false;
+    std::vector<uint32_t>   latencies_;
+};
+
+// /proc/self/statm 的第二项是常驻页数
+inline uint64_t residentKb() {
+    char buf[128];
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+
+    char* end;
+    strtoull(buf, &end, 10);
+    return strtoull(end, nullptr, 10) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+// 第 q 分位的延迟 会打乱 latencies 的顺序
+inline uint32_t percentile(std::vector<uint32_t>& latencies, double q) {
+    if (latencies.empty()) return 0;
+    size_t k = std::min(latencies.size() - 1, static_cast<size_t>(q * static_cast<double>(latencies.size())));
+    std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+    return latencies[k];
+}
+
+} // namespace Bench
@@ -0,0 +1,245 @@
+// pool_replay: 重放 TraceRecorder 记录的跟踪文件 (TIEREDPOOL_TRACE 或者 TraceRecorder::start)
+// 和 bench 一样按宏编译成 pool_replay / pool_replay_hash / pool_replay_glibc 见 BenchCommon.h
+//
+// 记录按时间排序 同一时间的释放排在分配前面 原始地址换成对象编号
+// 跟踪开始之前分配的块的释放没有对应的分配 跳过 结束时还没释放的块在计时之后释放
+// 原来的每个线程对应一个重放线程
+//   --mode strict  (默认) 所有操作严格按原来的全局顺序执行 一个线程执行完一步才轮到下一步 结果可以复现
+//   --mode deps    只保证释放在对应的分配之后 其余各线程自由执行 吞吐更接近真实情况
+//   --sizes        不重放 只输出分配的大小分布 每行 "字节数 次数" 可以直接给 bench 的 --sizes
+//
+// 结果和 bench 一样是一行 JSON baseline_rss_kb 是读入跟踪文件之后 开始重放之前的 RSS
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "BenchCommon.h"
+#include "../include/Trace.h"
+
+namespace
+{
+
+using namespace Bench;
+using Pool::TraceHeader;
+using Pool::TraceOp;
+using Pool::TraceRecord;
+
+// 重放线程执行的一步
+struct ReplayOp {
+    uint64_t    seq;        // 全局顺序
+    uint32_t    object;
+    uint32_t    size;
+    bool        free;
+};
+
+struct Trace {
+    std::vector<std::vector<ReplayOp>>  threads;
+    std::vector<uint32_t>               objectSizes;
+    uint64_t                            ops = 0;
+    uint64_t                            unmatchedFrees = 0;
+};
+
+bool readRecords(const char* path, std::vector<TraceRecord>& records) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    TraceHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, "POOLTRC", 8) != 0 ||
+        header.version != Pool::TraceRecorder::VERSION || header.recordSize != sizeof(TraceRecord)) {
+        return false;
+    }
+
+    TraceRecord record;
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+    return true;
+}
+
+// 排序 配对分配和释放 按线程拆开
+Trace buildTrace(std::vector<TraceRecord>& records) {
+    // 同一线程的记录在文件中是程序顺序 stable_sort 保持不变
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b) {
+        if (a.timestamp != b.timestamp) return a.timestamp < b.timestamp;
+        return a.op == TraceOp::Free && b.op == TraceOp::Allocate;
+    });
+
+    Trace trace;
+    std::unordered_map<uint64_t, uint32_t> live;
+    std::unordered_map<uint16_t, size_t> threadIndex;
+    for (const TraceRecord& record : records) {
+        uint32_t object;
+        if (record.op == TraceOp::Allocate) {
+            object = static_cast<uint32_t>(trace.objectSizes.size());
+            trace.objectSizes.push_back(std::max<uint32_t>(record.size, 1));
+            // 同一个地址再次分配说明漏掉了释放 旧对象留到最后
+            live[record.ptr] = object;
+        } else {
+            auto it = live.find(record.ptr);
+            if (it == live.end()) {
+                ++trace.unmatchedFrees;
+                continue;
+            }
+            object = it->second;
+            live.erase(it);
+        }
+
+        auto inserted = threadIndex.emplace(record.thread, trace.threads.size());
+        if (inserted.second) trace.threads.emplace_back();
+        // 不知道大小的释放按分配时的大小
+        trace.threads[inserted.first->second].push_back(
+            {trace.ops++, object, trace.objectSizes[object], record.op == TraceOp::Free});
+    }
+    return trace;
+}
+
+// 等待条件成立 先空转一会儿 再让出 CPU
+template<typename Pred>
+void waitUntil(Pred ready) {
+    for (int spin = 0; !ready(); ++spin) {
+        if (spin > 64) sched_yield();
+    }
+}
+
+void usage(const char* program) {
+    fprintf(stderr, "用法: %s <trace> [--mode strict|deps] [--sizes]\n", program);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    bool strict = true;
+    bool sizesOnly = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--mode" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode != "strict" && mode != "deps") {
+                usage(argv[0]);
+                return 1;
+            }
+            strict = mode == "strict";
+        } else if (arg == "--sizes") {
+            sizesOnly = true;
+        } else if (!path && arg[0] != '-') {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceRecord> records;
+    if (!readRecords(path, records)) {
+        fprintf(stderr, "读取跟踪文件失败: %s\n", path);
+        return 1;
+    }
+    Trace trace = buildTrace(records);
+    records.clear();
+    records.shrink_to_fit();
+
+    if (sizesOnly) {
+        std::map<uint32_t, uint64_t> histogram;
+        for (uint32_t size : trace.objectSizes) ++histogram[size];
+        for (const auto& entry : histogram) {
+            printf("%u %llu\n", entry.first, static_cast<unsigned long long>(entry.second));
+        }
+        return 0;
+    }
+
+    benchInit();
+    calibrateTimer();
+
+    size_t threadCount = trace.threads.size();
+    std::vector<std::atomic<void*>> objects(trace.objectSizes.size());
+    for (auto& object : objects) object.store(nullptr, std::memory_order_relaxed);
+    std::vector<Recorder> recorders(threadCount);
+    std::atomic<uint64_t> turn{0};
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    uint64_t baselineKb = residentKb();
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            Recorder& recorder = recorders[t];
+            ready.fetch_add(1);
+            waitUntil([&go] { return go.load(std::memory_order_acquire); });
+
+            for (const ReplayOp& op : trace.threads[t]) {
+                if (strict) {
+                    waitUntil([&] { return turn.load(std::memory_order_acquire) == op.seq; });
+                }
+                std::atomic<void*>& object = objects[op.object];
+                if (op.free) {
+                    // 分配它的线程可能还没执行到
+                    waitUntil([&object] { return object.load(std::memory_order_acquire) != nullptr; });
+                    recorder.deallocate(object.exchange(nullptr, std::memory_order_relaxed), op.size);
+                } else {
+                    void* ptr = recorder.allocate(op.size);
+                    if (ptr == nullptr) {
+                        fprintf(stderr, "分配 %u 字节失败\n", op.size);
+                        _exit(1);
+                    }
+                    object.store(ptr, std::memory_order_release);
+                }
+                if (strict) {
+                    turn.store(op.seq + 1, std::memory_order_release);
+                }
+            }
+        });
+    }
+    waitUntil([&] { return ready.load() == threadCount; });
+
+    Clock::time_point start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // 跟踪结束时还存活的块
+    Recorder leftovers;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        if (void* ptr = objects[i].load(std::memory_order_relaxed)) {
+            leftovers.deallocate(ptr, trace.objectSizes[i]);
+        }
+    }
+
+    uint64_t ops = 0;
+    bool corrupted = leftovers.corrupted();
+    std::vector<uint32_t> latencies;
+    for (const Recorder& recorder : recorders) {
+        ops += recorder.ops();
+        corrupted |= recorder.corrupted();
+        latencies.insert(latencies.end(), recorder.latencies().begin(), recorder.latencies().end());
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"allocator\":\"%s\",\"trace\":\"%s\",\"mode\":\"%s\",\"threads\":%zu,\"ok\":%s"
+           ",\"ops\":%llu,\"unmatched_frees\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.0f"
+           ",\"p50_ns\":%u,\"p99_ns\":%u,\"p999_ns\":%u,\"baseline_rss_kb\":%llu,\"peak_rss_kb\":%ld}\n",
+           ALLOCATOR_NAME, path, strict ? "strict" : "deps", threadCount, corrupted ? "false" : "true",
+           static_cast<unsigned long long>(ops), static_cast<unsigned long long>(trace.unmatchedFrees),
+           seconds, seconds > 0 ? static_cast<double>(ops) / seconds : 0.0,
+           percentile(latencies, 0.50), percentile(latencies, 0.99), percentile(latencies, 0.999),
+           static_cast<unsigned long long>(baselineKb), usage.ru_maxrss);
+    return corrupted ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace Pool
+{
+
+// 单调 (区域) 分配器
+// 一批同生共死的小对象 (例如一次请求中的所有临时对象) 不必逐个 allocate / deallocate
+// 直接从 PageCache 申请 span 顺序切分 不能单独释放 只能回滚到检查点或者整体 reset
+// reset 的代价和 span 数成正比 与对象个数无关 释放下来的 span 先放进本线程的备用链表 下次直接复用
+// 备用链表有字节数上限 Scavenger 通过 releaseSpareSpans 把空闲线程的备用 span 还给 PageCache
+// 注意: Arena 不会调用析构函数 create 出来的对象需要自己析构 (或者本身就是平凡析构的)
+// 不是线程安全的 一个 Arena 同一时间只能在一个线程中使用
+class Arena {
+public:
+    static const size_t DEFAULT_SPAN_PAGES = 16; // 64KB
+    static const size_t DEFAULT_ALIGNMENT = alignof(std::max_align_t);
+
+    // 只记录位置 回滚时释放之后申请的所有 span
+    struct Checkpoint {
+        void*   chunk;
+        char*   cur;
+    };
+
+    explicit Arena(size_t spanPages = DEFAULT_SPAN_PAGES);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // alignment 必须是 2 的幂
+    void* allocate(size_t size, size_t alignment = DEFAULT_ALIGNMENT) {
+        uintptr_t result = (reinterpret_cast<uintptr_t>(cur_) + alignment - 1) & ~(alignment - 1);
+        if (cur_ && result + size <= reinterpret_cast<uintptr_t>(end_)) {
+            cur_ = reinterpret_cast<char*>(result + size);
+            return reinterpret_cast<void*>(result);
+        }
+        return allocateSlow(size, alignment);
+    }
+
+    template<typename T, typename... Args>
+    T* create(Args&&... args) {
+        void* p = allocate(sizeof(T), alignof(T));
+        return p ? new (p) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    // 检查点可以嵌套 回滚到较早的检查点之后 较晚的检查点就失效了
+    Checkpoint checkpoint() const { return Checkpoint{current_, cur_}; }
+    void rollback(const Checkpoint& checkpoint);
+
+    // 释放全部内存 O(span 数)
+    void reset() { rollback(Checkpoint{nullptr, nullptr}); }
+
+    // 当前持有的 span 数
+    size_t spanCount() const { return spanCount_; }
+
+    // 把所有线程中自上次调用以来没有用过的备用 span 还给 PageCache 返回字节数
+    static size_t releaseSpareSpans();
+
+private:
+    // 每个 span 开头的块头
+    struct Chunk {
+        Chunk*  prev;       // 更早申请的 span
+        size_t  numPages;
+    };
+
+    void* allocateSlow(size_t size, size_t alignment);
+    static char* chunkEnd(Chunk* chunk);
+
+private:
+    size_t  spanPages_;
+    Chunk*  current_ = nullptr; // 最近申请的 span 也是链表头
+    char*   cur_ = nullptr;     // current_ 中下一个可用的位置
+    char*   end_ = nullptr;
+    size_t  spanCount_ = 0;
+};
+
+} // namespace Pool
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "Common.h"
+#include "MetadataAllocator.h"
+#include "Numa.h"
+#include "TransferCache.h"
 
 #include <mutex>
-#include <unordered_map>
 #include <array>
 #include <atomic>
 #include <chrono>
@@ -11,62 +13,103 @@
 namespace Pool
 {
 
-// atomic 原子操作
-struct SpanTracker {
-    std::atomic<void*> spanAddr{nullptr};
-    std::atomic<size_t> numPages{0};
-    std::atomic<size_t> blockCount{0};
-    std::atomic<size_t> freeCount{0}; 
-};
+struct PoolStats;
 
 class CentralCache {
 public:
-    static CentralCache& getInstance() {
-        static CentralCache instance;
-        return instance;
+    // 每个 NUMA 节点一个 只从本节点的 PageCache 取 span
+    static CentralCache& getInstance(size_t node = Numa::currentNode()) {
+        static CentralCache* instances = [] {
+            static CentralCache caches[MAX_NUMA_NODES];
+            for (size_t i = 0; i < MAX_NUMA_NODES; ++i) {
+                caches[i].node_ = i;
+            }
+            return caches;
+        }();
+        return instances[node];
     }
 
-    void* fetchRange(size_t index);
+    // 取至多 batchNum 个块 串成链表放在 start 中 返回实际取到的块数
+    // batchNum 恰好是一整批时优先走无锁的 TransferCache
+    // owner 是取块的线程的 RemoteFree 编号 span 上的 owner 随之更新 见 claimSpan / disownBatch
+    size_t fetchRange(void*& start, size_t batchNum, size_t index, uint16_t owner = 0);
+    // 归还一条链表 size 为链表中所有块的总字节数
+    // 链表中的块必须都属于本节点
     void returnRange(void* start, size_t size, size_t index);
 
+    // 链表中的块可能来自不同的节点 按 span 记录的节点拆开 各自归还到所属节点
+    static void returnRangeToOwners(void* start, size_t count, size_t index);
+
+    // 超过 DELAY_INTERVAL 没有归还过的 size class 把 TransferCache 中的块放回 span
+    // 全空的 span 全部还给 PageCache 供后台线程使用
+    void flushDelayedReturns();
+
+    // 累加本节点每个 size class 的 span 数和缓存着的字节数
+    void collectStats(PoolStats& stats);
+
 private:
     CentralCache();
 
     // 从页缓存获取内存
     void* fetchFromPageCache(size_t size);
 
-    // getter
-    SpanTracker* getSpanTracker(void* blockAddr);
-
-    void updateSpanFreeCount(SpanTracker* tracker, size_t newFreeBlocks, size_t index);
-
-    // 判断是否应该归还 
-    // 两个情况
-    // 已经触发了 应该归还的 次数
-    // 上一次真正归还的时间
-    bool shouldPerformDelayedReturn(size_t index, size_t currentCount, 
-        std::chrono::steady_clock::time_point currentTime);
-
-    // 归还给 pageCache
-    void performDelayReturn(size_t index);
+    // 给定块大小 一次向 PageCache 申请的页数
+    static size_t getSpanPages(size_t size);
+
+    // 以下都需要持有 locks_[index]
+
+    // 申请一个新的 span 只分配位图 块在取走时才切分
+    Span* allocateSpan(size_t index, uint16_t owner);
+    // 从 span 中取块之前 按取块的线程更新 span 的所有者
+    void claimSpan(Span* span, uint16_t owner);
+    // 从 span 中取至多 num 块 接在 tail 后面 返回取到的块数
+    size_t takeFromSpan(Span* span, size_t num, void**& tail);
+    // 一个块回到它所属的 span
+    void returnToSpan(Span* span, void* block, size_t index);
+    // TransferCache 中排着的批全部放回 span
+    void drainTransferCache(size_t index);
+    // 全空的 span 还给 PageCache
+    void releaseSpan(Span* span, size_t index);
+
+    // 从 TransferCache 整批取走时 清掉这些块的 span 上别的线程的所有者 不需要锁
+    static void disownBatch(void* batch, uint16_t owner);
+
+    // partialSpans_ 是双向链表 借用 span 的 next / prev 它们只有在 PageCache 的空闲链表中才会用到
+    void pushSpan(Span* span, size_t index);
+    void unlinkSpan(Span* span, size_t index);
+
+    static size_t bitmapBytes(const Span* span) {
+        return (span->blockCount + 63) / 64 * sizeof(uint64_t);
+    }
 
 private:
-    std::array<std::atomic<void*>, FREE_LIST_SIZE>                      centralFreeList_;
+    // 还有空闲块 但不是全空的 span 取块时从头部开始
+    // 块不再串成链表 每个 span 用位图记录哪些块空闲 span 是否全空只要看 freeCount
+    std::array<Span*, FREE_LIST_SIZE>                                   partialSpans_{};
+    // 每个 size class 留一个全空的 span 刚还给 PageCache 马上又要申请回来的情况很常见
+    std::array<Span*, FREE_LIST_SIZE>                                   emptySpan_{};
+
+    // 整批的块先放在这里 只有 TransferCache 满了或者空了才会去抢 locks_
+    // 满了的时候连同排着的批一起放回 span 见 returnRange
+    std::array<TransferCache, FREE_LIST_SIZE>                           transferCaches_;
 
     // 每一个 list 都有属于自己的锁 如果只用一个锁负责全部的list 在多线程实现中竞态严重
     std::array<std::atomic_flag, FREE_LIST_SIZE>                        locks_;
 
-    // 使用数组存储信息
-    std::array<SpanTracker, 1024>                                       spanTrackers_;
-    // spanCount 的数量
-    std::atomic<size_t>                                                 spanCount_;
+    // 空闲位图 所有 size class 共用 只在申请 / 归还 span 时用到
+    SizedMetadataAllocator                                              bitmapAllocator_;
+    std::atomic_flag                                                    bitmapLock_ = ATOMIC_FLAG_INIT;
 
     // 延迟归还
-    static const size_t                                                 MAX_DELAY_COUNT = 48; // 最大延迟计数
-    std::array<std::atomic<size_t>, FREE_LIST_SIZE>                     delayCounts_; // 每个大小类的延迟计数 已经触发了多少次应该归还的情况
-    std::array<std::chrono::steady_clock::time_point, FREE_LIST_SIZE>   lastReturnTime_; // 上一次真正归还的时间点
+    std::array<std::chrono::steady_clock::time_point, FREE_LIST_SIZE>   lastReturnTime_; // 上一次归还的时间点
     static const std::chrono::milliseconds                              DELAY_INTERVAL; // 延迟间隔
 
+    // 统计 在 locks_ 内修改 collectStats 不加锁读取
+    std::array<std::atomic<size_t>, FREE_LIST_SIZE>                     spanCount_;     // 切分成这一类的 span 数
+    std::array<std::atomic<size_t>, FREE_LIST_SIZE>                     freeBlocks_;    // 这些 span 中空闲的块数
+
+    size_t                                                              node_ = 0;
+
 };
 
 } // namespace Pool
\ No newline at end of file
@@ -1,40 +1,161 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <atomic>
 #include <array>
+#include <algorithm>
 
 namespace Pool
 {
 constexpr size_t ALIGNMENT = 8; // 对齐数 可分配的最小缓存
 constexpr size_t MAX_BYTES = 256 * 1024; // 一个块中的总容量
-// 种类每一个 size 的list 大小都是相同的
-// 但是实际运行则不然 
-// 内存小块是要多于内存大块的
-constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT; // list 大小
+constexpr size_t SMALL_CLASS_MAX = 128; // 128B 以内的 size class 按 ALIGNMENT 递增
+constexpr size_t CLASS_STEPS_PER_DOUBLING = 8; // 之后每翻一倍分成 8 档 内碎片不超过 12.5%
+constexpr size_t PAGE_SHIFT = 12; // 一页 4KB
+constexpr size_t MAX_BATCH_NUM = 32; // ThreadCache 与 CentralCache 之间一次搬运的最大块数
+constexpr size_t MAX_NUMA_NODES = 8; // 每个节点一套 PageCache 和 CentralCache
 
 // 内存块头部信息 
 struct BlockHeader {
     BlockHeader* next;
 };
 
+// 一段连续的页 PageCache 管理内存的基本单位
+// 通过 PageMap 可以由任意地址找到它所属的 span
+struct Span {
+    void*   pageAddr   = nullptr;  // 起始地址
+    size_t  numPages   = 0;        // 页数
+    Span*   next       = nullptr;  // 空闲链表
+    Span*   prev       = nullptr;  // 空闲链表是双向的 合并时 O(1) 摘下相邻的 span
+    bool    isUsed     = false;    // 是否已经交给 CentralCache
+    bool    isReleased = false;    // 空闲时物理页已经 madvise 还给系统 再次使用时由缺页重新分配
+    uint8_t node       = 0;        // 所属的 NUMA 节点 释放时回到这个节点的 PageCache
+    // 从这个 span 取走过块的唯一线程 跨线程释放时推回它的队列 见 RemoteFree
+    // 块交到第二个线程手里就清为 0 span 全空之后再由下一个取块的线程认领
+    // TransferCache 的路径上会在锁外清掉 读写都用 __atomic 内建函数
+    uint16_t owner     = 0;
+
+    // 下面的字段只有被 CentralCache 切分成小块之后才有意义
+    size_t  sizeClass  = 0;        // 小块所属的 size class 不知道大小的 deallocate 靠它找回 index 大块为 LARGE_SIZE_CLASS
+    size_t  blockSize  = 0;        // 小块大小 大块为整个 span 的字节数
+    size_t  blockCount = 0;        // 切分出的小块总数
+    size_t  freeCount  = 0;        // 空闲小块数 = 位图中 1 的个数 + 还没有切分的块数
+    // 第 i 位为 1 表示第 i 块空闲 只有 [0, carved) 的位有意义 见 CentralCache
+    uint64_t* freeBitmap = nullptr;
+    size_t  carved     = 0;        // 从头开始切分出去过的块数 之后的块还没有被碰过
+    size_t  scanHint   = 0;        // 位图中这个下标之前的字全为 0 分配时从这里开始找
+};
+
+// 相邻两个 size class 之间的间隔
+constexpr size_t classAlignment(size_t size) {
+    if (size < SMALL_CLASS_MAX) return ALIGNMENT;
+
+    size_t lg = 0;
+    while ((size_t(2) << lg) <= size) ++lg;
+    return (size_t(1) << lg) / CLASS_STEPS_PER_DOUBLING;
+}
+
+constexpr size_t countSizeClasses() {
+    size_t num = 0;
+    for (size_t size = ALIGNMENT; size <= MAX_BYTES; size += classAlignment(size)) {
+        ++num;
+    }
+    return num;
+}
+
+// 原来按 8B 等距划分出 32768 个 size class
+// 但是内存小块是要多于内存大块的 大块没有必要分得这么细
+// 现在仿照 TCMalloc 几何递增 一共约 100 个
+constexpr size_t FREE_LIST_SIZE = countSizeClasses(); // list 大小
+// 超过 MAX_BYTES 的申请整个占一个 span span->sizeClass 记为它 见 LargeCache
+constexpr size_t LARGE_SIZE_CLASS = FREE_LIST_SIZE;
+
+// 查找表的下标 1024B 以内按 8B 一格 之后按 128B 一格
+// 1024B 以上的 size class 间隔都不小于 128B 所以一格内不会跨越两个 class
+constexpr size_t classArrayIndex(size_t bytes) {
+    return bytes <= 1024 ? (bytes + 7) >> 3 : (bytes + 127 + (120 << 7)) >> 7;
+}
+
+constexpr size_t CLASS_ARRAY_SIZE = classArrayIndex(MAX_BYTES) + 1;
+
+struct SizeClassTable {
+    size_t  classSize[FREE_LIST_SIZE];       // index -> 块大小
+    uint32_t classReciprocal[FREE_LIST_SIZE]; // 2^32 / 块大小 向上取整 见 SizeClass::blockIndex
+    uint8_t classIndex[CLASS_ARRAY_SIZE];    // classArrayIndex(bytes) -> index
+};
+
+// 编译期生成 size class 表
+constexpr SizeClassTable makeSizeClassTable() {
+    SizeClassTable table{};
+
+    size_t index = 0;
+    for (size_t size = ALIGNMENT; size <= MAX_BYTES; size += classAlignment(size)) {
+        table.classReciprocal[index] = static_cast<uint32_t>(((uint64_t(1) << 32) + size - 1) / size);
+        table.classSize[index++] = size;
+    }
+
+    // 每一格对应能放下这一格所有 bytes 的最小 class
+    size_t bytes = 0;
+    for (index = 0; index < FREE_LIST_SIZE; ++index) {
+        for (; bytes <= table.classSize[index]; bytes += ALIGNMENT) {
+            table.classIndex[classArrayIndex(bytes)] = static_cast<uint8_t>(index);
+        }
+    }
+    return table;
+}
+
+inline constexpr SizeClassTable SIZE_CLASS_TABLE = makeSizeClassTable();
+
+static_assert(FREE_LIST_SIZE <= 256, "classIndex is stored as uint8_t");
+static_assert(SIZE_CLASS_TABLE.classSize[FREE_LIST_SIZE - 1] == MAX_BYTES, "last size class must be MAX_BYTES");
+
 class SizeClass {
 public:
-    // 将给定的 bytes 向上取整
+    // 将给定的 bytes 向上取整到所在 size class 的块大小
     static size_t roundUp(size_t bytes) {
-        return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        return SizeForIndex(getIndex(bytes));
     }
 
-    // 分配内存块时计算索引
+    // 分配内存块时计算索引 O(1) 查表
     static size_t getIndex(size_t bytes) {
-        bytes = std::max(bytes, ALIGNMENT);
-        return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+        return SIZE_CLASS_TABLE.classIndex[classArrayIndex(bytes)];
+    }
+
+    // 给定 index 返回对应的块的大小
+    static size_t SizeForIndex(size_t index) {
+        return SIZE_CLASS_TABLE.classSize[index];
+    }
+
+    // span 内的偏移换成块的序号 用乘法代替除法
+    // offset 是块大小的整数倍 误差不到 offset / 2^32 所以只要 offset 小于 4GB 结果就是精确的
+    static size_t blockIndex(size_t offset, size_t index) {
+        return static_cast<size_t>((uint64_t(offset) * SIZE_CLASS_TABLE.classReciprocal[index]) >> 32);
+    }
+
+    // 块的地址 = span 起始地址 (页对齐) + k * 块大小
+    // 所以块大小是 alignment 倍数的 size class 中每个块都满足对齐
+    // 返回能放下 bytes 且满足对齐的最小块大小 没有时返回 0
+    static size_t alignedSize(size_t bytes, size_t alignment) {
+        if (alignment <= ALIGNMENT) return bytes <= MAX_BYTES ? roundUp(bytes) : 0;
+        if (bytes > MAX_BYTES) return 0;
+
+        bytes = std::max(bytes, alignment);
+        for (size_t index = getIndex(bytes); index < FREE_LIST_SIZE; ++index) {
+            if (SizeForIndex(index) % alignment == 0) {
+                return SizeForIndex(index);
+            }
+        }
+        return 0;
     }
 
-    // 给定 size 返回对应的块的大小
-    static size_t SizeForIndex(size_t size) {
-        return roundUp(size);
+    // 一批搬运的块数 小块一次多搬一些 大块少搬一些
+    // 每批大约 64KB 最少 1 块 最多 MAX_BATCH_NUM 块
+    static size_t numMoveSize(size_t size) {
+        if (size == 0) return 0;
+        size_t num = (64 * 1024) / size;
+        return std::max<size_t>(1, std::min(num, MAX_BATCH_NUM));
     }
 };
 
-} // namespace Pool
\ No newline at end of file
+} // namespace Pool
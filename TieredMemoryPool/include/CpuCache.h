@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "Common.h"
+
+#if defined(__x86_64__) && defined(__linux__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define TIEREDPOOL_HAVE_RSEQ 1
+#endif
+
+namespace Pool
+{
+
+struct PoolStats;
+
+// 每个 CPU 的 slab 的布局 编译期算好 所有 CPU 相同
+// 开头是每个 size class 当前缓存的块数 (uint32_t) 和 drain 记下的计数签名 后面依次是各个 size class 的槽位
+// 每个 size class 的槽位: 两批 但不超过 64 个 缓存的字节数也不超过 256KB
+constexpr size_t CPU_CACHE_MARK_OFFSET = (FREE_LIST_SIZE * sizeof(uint32_t) + 7) / 8 * 8;
+constexpr size_t CPU_CACHE_HEADER_BYTES = (CPU_CACHE_MARK_OFFSET + sizeof(uint64_t) + 63) / 64 * 64;
+constexpr size_t CPU_CACHE_MAX_CLASS_SLOTS = 64;
+constexpr size_t CPU_CACHE_MAX_CLASS_BYTES = 256 * 1024;
+
+struct CpuCacheLayout {
+    uint32_t    capacity[FREE_LIST_SIZE];
+    size_t      first[FREE_LIST_SIZE];      // 槽位相对于 slab 开头的偏移
+    size_t      end;
+};
+
+constexpr CpuCacheLayout makeCpuCacheLayout() {
+    CpuCacheLayout layout{};
+    size_t offset = CPU_CACHE_HEADER_BYTES;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        size_t size = SIZE_CLASS_TABLE.classSize[index];
+        size_t batch = std::max<size_t>(1, std::min(64 * 1024 / size, MAX_BATCH_NUM));
+        size_t slots = std::min(batch * 2, CPU_CACHE_MAX_CLASS_SLOTS);
+        slots = std::min(slots, std::max<size_t>(1, CPU_CACHE_MAX_CLASS_BYTES / size));
+
+        layout.capacity[index] = static_cast<uint32_t>(slots);
+        layout.first[index] = offset;
+        offset += slots * sizeof(void*);
+    }
+    layout.end = offset;
+    return layout;
+}
+
+inline constexpr CpuCacheLayout CPU_CACHE_LAYOUT = makeCpuCacheLayout();
+
+// 每个 CPU 一份的前端缓存 代替每个线程一份的 ThreadCache
+// 几百个大部分时间空闲的线程 每个 ThreadCache 都各自囤着内存 总量随线程数增长
+// 按 CPU 缓存之后 总量只和核数有关
+//
+// 无锁的 push / pop 靠 Linux 的 restartable sequences (rseq):
+// 临界区内被抢占或者迁移到别的 CPU 时 内核把执行流拉回到 abort 处重新开始
+// 所以只要最后一条写 (提交) 之前都只读 就不需要任何原子指令
+// rseq 由 glibc 2.35+ 在每个线程启动时注册 拿不到时 enable 返回 false 继续使用 ThreadCache
+//
+// 每个 CPU 一块 slab 布局见 CpuCacheLayout
+// slab 由对应的 CPU 第一次访问 按首次访问的策略物理页就在本地节点上
+class CpuCache {
+public:
+    // 每个 CPU 的 slab 大小
+    static const size_t SLAB_SHIFT = 16;
+    static const size_t SLAB_SIZE = size_t(1) << SLAB_SHIFT;
+    static_assert(CPU_CACHE_LAYOUT.end <= SLAB_SIZE, "per-cpu slab overflow");
+
+    // 切换到按 CPU 缓存 内核或者 glibc 不支持 rseq 时返回 false
+    // 之前由 ThreadCache 分配的块可以直接在这里释放 反过来也一样
+    static bool enable();
+    static bool isActive() { return active_.load(std::memory_order_relaxed); }
+
+    static void* allocate(size_t size) {
+        if (size == 0) size = ALIGNMENT;
+        if (size > MAX_BYTES) return allocateLarge(size);
+
+        size_t index = SizeClass::getIndex(size);
+        if (void* ptr = pop(index)) return ptr;
+        return allocateSlow(index);
+    }
+
+    static void deallocate(void* ptr, size_t size) {
+        if (size > MAX_BYTES) {
+            deallocateLarge(ptr, size);
+            return;
+        }
+        size_t index = SizeClass::getIndex(size);
+        if (!push(index, ptr)) {
+            deallocateSlow(index, ptr);
+        }
+    }
+
+    // 不知道大小 通过 PageMap 找到 span 上的 size class
+    static void deallocate(void* ptr);
+
+    // 把各个 CPU 的 slab 中缓存的块还给 CentralCache 返回归还的字节数
+    // 调用线程依次绑定到每个 CPU 上 用和快速路径一样的 rseq pop 取空 快速路径不需要加锁
+    // idleOnly 时只清空两次调用之间计数一直没有变化的 CPU (空闲的 CPU) 由 ThreadCache::reclaimIdleCaches 调用
+    // 不允许调用线程运行的 CPU 清不到 跳过
+    static size_t drain(bool idleOnly = false);
+
+    // 累加所有 CPU 的 slab 中缓存着的字节数 读的是别的 CPU 正在修改的计数 只是近似值
+    static void collectStats(PoolStats& stats);
+
+private:
+#ifdef TIEREDPOOL_HAVE_RSEQ
+    static struct rseq* rseqArea() {
+        return reinterpret_cast<struct rseq*>(
+            static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+    }
+#endif
+
+// 临界区描述符 [1, 2) 为临界区 4 为 abort 入口 入口之前必须是注册时约定的签名
+// 段标志 ? 让描述符和所在函数属于同一个 COMDAT 组 内联函数的重复副本被丢弃时一起丢弃
+#define TIEREDPOOL_RSEQ_CS                                  \
+        ".pushsection __rseq_cs, \"aw?\"\n\t"               \
+        ".balign 32\n\t"                                    \
+        "3:\n\t"                                            \
+        ".long 0, 0\n\t"                                    \
+        ".quad 1f, 2f - 1f, 4f\n\t"                         \
+        ".popsection\n\t"                                   \
+        "0:\n\t"                                            \
+        "leaq 3b(%%rip), %%rax\n\t"                         \
+        "movq %%rax, %[rseq_cs]\n\t"
+
+#define TIEREDPOOL_RSEQ_ABORT                               \
+        ".pushsection __rseq_failure, \"ax?\"\n\t"          \
+        ".byte 0x0f, 0xb9, 0x3d\n\t"                        \
+        ".long 0x53053053\n\t"                              \
+        "4:\n\t"                                            \
+        "jmp 0b\n\t"                                        \
+        ".popsection\n\t"
+
+    // 放入当前 CPU 的 slab 满了返回 false
+    // 提交之前先把 ok 置 1 被打断时从头执行会重新清零
+    static bool push(size_t index, void* item) {
+#ifdef TIEREDPOOL_HAVE_RSEQ
+        struct rseq* area = rseqArea();
+        int ok;
+        asm volatile(
+            TIEREDPOOL_RSEQ_CS
+            "1:\n\t"
+            "xorl %k[ok], %k[ok]\n\t"
+            "movl %[cpu_id], %%eax\n\t"
+            "shlq %[shift], %%rax\n\t"
+            "addq %[base], %%rax\n\t"
+            "movl (%%rax, %[index], 4), %%ecx\n\t"
+            "cmpl %[capacity], %%ecx\n\t"
+            "jae 2f\n\t"
+            "leaq (%%rax, %[first]), %%rdx\n\t"
+            "movq %[item], (%%rdx, %%rcx, 8)\n\t"
+            "incl %%ecx\n\t"
+            "movl $1, %k[ok]\n\t"
+            "movl %%ecx, (%%rax, %[index], 4)\n\t"
+            "2:\n\t"
+            TIEREDPOOL_RSEQ_ABORT
+            : [ok] "=&r"(ok), [rseq_cs] "=m"(area->rseq_cs)
+            : [cpu_id] "m"(area->cpu_id), [base] "r"(slabs_), [index] "r"(index),
+              [capacity] "r"(CPU_CACHE_LAYOUT.capacity[index]), [first] "r"(CPU_CACHE_LAYOUT.first[index]),
+              [item] "r"(item), [shift] "i"(SLAB_SHIFT)
+            : "rax", "rcx", "rdx", "memory", "cc");
+        return ok != 0;
+#else
+        (void)index;
+        (void)item;
+        return false;
+#endif
+    }
+
+    // 从当前 CPU 的 slab 取出一块 空的时候返回 nullptr
+    static void* pop(size_t index) {
+#ifdef TIEREDPOOL_HAVE_RSEQ
+        struct rseq* area = rseqArea();
+        void* result;
+        asm volatile(
+            TIEREDPOOL_RSEQ_CS
+            "1:\n\t"
+            "xorl %k[result], %k[result]\n\t"
+            "movl %[cpu_id], %%eax\n\t"
+            "shlq %[shift], %%rax\n\t"
+            "addq %[base], %%rax\n\t"
+            "movl (%%rax, %[index], 4), %%ecx\n\t"
+            "testl %%ecx, %%ecx\n\t"
+            "jz 2f\n\t"
+            "decl %%ecx\n\t"
+            "leaq (%%rax, %[first]), %%rdx\n\t"
+            "movq (%%rdx, %%rcx, 8), %[result]\n\t"
+            "movl %%ecx, (%%rax, %[index], 4)\n\t"
+            "2:\n\t"
+            TIEREDPOOL_RSEQ_ABORT
+            : [result] "=&r"(result), [rseq_cs] "=m"(area->rseq_cs)
+            : [cpu_id] "m"(area->cpu_id), [base] "r"(slabs_), [index] "r"(index),
+              [first] "r"(CPU_CACHE_LAYOUT.first[index]), [shift] "i"(SLAB_SHIFT)
+            : "rax", "rcx", "rdx", "memory", "cc");
+        return result;
+#else
+        (void)index;
+        return nullptr;
+#endif
+    }
+
+#undef TIEREDPOOL_RSEQ_CS
+#undef TIEREDPOOL_RSEQ_ABORT
+
+    // 当前 CPU 的这一类空了 从 CentralCache 取一批 返回一块 剩下的放进 slab
+    static void* allocateSlow(size_t index);
+    // 当前 CPU 的这一类满了 连同 ptr 一起归还一批给 CentralCache
+    static void deallocateSlow(size_t index, void* ptr);
+
+    // 取空当前 CPU 的 slab 返回归还的字节数
+    static size_t drainCurrent();
+
+    // 超过 MAX_BYTES 的申请不经过 slab
+    static void* allocateLarge(size_t size);
+    static void deallocateLarge(void* ptr, size_t size);
+
+private:
+    static char*                slabs_;
+    static std::atomic<bool>    active_;
+};
+
+} // namespace Pool
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+#include "Common.h"
+#include "Numa.h"
+
+namespace Pool
+{
+
+struct PoolStats;
+
+// 超过 MAX_BYTES 的申请
+// 直接向 PageCache 要按页对齐的 span 不再交给系统的 malloc
+// 刚释放的 span 先留在这里 下一次页数差不多的申请直接拿走 不用进 PageCache 切分合并
+// 缓存超出预算时最早放进来的 span madvise 之后还给 PageCache
+class LargeCache {
+public:
+    // 最多缓存的 span 数和总字节数 (每个节点)
+    static const size_t MAX_CACHED_SPANS = 32;
+    static const size_t MAX_CACHED_BYTES = 64 * 1024 * 1024;
+    // 超过它的 span 不进缓存 释放时直接还给系统
+    static const size_t MAX_CACHEABLE_BYTES = MAX_CACHED_BYTES / 4;
+
+    static LargeCache& getInstance(size_t node = Numa::currentNode()) {
+        static LargeCache* instances = [] {
+            static LargeCache caches[MAX_NUMA_NODES];
+            for (size_t i = 0; i < MAX_NUMA_NODES; ++i) {
+                caches[i].node_ = i;
+            }
+            return caches;
+        }();
+        return instances[node];
+    }
+
+    // 返回的地址按页对齐 可用的大小记在 span->blockSize 上
+    static void* allocate(size_t size);
+    // 可以在任意线程释放 回到 span 所属节点的缓存
+    static void deallocate(void* ptr);
+
+    // 累加所有节点的分配释放次数 使用中和缓存着的字节数
+    static void collectStats(PoolStats& stats);
+
+private:
+    LargeCache() = default;
+
+    // 页数在 [numPages, numPages * 9 / 8] 之间的 span 中最小的一个 没有时返回 nullptr
+    Span* take(size_t numPages);
+    void put(Span* span);
+
+private:
+    std::array<Span*, MAX_CACHED_SPANS> spans_{};   // 按放入的先后顺序 最早的在前面
+    size_t                              count_ = 0;
+    size_t                              bytes_ = 0;
+    size_t                              node_ = 0;
+    std::mutex                          mutex_;
+
+    // 统计 大块的分配本来就要进锁 这里直接用原子加法
+    static std::atomic<uint64_t>        allocs_;
+    static std::atomic<uint64_t>        frees_;
+    static std::atomic<size_t>          inUseBytes_;
+};
+
+} // namespace Pool
@@ -1,19 +1,75 @@
 #pragma once
 
+#include "../include/CpuCache.h"
 #include "../include/ThreadCache.h"
+#include "../include/Trace.h"
+// 和 HashMemoryPool 共用 在仓库顶层的 HeapProfiler 目录
+#include "HeapProfiler.h"
 #include <cstddef>
 
 namespace Pool 
 {
 
+// 前端默认是每个线程一份的 ThreadCache
+// CpuCache::enable() 成功之后改用每个 CPU 一份的缓存 两者分配的块可以混着释放
+// 打开 HeapProfiler 时两种前端的分配释放都在这里采样 打开 TraceRecorder 时都在这里记录
 class MemoryPool {
 public:
     static void* allocate(std::size_t size) {
-        return ThreadCache::getInstance()->allocate(size);
+        void* ptr = allocateFromFrontEnd(size);
+        HeapProfiler::recordAllocation(ptr, size);
+        TraceRecorder::recordAllocation(ptr, size);
+        return ptr;
     }
 
+    // 知道大小时的快速路径
     static void deallocate(void* ptr, size_t size) {
-        ThreadCache::getInstance()->deallocate(ptr, size);
+        TraceRecorder::recordFree(ptr, size);
+        HeapProfiler::recordFree(ptr);
+        deallocateToFrontEnd(ptr, size);
+    }
+
+    // 不需要大小 可以放在 free() / std::pmr 之后
+    static void deallocate(void* ptr) {
+        TraceRecorder::recordFree(ptr, 0);
+        HeapProfiler::recordFree(ptr);
+        deallocateToFrontEnd(ptr);
+    }
+
+private:
+    // 线程退出之后 ThreadCache 已经析构 getInstance 返回 nullptr 此时直接走 CentralCache
+    static void* allocateFromFrontEnd(std::size_t size) {
+        if (CpuCache::isActive()) {
+            return CpuCache::allocate(size);
+        }
+        if (ThreadCache* cache = ThreadCache::getInstance()) {
+            return cache->allocate(size);
+        }
+        return ThreadCache::allocateWithoutCache(size);
+    }
+
+    static void deallocateToFrontEnd(void* ptr, size_t size) {
+        if (CpuCache::isActive()) {
+            CpuCache::deallocate(ptr, size);
+            return;
+        }
+        if (ThreadCache* cache = ThreadCache::getInstance()) {
+            cache->deallocate(ptr, size);
+        } else {
+            ThreadCache::deallocateWithoutCache(ptr, size);
+        }
+    }
+
+    static void deallocateToFrontEnd(void* ptr) {
+        if (CpuCache::isActive()) {
+            CpuCache::deallocate(ptr);
+            return;
+        }
+        if (ThreadCache* cache = ThreadCache::getInstance()) {
+            cache->deallocate(ptr);
+        } else {
+            ThreadCache::deallocateWithoutCache(ptr, 0);
+        }
     }
 };
 
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <thread>
+#include <utility>
+#include <sys/mman.h>
+
+namespace Pool
+{
+
+// 内存池自身元数据 (Span std::map 的节点) 的分配器
+// 直接向系统 mmap 大块再切分 绝不调用 malloc / new
+// 否则在 LD_PRELOAD 或者后台线程里 内存池内部的申请会重新走进内存池 在 PageCache::mutex_ 上死锁
+// 不是线程安全的 调用者需要持有 PageCache::mutex_
+template <size_t Size, size_t Align>
+class RawMetadataAllocator {
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    void* allocate() {
+        if (freeList_) {
+            void* result = freeList_;
+            freeList_ = *reinterpret_cast<void**>(result);
+            return result;
+        }
+
+        if (remaining_ < SLOT_SIZE) {
+            void* chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk == MAP_FAILED) return nullptr;
+            current_ = static_cast<char*>(chunk);
+            remaining_ = CHUNK_SIZE;
+        }
+
+        void* result = current_;
+        current_ += SLOT_SIZE;
+        remaining_ -= SLOT_SIZE;
+        return result;
+    }
+
+    void deallocate(void* ptr) {
+        *reinterpret_cast<void**>(ptr) = freeList_;
+        freeList_ = ptr;
+    }
+
+private:
+    // 每个槽位至少能放下一个指针 并且满足对齐
+    static const size_t RAW_SIZE = Size < sizeof(void*) ? sizeof(void*) : Size;
+    static const size_t ALIGN = Align < alignof(void*) ? alignof(void*) : Align;
+    static const size_t SLOT_SIZE = (RAW_SIZE + ALIGN - 1) / ALIGN * ALIGN;
+
+    char*   current_ = nullptr;
+    size_t  remaining_ = 0;
+    void*   freeList_ = nullptr;
+};
+
+// 固定类型的对象
+template <typename T>
+class MetadataAllocator {
+public:
+    template <typename... Args>
+    T* create(Args&&... args) {
+        void* ptr = raw_.allocate();
+        return ptr ? new (ptr) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    void destroy(T* ptr) {
+        ptr->~T();
+        raw_.deallocate(ptr);
+    }
+
+private:
+    RawMetadataAllocator<sizeof(T), alignof(T)> raw_;
+};
+
+// 大小不固定的元数据 (span 的空闲位图)
+// 按 2 的幂分档 每档一条空闲链表 释放时要传回申请时的大小
+// 同样不是线程安全的
+class SizedMetadataAllocator {
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    static const size_t MIN_SIZE = 8;
+    static const size_t MAX_SIZE = 4096;
+
+    void* allocate(size_t bytes) {
+        if (bytes == 0 || bytes > MAX_SIZE) return nullptr;
+
+        size_t bucket = bucketOf(bytes);
+        if (void* result = freeLists_[bucket]) {
+            freeLists_[bucket] = *reinterpret_cast<void**>(result);
+            return result;
+        }
+
+        // 当前 chunk 剩下的不够这一档 直接丢掉 最多浪费 MAX_SIZE
+        size_t slot = MIN_SIZE << bucket;
+        if (remaining_ < slot) {
+            void* chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk == MAP_FAILED) return nullptr;
+            current_ = static_cast<char*>(chunk);
+            remaining_ = CHUNK_SIZE;
+        }
+
+        void* result = current_;
+        current_ += slot;
+        remaining_ -= slot;
+        return result;
+    }
+
+    void deallocate(void* ptr, size_t bytes) {
+        size_t bucket = bucketOf(bytes);
+        *reinterpret_cast<void**>(ptr) = freeLists_[bucket];
+        freeLists_[bucket] = ptr;
+    }
+
+private:
+    static const size_t NUM_BUCKETS = 10; // 8B ~ 4KB
+
+    static size_t bucketOf(size_t bytes) {
+        size_t bucket = 0;
+        while ((MIN_SIZE << bucket) < bytes) ++bucket;
+        return bucket;
+    }
+
+    char*   current_ = nullptr;
+    size_t  remaining_ = 0;
+    void*   freeLists_[NUM_BUCKETS] = {};
+};
+
+// 给 std::map 这类按节点分配的容器使用的 STL 分配器
+// 每种节点类型共用一个静态的 RawMetadataAllocator
+// 各个 NUMA 节点的 PageCache 持有不同的锁 所以这里自己再加一把自旋锁
+template <typename T>
+class MetadataStlAllocator {
+public:
+    using value_type = T;
+
+    MetadataStlAllocator() = default;
+    template <typename U>
+    MetadataStlAllocator(const MetadataStlAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n != 1) throw std::bad_alloc();
+        lock();
+        void* ptr = raw().allocate();
+        unlock();
+        if (!ptr) throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) {
+        lock();
+        raw().deallocate(ptr);
+        unlock();
+    }
+
+    template <typename U>
+    bool operator==(const MetadataStlAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const MetadataStlAllocator<U>&) const { return false; }
+
+private:
+    static RawMetadataAllocator<sizeof(T), alignof(T)>& raw() {
+        static RawMetadataAllocator<sizeof(T), alignof(T)> instance;
+        return instance;
+    }
+
+    static void lock() {
+        while (lock_.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    static void unlock() { lock_.clear(std::memory_order_release); }
+
+    static inline std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+};
+
+} // namespace Pool
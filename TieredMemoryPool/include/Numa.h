@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+#include "Common.h"
+
+namespace Pool
+{
+
+// NUMA 拓扑
+// 每个节点有自己的 PageCache 和 CentralCache 线程从所在节点的堆中取内存 访问的都是本地内存
+// 节点和 CPU 的对应关系在第一次使用时从 /sys/devices/system/node 读出 不依赖 libnuma
+//
+// 单节点的机器上可以模拟多个节点 (环境变量 TIEREDPOOL_NUMA_NODES=<n> 或 setSimulatedNodes)
+// 模拟模式下线程按第一次分配的顺序轮流分到各个节点 不调用 mbind 用来测试跨节点释放的路径
+class Numa {
+public:
+    // 节点数 不超过 MAX_NUMA_NODES
+    static size_t numNodes();
+
+    // 当前线程所在的节点 真实拓扑下由 sched_getcpu 查表得到 线程迁移之后会跟着变
+    static size_t currentNode();
+
+    // n 为 0 或 1 时关闭模拟 回到真实拓扑
+    // 需要在第一次分配之前调用 之后再改变节点数 已经分配出去的块可能被送回错误的节点
+    static void setSimulatedNodes(size_t n);
+    static bool isSimulated();
+
+    // 把当前线程固定在某个节点上 真实拓扑下同样生效 (线程已经用 sched_setaffinity 绑核时用)
+    static void setThreadNode(size_t node);
+
+    // 把 [ptr, ptr + size) 的物理页优先放在 node 上 只在真实的多节点机器上调用 mbind
+    static void bindToNode(void* ptr, size_t size, size_t node);
+};
+
+} // namespace Pool
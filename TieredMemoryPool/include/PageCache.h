@@ -1,43 +1,136 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstddef>
-#include <map>
+#include <cstdint>
 #include <mutex>
+#include <set>
 
 #include "Common.h"
+#include "MetadataAllocator.h"
+#include "Numa.h"
+#include "PageMap.h"
 
 namespace Pool 
 {
+
+struct PoolStats;
+
+// 向系统申请的大块内存用什么页来支撑
+enum class HugePagePolicy {
+    None,           // 普通的 4K 页
+    Transparent,    // madvise(MADV_HUGEPAGE) 交给内核的透明大页
+    HugeTLB,        // MAP_HUGETLB 需要事先在 /proc/sys/vm/nr_hugepages 预留 失败时退回普通页
+};
+
 class PageCache {
 public:
     // 4Kb 
-    static const std::size_t PAGE_SIZE = 4096;
+    static const std::size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;
+    static const std::size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+    // 一次向系统预留的地址空间 span 从中顺序切分
+    static const std::size_t ARENA_SIZE = size_t(1) << 30;
 
-    static PageCache& getInstance() {
-        static PageCache instance;
-        return instance;
+    // 每个 NUMA 节点一个 默认取当前线程所在节点的
+    static PageCache& getInstance(size_t node = Numa::currentNode()) {
+        static PageCache* instances = [] {
+            static PageCache caches[MAX_NUMA_NODES];
+            for (size_t i = 0; i < MAX_NUMA_NODES; ++i) {
+                caches[i].node_ = i;
+            }
+            return caches;
+        }();
+        return instances[node];
     }
 
+    // 从本节点的堆中分配 新预留的 arena 通过 mbind 绑定在本节点上
+    // span 可能比 numPages 大 (特别大的请求按大页取整) 实际页数以 getSpan(ptr)->numPages 为准
     void* allocateSpan(size_t numPages);
 
-    void deallocateSpan(void* ptr, size_t numPages);
+    // 可以在任意节点上调用 span 会被送回它所属节点的 PageCache
+    // release 为 true 时先把物理页 madvise 还给系统 (短期内不会再用到的大块)
+    void deallocateSpan(void* ptr, size_t numPages, bool release = false);
+
+    // 由任意地址找到它所属的 span O(1)
+    // 只对已经分配出去的 span 内的地址有效 所有节点共用一个 PageMap 不需要先找节点
+    static Span* getSpan(void* ptr) {
+        return pageMap_.get(reinterpret_cast<uintptr_t>(ptr) >> PAGE_SHIFT);
+    }
+
+    // 空闲 span 中还没有还给系统的字节数
+    size_t getFreeResidentBytes();
+
+    // 把空闲 span 的物理页还给系统 至多 maxBytes 返回实际释放的字节数
+    // 地址空间仍然保留 span 照常留在空闲链表中 再次分配时由缺页重新填充
+    size_t releaseFreePages(size_t maxBytes, bool useMadvFree = false);
+
+    // 累加本节点映射的地址空间和空闲 span
+    void collectStats(PoolStats& stats);
+
+    // 只影响之后新预留的 arena 默认 Transparent 对所有节点生效
+    static void setHugePagePolicy(HugePagePolicy policy);
 
 private:
     PageCache() = default;
 
-    void* systemAlloc(size_t numPages);
+    // 从当前 arena 中切出 numPages 页 不够时再预留一个新的 arena
+    // 单独映射的特别大的请求按大页取整 numPages 改成实际映射的页数
+    void* systemAlloc(size_t& numPages);
+    // 向系统映射一段按 HUGE_PAGE_SIZE 对齐的内存 并按 hugePagePolicy_ 处理
+    void* mapRegion(size_t size);
 
-private:
-    struct Span {
-        void*   pageAddr;
-        size_t  numPages;
-        Span*   next;
+    // 在 pageMap_ 中登记 span 的每一页
+    bool registerSpan(Span* span);
+    // 空闲 span 只需要登记首尾两页 供合并时查找相邻的 span
+    bool registerSpanEdges(Span* span);
+
+    static bool releaseToSystem(void* ptr, size_t bytes, bool useMadvFree);
+
+    // 空闲 span 索引
+    // 放入时登记首尾两页 常驻字节数的统计也在这两个函数里维护
+    void insertFreeSpan(Span* span);
+    void removeFreeSpan(Span* span);
+    // 至少 numPages 页的空闲 span 中最小的一个 (best fit) 没有时返回 nullptr
+    Span* findFreeSpan(size_t numPages);
+
+    // 大 span 按 (页数, 地址) 排序 页数相同时优先用低地址 让高地址的 span 更容易整块空出来
+    struct LargeSpanLess {
+        using is_transparent = void;
+        bool operator()(const Span* a, const Span* b) const {
+            return a->numPages != b->numPages ? a->numPages < b->numPages 
+                                              : a->pageAddr < b->pageAddr;
+        }
+        bool operator()(const Span* a, size_t numPages) const { return a->numPages < numPages; }
+        bool operator()(size_t numPages, const Span* b) const { return numPages < b->numPages; }
     };
 
-    // 记录空闲的 span 的地址
-    std::map<size_t, Span*> freeSpans_;
-    // 记录已经分配的 span 的地址 方便归还
-    std::map<void*, Span*>  spanMap_;
+private:
+    // 不超过 MAX_SMALL_PAGES 页的空闲 span 按页数放进双向链表 下标即页数
+    // 位图记录哪些链表非空 找 best fit 只需要几次 ctz
+    static const size_t MAX_SMALL_PAGES = 128;
+    static const size_t BITMAP_WORDS = MAX_SMALL_PAGES / 64;
+
+    std::array<Span*, MAX_SMALL_PAGES + 1>      smallSpans_{};
+    std::array<uint64_t, BITMAP_WORDS>          smallBitmap_{};
+    // 更大的 span 数量很少 放进红黑树
+    // 节点和 Span 都不能用 new 分配 见 MetadataAllocator
+    std::set<Span*, LargeSpanLess, MetadataStlAllocator<Span*>> largeSpans_;
+    MetadataAllocator<Span> spanAllocator_;
+    // 页号 -> span 替代原来的 std::map<void*, Span*>
+    static PageMap          pageMap_;
+    // 空闲且还占着物理内存的字节数 后台释放线程据此决定要释放多少
+    size_t                  freeResidentBytes_ = 0;
+    // 空闲 span 的个数和总字节数 (包括已经释放的)
+    size_t                  freeSpans_ = 0;
+    size_t                  freeBytes_ = 0;
+    // 向系统映射的字节数 只增不减
+    size_t                  mappedBytes_ = 0;
+    // 当前 arena 中还没有切分出去的部分 [arenaCur_, arenaEnd_)
+    char*                   arenaCur_ = nullptr;
+    char*                   arenaEnd_ = nullptr;
+    static std::atomic<HugePagePolicy> hugePagePolicy_;
+    size_t                  node_ = 0;
     std::mutex              mutex_;
 };
 
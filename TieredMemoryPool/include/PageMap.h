@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <sys/mman.h>
+
+#include "Common.h"
+
+namespace Pool
+{
+
+// 页号 -> Span 的三级基数树
+// 仿照 TCMalloc 的 PageMap3 用于在 O(1) 时间内由任意地址找到它所属的 span
+// x86-64 用户态地址只有 48 位 去掉 12 位页内偏移后页号为 36 位 每一级 12 位
+// 只有真正用到的地址区间才会分配节点 所以整体占用很小
+// 所有 NUMA 节点的 PageCache 共用一棵树 任意地址都能找到 span 再由 span 找到所属的节点
+class PageMap {
+public:
+    static const size_t ADDRESS_BITS = 48;
+    static const size_t BITS = ADDRESS_BITS - PAGE_SHIFT;
+    static const size_t ROOT_BITS = (BITS + 2) / 3;
+    static const size_t MID_BITS = (BITS + 2) / 3;
+    static const size_t LEAF_BITS = BITS - ROOT_BITS - MID_BITS;
+
+    static const size_t ROOT_LENGTH = size_t(1) << ROOT_BITS;
+    static const size_t MID_LENGTH = size_t(1) << MID_BITS;
+    static const size_t LEAF_LENGTH = size_t(1) << LEAF_BITS;
+
+    // constexpr 构造 作为静态变量时在编译期完成初始化
+    // 否则 LD_PRELOAD 下动态初始化之前的 malloc 登记的 span 会被构造函数清掉
+    constexpr PageMap() : root_{} {}
+
+    // 查询 页号 对应的 span 没有记录时返回 nullptr
+    // 读操作不加锁 调用者保证查询的页已经通过 set 注册过
+    Span* get(size_t pageId) const {
+        if ((pageId >> BITS) != 0) return nullptr;
+
+        const size_t i1 = pageId >> (MID_BITS + LEAF_BITS);
+        const size_t i2 = (pageId >> LEAF_BITS) & (MID_LENGTH - 1);
+        const size_t i3 = pageId & (LEAF_LENGTH - 1);
+
+        Node* mid = root_[i1].load(std::memory_order_acquire);
+        if (!mid) return nullptr;
+        Leaf* leaf = mid->children[i2].load(std::memory_order_acquire);
+        if (!leaf) return nullptr;
+        return leaf->spans[i3];
+    }
+
+    // 写操作需要在所属节点 PageCache 的锁内完成 调用前先 ensure
+    // 不同节点写的是不同的页 互不干扰
+    void set(size_t pageId, Span* span) {
+        const size_t i1 = pageId >> (MID_BITS + LEAF_BITS);
+        const size_t i2 = (pageId >> LEAF_BITS) & (MID_LENGTH - 1);
+        const size_t i3 = pageId & (LEAF_LENGTH - 1);
+
+        Node* mid = root_[i1].load(std::memory_order_relaxed);
+        mid->children[i2].load(std::memory_order_relaxed)->spans[i3] = span;
+    }
+
+    // 保证 [start, start + n) 这一段页号的节点都已经分配
+    // 节点一旦装上就不会再变 绝大多数时候都已经存在 只需要 acquire 读一下
+    // 真的缺节点时才加锁 多个节点的 PageCache 可能同时需要同一个中间节点
+    bool ensure(size_t start, size_t n) {
+        for (size_t key = start; key < start + n; ) {
+            if ((key >> BITS) != 0) return false;
+
+            const size_t i1 = key >> (MID_BITS + LEAF_BITS);
+            const size_t i2 = (key >> LEAF_BITS) & (MID_LENGTH - 1);
+
+            Node* mid = root_[i1].load(std::memory_order_acquire);
+            if (!mid || !mid->children[i2].load(std::memory_order_acquire)) {
+                if (!grow(i1, i2)) return false;
+            }
+
+            // 跳到下一个叶子节点覆盖的起始页号
+            key = ((key >> LEAF_BITS) + 1) << LEAF_BITS;
+        }
+        return true;
+    }
+
+private:
+    struct Leaf {
+        Span* spans[LEAF_LENGTH];
+    };
+
+    // 全零就是空指针 mmap 出来就可以直接用
+    struct Node {
+        std::atomic<Leaf*> children[MID_LENGTH];
+    };
+
+    // 加锁之后再检查一遍 别的线程可能刚刚装好
+    // 节点初始化好之后才 release 发布 无锁读到指针的线程一定能看到清零的内容
+    bool grow(size_t i1, size_t i2) {
+        std::lock_guard<std::mutex> lock(growMutex_);
+        Node* mid = root_[i1].load(std::memory_order_relaxed);
+        if (!mid) {
+            mid = static_cast<Node*>(allocNode(sizeof(Node)));
+            if (!mid) return false;
+            root_[i1].store(mid, std::memory_order_release);
+        }
+        if (!mid->children[i2].load(std::memory_order_relaxed)) {
+            Leaf* leaf = static_cast<Leaf*>(allocNode(sizeof(Leaf)));
+            if (!leaf) return false;
+            mid->children[i2].store(leaf, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // 节点直接向系统申请 不能走内存池自身 否则会递归
+    // mmap 返回的内存已经清零 所以不需要初始化
+    static void* allocNode(size_t bytes) {
+        void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+private:
+    std::atomic<Node*>  root_[ROOT_LENGTH];
+    std::mutex          growMutex_;
+};
+
+} // namespace Pool
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "Common.h"
+#include "MemoryPool.h"
+
+namespace Pool
+{
+
+// 让 STL 容器直接使用三级缓存
+
+// 大小和对齐都对应到一个 size class 上 释放时用同样的方法算回来 走知道大小的快速路径
+// 超过 MAX_BYTES 的整页分配 本来就按页对齐
+// 对齐超过一页的 交给 operator new
+inline size_t poolAllocationSize(size_t bytes, size_t alignment) {
+    if (bytes == 0) bytes = 1;
+    if (alignment > (size_t(1) << PAGE_SHIFT)) return 0;
+    if (bytes > MAX_BYTES) return bytes;
+    return SizeClass::alignedSize(bytes, alignment);
+}
+
+// std::pmr 接口
+class PoolResource : public std::pmr::memory_resource
+{
+public:
+    // 所有线程共用同一套三级缓存 一个就够了
+    static PoolResource* getInstance() {
+        static PoolResource instance;
+        return &instance;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        size_t size = poolAllocationSize(bytes, alignment);
+        if (size == 0) {
+            return operator new(bytes, std::align_val_t(alignment));
+        }
+        void* p = MemoryPool::allocate(size);
+        if (p == nullptr) throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        size_t size = poolAllocationSize(bytes, alignment);
+        if (size == 0) {
+            operator delete(p, std::align_val_t(alignment));
+            return;
+        }
+        MemoryPool::deallocate(p, size);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return dynamic_cast<const PoolResource*>(&other) != nullptr;
+    }
+};
+
+// 满足 Allocator 要求的分配器
+// 容器 rebind 到节点类型之后 绝大多数是 n == 1 的申请
+// 这时大小和对齐都是编译期常量 直接走 MemoryPool 知道大小的路径 释放时不用查 PageMap
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        void* p = nullptr;
+        if (NODE_FAST_PATH && n == 1) {
+            p = MemoryPool::allocate(sizeof(T));
+        } else {
+            if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+            p = PoolResource::getInstance()->allocate(n * sizeof(T), alignof(T));
+        }
+        if (p == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if (NODE_FAST_PATH && n == 1) {
+            MemoryPool::deallocate(p, sizeof(T));
+        } else {
+            PoolResource::getInstance()->deallocate(p, n * sizeof(T), alignof(T));
+        }
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+
+private:
+    static constexpr bool NODE_FAST_PATH = sizeof(T) <= MAX_BYTES && alignof(T) <= ALIGNMENT;
+};
+
+} // namespace Pool
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Pool
+{
+
+// 跨线程释放 (mimalloc 的 thread-delayed-free)
+// 生产者线程分配 消费者线程释放时 块原本会留在消费者的 ThreadCache 里 生产者只能一直去 CentralCache 要
+// 打开之后 CentralCache 在 span 上记下从它取走块的线程 (span->owner)
+// 别的线程释放这个 span 中的块 直接推到所有者的 MPSC 队列上 所有者下一次 miss 时整条取回
+// 所有者只能有一个: span 的块 (包括经过 TransferCache 的整批) 交到第二个线程手里时清掉
+// 否则第二个线程释放自己的块也会推给原来的所有者 span 全空之后再由下一个取块的线程认领
+//
+// 每个线程一个队列 放在全局的数组里 线程退出之后队列关闭 推送失败的块由释放者自己处理
+// 编号会被新线程复用 块本身和线程无关 推给新线程也没有问题
+class RemoteFree {
+public:
+    static const uint16_t NO_OWNER = 0;
+    static const size_t MAX_OWNERS = 1024;
+
+    static void enable(bool enabled = true) { enabled_.store(enabled, std::memory_order_relaxed); }
+    static bool isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // 为新线程分配一个队列 用完时返回 NO_OWNER (这个线程的块不会被推回来)
+    static uint16_t acquire();
+    // 线程退出 关闭队列 返回队列中剩下的块 编号可以给新线程使用
+    static void* release(uint16_t owner);
+
+    // 推到 owner 的队列上 队列已经关闭时返回 false
+    static bool push(uint16_t owner, void* block) {
+        Slot& slot = slots_[owner];
+        void* head = slot.head.load(std::memory_order_relaxed);
+        do {
+            if (reinterpret_cast<uintptr_t>(head) == CLOSED) return false;
+            *reinterpret_cast<void**>(block) = head;
+        } while (!slot.head.compare_exchange_weak(head, block,
+                     std::memory_order_release, std::memory_order_relaxed));
+        return true;
+    }
+
+    // 只有所有者 (或者确认所有者没有在使用时的回收线程) 可以调用
+    static void* drain(uint16_t owner) {
+        Slot& slot = slots_[owner];
+        if (slot.head.load(std::memory_order_relaxed) == nullptr) return nullptr;
+        return slot.head.exchange(nullptr, std::memory_order_acquire);
+    }
+
+private:
+    // 每个队列独占一条缓存行 不同线程的推送互不干扰
+    // 全零就是合法的初始状态 静态数组不需要动态初始化 (LD_PRELOAD 下可能在初始化之前就被用到)
+    struct alignas(64) Slot {
+        std::atomic<void*>  head{nullptr};
+        bool                used = false;
+    };
+
+    // 关闭的队列 head 为这个值 不会是合法的块地址
+    static const uintptr_t      CLOSED = 1;
+
+    static Slot                 slots_[MAX_OWNERS];
+    static std::atomic<bool>    enabled_;
+};
+
+} // namespace Pool
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include "MetadataAllocator.h"
+
+namespace Pool
+{
+
+struct ScavengerOptions {
+    // 空闲但仍然常驻的字节数超过它才开始释放 留一部分给下一波流量 避免反复缺页
+    size_t                      retainedBytes = 64 * 1024 * 1024;
+    // 每秒至多释放的字节数 流量只是短暂回落时不会把马上又要用到的页全部还回去
+    size_t                      releaseBytesPerSecond = 256 * 1024 * 1024;
+    // 两轮之间的间隔
+    std::chrono::milliseconds   interval{200};
+    // true 用 MADV_FREE (更便宜 RSS 延迟下降) false 用 MADV_DONTNEED
+    bool                        useMadvFree = false;
+    // 是否顺便回收空闲线程的 ThreadCache (以及空闲 CPU 的 slab) 和 Arena 备用 span
+    bool                        reclaimThreadCaches = true;
+};
+
+// 可选的后台释放线程
+// 每一轮: 回收空闲线程的缓存和 Arena 备用 span -> CentralCache 延迟归还 -> PageCache 把多余的空闲页 madvise 给系统
+// 这样流量高峰过去之后 RSS 能回落到和实际使用量相当的水平
+class Scavenger {
+public:
+    static Scavenger& getInstance();
+
+    // 已经在运行时只更新参数 下一轮生效
+    void start(const ScavengerOptions& options = ScavengerOptions());
+    void stop();
+    bool isRunning();
+
+    // 同步执行一轮 至多释放 maxReleaseBytes 返回释放的字节数
+    // 不想开线程时也可以自己在合适的时机调用
+    size_t runOnce(size_t maxReleaseBytes);
+
+private:
+    Scavenger() : cv_(cvAllocator_.create()) {}
+    ~Scavenger();
+
+    Scavenger(const Scavenger&) = delete;
+    Scavenger& operator=(const Scavenger&) = delete;
+
+    void run();
+
+    // fork 时后台线程不能正持有内存池的锁 子进程里也没有这个线程
+    static void prepareFork();
+    static void parentAfterFork();
+    static void childAfterFork();
+
+private:
+    ScavengerOptions            options_;
+    bool                        running_ = false;
+    std::thread                 thread_;
+    std::mutex                  mutex_;
+    // 通过指针使用 fork 之后子进程里的那个还记着父进程的线程在等待
+    // 析构它 glibc 会一直等那个线程醒来 所以只能丢下 另外构造一个新的
+    MetadataAllocator<std::condition_variable>  cvAllocator_;
+    std::condition_variable*    cv_;
+    // runOnce 全程持有 fork 前拿到它就说明后台线程不在内存池内部
+    std::mutex                  runMutex_;
+};
+
+} // namespace Pool
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "Common.h"
+
+namespace Pool
+{
+
+// 每个 size class 的统计
+struct SizeClassStats {
+    size_t      size = 0;
+    // 经过 ThreadCache 的分配 / 释放次数 (CpuCache 的快速路径不计数)
+    uint64_t    allocs = 0;
+    uint64_t    frees = 0;
+    // ThreadCache 的 freeList_ 为空 去 CentralCache 取的次数
+    uint64_t    misses = 0;
+    // 切分成这一类的 span 数和字节数
+    size_t      spans = 0;
+    size_t      spanBytes = 0;
+    // 各层缓存着的空闲块 和 交给了程序还没有释放的块
+    size_t      threadCachedBytes = 0;
+    size_t      cpuCachedBytes = 0;
+    size_t      centralCachedBytes = 0;
+    size_t      inUseBytes = 0;
+};
+
+// 整个内存池的快照 由 getStats 汇总
+// 各个线程 / CPU / 节点分别计数 汇总时并没有停下所有线程 各项之间可能有少量出入
+struct PoolStats {
+    std::array<SizeClassStats, FREE_LIST_SIZE> sizeClasses;
+
+    // 小块合计
+    uint64_t    allocs = 0;
+    uint64_t    frees = 0;
+    uint64_t    threadCacheHits = 0;
+    uint64_t    threadCacheMisses = 0;
+    size_t      inUseBytes = 0;
+    size_t      threadCachedBytes = 0;
+    size_t      cpuCachedBytes = 0;
+    size_t      centralCachedBytes = 0;
+    size_t      threadCaches = 0;
+
+    // 超过 MAX_BYTES 的大块 见 LargeCache
+    uint64_t    largeAllocs = 0;
+    uint64_t    largeFrees = 0;
+    size_t      largeInUseBytes = 0;
+    size_t      largeCachedBytes = 0;
+
+    // PageCache 中的空闲 span 以及其中还没有 madvise 的部分
+    size_t      pageCacheFreeSpans = 0;
+    size_t      pageCacheFreeBytes = 0;
+    size_t      pageCacheFreeResidentBytes = 0;
+
+    // 向系统映射的地址空间 其中 arena 还没有切出去的部分从来没有被访问过
+    size_t      mappedBytes = 0;
+    size_t      arenaUnusedBytes = 0;
+    // 内存池估计自己占着的物理内存: 映射的 - 没切出去的 - 已经 madvise 的空闲页
+    size_t      residentBytes = 0;
+    // 整个进程的 RSS (/proc/self/statm) 包括不属于内存池的部分
+    size_t      processResidentBytes = 0;
+
+    // 1 - 程序正在使用的字节数 / residentBytes 缓存和碎片占的比例
+    double      fragmentation = 0;
+};
+
+// 汇总各层的计数 开销和线程数 节点数成正比 不要放在热路径上
+PoolStats getStats();
+
+// 打印成表格 只列出用到过的 size class
+void dumpStats(FILE* out);
+
+} // namespace Pool
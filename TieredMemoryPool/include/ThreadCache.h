@@ -1,44 +1,167 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
 
 #include "Common.h"
 
 namespace Pool 
 {
 
+struct PoolStats;
+
 class ThreadCache {
 public:
 // 这表明 instance 是线程局部存储的，意味着每个线程都会有自己的 ThreadCache 实例。
 // 通过 static 关键字修饰成员函数 getInstance，确保每次调用该函数时只会初始化一次 instance。
+// 线程退出时 instance 析构之后 同一线程中更晚的 free (例如其他 thread_local 的析构) 不能再使用它
+// 此时返回 nullptr 由调用者改用 allocateWithoutCache / deallocateWithoutCache
     static ThreadCache* getInstance() {
+        if (destroyed_) return nullptr;
         static thread_local ThreadCache instance;
         return &instance;
     }
 
     void* allocate(size_t size);
+    // 已知大小时直接计算 index 不需要查 PageMap
     void deallocate(void* ptr, size_t size);
+    // 不知道大小时通过 PageMap 找到 span 上记录的 size class
+    void deallocate(void* ptr);
+
+    // 线程缓存已经析构 直接与 CentralCache 交互
+    static void* allocateWithoutCache(size_t size);
+    // size 为 0 表示不知道大小
+    static void deallocateWithoutCache(void* ptr, size_t size);
+
+    // 遍历所有存活的线程缓存 把自上次调用以来没有任何分配释放的 (空闲线程) 全部归还给 CentralCache
+    // 打开了 CpuCache 时 空闲 CPU 的 slab 也一起清空
+    // 由后台线程周期性调用 返回回收的字节数
+    static size_t reclaimIdleCaches();
+
+    // 累加所有线程缓存 (包括已经退出的线程) 的计数和缓存着的字节数
+    static void collectStats(PoolStats& stats);
 
 private:
-    ThreadCache() {
-        freeList_.fill(nullptr);
-        freeListSize_.fill(0);
-    }
+    ThreadCache();
+    // 线程退出时把所有 freeList_ 成批归还给 CentralCache 避免泄漏
+    ~ThreadCache();
+
+    // 标记本线程正在使用自己的线程缓存
+    // reclaimIdleCaches 需要从别的线程访问 但加锁会让快速路径慢好几倍
+    // 这里用非对称的 Dekker: 本线程只做普通的读写 回收线程用 membarrier 让所有线程执行一次内存屏障
+    class UseGuard {
+    public:
+        explicit UseGuard(ThreadCache& cache) : cache_(cache) {
+            for (;;) {
+                cache_.inUse_.store(true, std::memory_order_relaxed);
+                // 只需要阻止编译器重排 CPU 层面的屏障由 membarrier 补上
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                if (!cache_.reclaiming_.load(std::memory_order_acquire)) break;
+
+                // 正在被回收 等回收结束
+                cache_.inUse_.store(false, std::memory_order_release);
+                while (cache_.reclaiming_.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+            }
+            cache_.active_ = true;
+        }
+        ~UseGuard() {
+            cache_.inUse_.store(false, std::memory_order_release);
+        }
+
+    private:
+        ThreadCache& cache_;
+    };
+
+    // 在持有 registryMutex_ 时调用 对每个此刻没有被本线程使用的线程缓存调用 fn
+    // wait 为 true 时等正在使用的线程用完 否则跳过它们
+    template <typename Fn>
+    static void forEachQuiescent(bool wait, Fn fn);
+
+    // 归还所有 freeList_ 返回归还的字节数
+    size_t releaseAll();
+
+    // 别的线程释放的块属于本线程切分的 span 推回所有者的队列 见 RemoteFree
+    // 本线程就是所有者或者推送失败时返回 false 由调用者放进自己的 freeList_
+    bool pushRemote(void* ptr, const Span* span);
+    // 把从队列取回的链表按 size class 放回 freeList_ 超过 maxLength_ 的部分归还
+    void absorbRemoteFrees(void* list);
+
+    // 从 freeList_[index] 头部取下一块 调用者保证非空
+    void* popFreeList(size_t index);
+
+    // 放回 freeList_[index]
+    void deallocateByIndex(void* ptr, size_t index);
 
     // 从中心缓存获取内存
     void* fetchFromCentralCache(size_t index);
-    // 归还内存到中心缓存
-    void returnToCentralCache(void* start, size_t size);
+    // 从 freeList_[index] 头部取下 num 块归还到中心缓存
+    void returnToCentralCache(size_t index, size_t num);
 
     bool shouldReturnToCentralCache(size_t index);
 
+    // freeList_[index] 超过了 maxLength_ 归还一批并调整 maxLength_
+    void listTooLong(size_t index);
+
+    // 整个线程缓存的字节数超过预算时 从冷的 size class 中回收
+    void scavenge();
+
 private:
+    // 单个 freeList_ 的长度上限
+    static const size_t                 MAX_FREE_LIST_LENGTH = 8192;
+    // 连续溢出多少次之后缩小 maxLength_
+    static const size_t                 MAX_OVERAGES = 3;
+    // 每个线程缓存的总字节数预算
+    static const size_t                 MAX_CACHE_BYTES = 4 * 1024 * 1024;
+
+
     // 用数组实现 自由链表
     // 相同大小的缓存放在一个块中 
     // 再用一个数组保存 块的大小 和已经放了多少个
     std::array<void*, FREE_LIST_SIZE>   freeList_;
     std::array<size_t, FREE_LIST_SIZE>  freeListSize_;
+
+    // 每个 size class 可以缓存的最大块数 miss 时增长 溢出时缩小
+    std::array<uint32_t, FREE_LIST_SIZE> maxLength_;
+    // 在 maxLength_ 已经不小于一批时 连续溢出的次数
+    std::array<uint32_t, FREE_LIST_SIZE> lengthOverages_;
+    // 上次 scavenge 以来 freeList_ 长度的最小值 大于 0 说明这些块一直没有被用到
+    std::array<uint32_t, FREE_LIST_SIZE> lowWater_;
+
+    // 当前缓存的总字节数
+    size_t                              totalBytes_ = 0;
+
+    // 跨线程释放的队列编号 没有打开 RemoteFree 时为 NO_OWNER
+    uint16_t                            owner_ = 0;
+
+    // 统计 只由本线程写 collectStats 在 forEachQuiescent 中读
+    std::array<uint64_t, FREE_LIST_SIZE> allocCount_;
+    std::array<uint64_t, FREE_LIST_SIZE> freeCount_;
+    std::array<uint64_t, FREE_LIST_SIZE> missCount_;
+    // 已经退出的线程和没有线程缓存时的计数 由 registryMutex_ 保护
+    static std::array<uint64_t, FREE_LIST_SIZE> retiredAllocs_;
+    static std::array<uint64_t, FREE_LIST_SIZE> retiredFrees_;
+    static std::array<uint64_t, FREE_LIST_SIZE> retiredMisses_;
+
+    // 本线程是否正在使用 / 其他线程是否正在回收 见 UseGuard
+    alignas(64) std::atomic<bool>       inUse_{false};
+    alignas(64) std::atomic<bool>       reclaiming_{false};
+    // 自上次 reclaimIdleCaches 以来是否有过分配释放
+    bool                                active_ = true;
+
+    // 所有存活的线程缓存组成的双向链表
+    ThreadCache*                        prev_ = nullptr;
+    ThreadCache*                        next_ = nullptr;
+    static ThreadCache*                 registryHead_;
+    static std::mutex                   registryMutex_;
+
+    // 本线程的 ThreadCache 是否已经析构
+    static thread_local bool            destroyed_;
 };
 
 } // namespace Pool
\ No newline at end of file
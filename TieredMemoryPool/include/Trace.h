@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Pool
+{
+
+enum class TraceOp : uint8_t {
+    Allocate = 0,
+    Free = 1,
+};
+
+// 跟踪文件开头的文件头 之后全是 TraceRecord
+struct TraceHeader {
+    char        magic[8];       // "POOLTRC"
+    uint32_t    version;
+    uint32_t    recordSize;
+};
+
+// 每次分配 / 释放一条 24 字节
+// 文件中按线程分段 同一线程内是程序顺序 线程之间按 timestamp 排序还原
+// 分配在返回之后取时间 释放在真正释放之前取时间 所以同一个地址的释放总是早于它再次被分配
+struct TraceRecord {
+    uint64_t    timestamp;      // CLOCK_MONOTONIC 纳秒
+    uint64_t    ptr;            // 原始地址 只用来配对分配和释放 pool_replay 换成对象编号
+    uint32_t    size;           // 释放时不知道大小记为 0
+    uint16_t    thread;         // 线程按第一次记录的顺序编号
+    TraceOp     op;
+    uint8_t     reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord 必须是 24 字节");
+
+// 记录每一次分配释放 离线用 pool_replay 在别的分配器 / 配置上按原来的交错顺序重放
+// 每个线程一个环形缓冲区 只有本线程写 后台线程定期取走写进文件 不需要锁
+// 缓冲区满了 (写文件跟不上) 时记录的线程等待 不丢记录 否则重放时分配和释放对不上
+// 缓冲区和后台线程都不经过内存池 LD_PRELOAD 时也不会记录自己
+class TraceRecorder {
+public:
+    static const uint32_t   VERSION = 1;
+    static const size_t     RING_CAPACITY = 1 << 16;
+
+    // 打开文件 写入文件头 启动后台线程 已经在记录或者打开失败时返回 false
+    static bool start(const char* path);
+    // 停止记录 写完所有缓冲区中的记录后关闭文件
+    static void stop();
+    static bool isRunning() { return running_.load(std::memory_order_relaxed); }
+
+    static void recordAllocation(void* ptr, size_t size) {
+        if (!isRunning() || ptr == nullptr) return;
+        append(TraceOp::Allocate, ptr, size);
+    }
+
+    static void recordFree(void* ptr, size_t size) {
+        if (!isRunning() || ptr == nullptr) return;
+        append(TraceOp::Free, ptr, size);
+    }
+
+    // 已经写进文件的记录数 和缓冲区满了需要等待的次数
+    static uint64_t recordCount();
+    static uint64_t stallCount();
+
+private:
+    static void append(TraceOp op, void* ptr, size_t size);
+
+    static void prepareFork();
+    static void parentAfterFork();
+    static void childAfterFork();
+
+    static std::atomic<bool> running_;
+};
+
+} // namespace Pool
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Pool
+{
+
+// CentralCache 前面的一层 无锁 有界 MPMC 环形队列 (Dmitry Vyukov)
+// 每一个元素是一批已经串好的块的头指针 一批的块数固定为 SizeClass::numMoveSize
+// ThreadCache 整批归还 / 整批申请时只需要一次 CAS 不需要进入 CentralCache 的自旋锁
+//
+// cell 中的 seq 存的是 真实序号 - cell 下标
+// 这样全零的内存就是一个合法的空队列 CentralCache 作为静态单例不需要逐个初始化
+class TransferCache {
+public:
+    static const size_t CAPACITY = 8; // 必须是 2 的幂
+
+    // 放入一批 队列满时返回 false
+    bool push(void* batch) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        for (;;) {
+            size_t idx = pos & (CAPACITY - 1);
+            cell = &cells_[idx];
+            size_t seq = cell->seq.load(std::memory_order_acquire) + idx;
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->batch = batch;
+        cell->seq.store(pos + 1 - (pos & (CAPACITY - 1)), std::memory_order_release);
+        return true;
+    }
+
+    // 取出一批 队列空时返回 nullptr
+    void* pop() {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        for (;;) {
+            size_t idx = pos & (CAPACITY - 1);
+            cell = &cells_[idx];
+            size_t seq = cell->seq.load(std::memory_order_acquire) + idx;
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        void* batch = cell->batch;
+        cell->seq.store(pos + CAPACITY - (pos & (CAPACITY - 1)), std::memory_order_release);
+        return batch;
+    }
+
+    // 当前的批数 只用于统计 并发修改时是个近似值
+    size_t size() const {
+        size_t enqueued = enqueuePos_.load(std::memory_order_relaxed);
+        size_t dequeued = dequeuePos_.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? std::min<size_t>(enqueued - dequeued, size_t(CAPACITY)) : 0;
+    }
+
+private:
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        void*               batch;
+    };
+
+    Cell                            cells_[CAPACITY];
+    // 入队和出队的位置放在不同的缓存行 避免伪共享
+    alignas(64) std::atomic<size_t> enqueuePos_;
+    alignas(64) std::atomic<size_t> dequeuePos_;
+};
+
+} // namespace Pool
@@ -0,0 +1,221 @@
+#include "../include/Arena.h"
+#include "../include/PageCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace Pool
+{
+
+namespace
+{
+
+// 每个线程的备用 span
+// reset 之后马上又会有下一个请求 span 直接在本线程中复用 不用再去抢 PageCache 的锁
+// 按字节数设上限 检查点之后申请的大 span 也能留下来 但一个线程最多占着 MAX_SPARE_BYTES
+// 所有线程的备用链表串在一起 Scavenger 把一段时间没有用过的还给 PageCache
+class SpareSpans {
+public:
+    static const size_t MAX_SPARE_SPANS = 64;
+    static const size_t MAX_SPARE_BYTES = 4 * 1024 * 1024;
+
+    // 线程退出 析构之后返回 nullptr 直接和 PageCache 交互
+    static SpareSpans* getInstance() {
+        if (destroyed_) return nullptr;
+        static thread_local SpareSpans instance;
+        return &instance;
+    }
+
+    // 放得下的里面最小的那个 多出来的页 Arena 照样可以用
+    void* pop(size_t numPages) {
+        lock();
+        active_ = true;
+        size_t best = count_;
+        for (size_t i = 0; i < count_; ++i) {
+            if (spans_[i].numPages >= numPages &&
+                (best == count_ || spans_[i].numPages < spans_[best].numPages)) {
+                best = i;
+            }
+        }
+        void* span = nullptr;
+        if (best != count_) {
+            span = spans_[best].span;
+            bytes_ -= spans_[best].numPages * PageCache::PAGE_SIZE;
+            spans_[best] = spans_[--count_];
+        }
+        unlock();
+        return span;
+    }
+
+    bool push(void* span, size_t numPages) {
+        size_t bytes = numPages * PageCache::PAGE_SIZE;
+        lock();
+        active_ = true;
+        bool kept = count_ < MAX_SPARE_SPANS && bytes_ + bytes <= MAX_SPARE_BYTES;
+        if (kept) {
+            spans_[count_++] = Spare{span, numPages};
+            bytes_ += bytes;
+        }
+        unlock();
+        return kept;
+    }
+
+    // 和 ThreadCache::reclaimIdleCaches 一样 两次调用之间没有用过的线程才释放
+    static size_t releaseIdle() {
+        size_t released = 0;
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        for (SpareSpans* spare = registryHead_; spare; spare = spare->next_) {
+            spare->lock();
+            if (!spare->active_) {
+                released += spare->releaseAll();
+            }
+            spare->active_ = false;
+            spare->unlock();
+        }
+        return released;
+    }
+
+private:
+    struct Spare {
+        void*   span;
+        size_t  numPages;
+    };
+
+    SpareSpans() {
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        next_ = registryHead_;
+        if (registryHead_) {
+            registryHead_->prev_ = this;
+        }
+        registryHead_ = this;
+    }
+
+    ~SpareSpans() {
+        {
+            // 先摘下 之后 Scavenger 就不会再访问它
+            std::lock_guard<std::mutex> lock(registryMutex_);
+            if (prev_) {
+                prev_->next_ = next_;
+            } else {
+                registryHead_ = next_;
+            }
+            if (next_) {
+                next_->prev_ = prev_;
+            }
+        }
+        releaseAll();
+        destroyed_ = true;
+    }
+
+    size_t releaseAll() {
+        size_t released = bytes_;
+        while (count_ > 0) {
+            --count_;
+            PageCache::getInstance().deallocateSpan(spans_[count_].span, spans_[count_].numPages);
+        }
+        bytes_ = 0;
+        return released;
+    }
+
+    // 只有本线程和 Scavenger 会来抢 几乎总是一次就能拿到
+    void lock() {
+        while (lock_.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    void unlock() { lock_.clear(std::memory_order_release); }
+
+private:
+    Spare                       spans_[MAX_SPARE_SPANS];
+    size_t                      count_ = 0;
+    size_t                      bytes_ = 0;
+    bool                        active_ = false;   // 自上次 releaseIdle 以来是否用过
+    std::atomic_flag            lock_ = ATOMIC_FLAG_INIT;
+    SpareSpans*                 prev_ = nullptr;
+    SpareSpans*                 next_ = nullptr;
+
+    static SpareSpans*          registryHead_;
+    static std::mutex           registryMutex_;
+    static thread_local bool    destroyed_;
+};
+
+SpareSpans*         SpareSpans::registryHead_ = nullptr;
+std::mutex          SpareSpans::registryMutex_;
+thread_local bool   SpareSpans::destroyed_ = false;
+
+void* acquireSpan(size_t numPages) {
+    if (SpareSpans* spare = SpareSpans::getInstance()) {
+        if (void* span = spare->pop(numPages)) {
+            return span;
+        }
+    }
+    return PageCache::getInstance().allocateSpan(numPages);
+}
+
+void releaseSpan(void* span, size_t numPages) {
+    if (SpareSpans* spare = SpareSpans::getInstance()) {
+        if (spare->push(span, numPages)) {
+            return;
+        }
+    }
+    PageCache::getInstance().deallocateSpan(span, numPages);
+}
+
+} // namespace
+
+size_t Arena::releaseSpareSpans() {
+    return SpareSpans::releaseIdle();
+}
+
+Arena::Arena(size_t spanPages)
+    : spanPages_(std::max<size_t>(spanPages, 1))
+{}
+
+Arena::~Arena() {
+    reset();
+}
+
+char* Arena::chunkEnd(Chunk* chunk) {
+    return reinterpret_cast<char*>(chunk) + chunk->numPages * PageCache::PAGE_SIZE;
+}
+
+// 当前 span 放不下 再申请一个
+// 特别大的申请单独占一个 span 当前 span 剩下的部分就浪费了
+void* Arena::allocateSlow(size_t size, size_t alignment) {
+    if (size == 0) size = 1;
+
+    size_t need = sizeof(Chunk) + alignment + size;
+    size_t numPages = std::max(spanPages_, (need + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE);
+
+    void* span = acquireSpan(numPages);
+    if (!span) return nullptr;
+
+    // PageCache 可能给出更大的 span 多出来的部分照样可以用 释放时也要按它的页数
+    Chunk* chunk = static_cast<Chunk*>(span);
+    chunk->prev = current_;
+    chunk->numPages = PageCache::getSpan(span)->numPages;
+    current_ = chunk;
+    ++spanCount_;
+
+    cur_ = reinterpret_cast<char*>(chunk + 1);
+    end_ = chunkEnd(chunk);
+    return allocate(size, alignment);
+}
+
+void Arena::rollback(const Checkpoint& checkpoint) {
+    Chunk* target = static_cast<Chunk*>(checkpoint.chunk);
+
+    while (current_ != target) {
+        Chunk* prev = current_->prev;
+        releaseSpan(current_, current_->numPages);
+        current_ = prev;
+        --spanCount_;
+    }
+
+    cur_ = checkpoint.cur;
+    end_ = current_ ? chunkEnd(current_) : nullptr;
+}
+
+} // namespace Pool
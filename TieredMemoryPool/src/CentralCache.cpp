@@ -3,9 +3,12 @@
 #include <cstddef>
 #include <thread>
 #include <chrono>
+#include <cstring>
 
 #include "../include/CentralCache.h"
 #include "../include/PageCache.h"
+#include "../include/RemoteFree.h"
+#include "../include/Stats.h"
 
 namespace Pool
 {
@@ -14,29 +17,57 @@ const std::chrono::milliseconds CentralCache::DELAY_INTERVAL{1000};
 
 static const size_t SPAN_PAGES = 8;
 
+// 统计计数只在持有锁时修改 不需要原子的加法 只要读的一方不会读到撕裂的值
+// delta 按无符号回绕 减法传补码
+static void addRelaxed(std::atomic<size_t>& counter, size_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// 位图中 1 的个数
+[[maybe_unused]] static size_t countFreeBits(const Span* span) {
+    size_t bits = 0;
+    for (size_t word = 0; word < (span->carved + 63) / 64; ++word) {
+        bits += __builtin_popcountll(span->freeBitmap[word]);
+    }
+    return bits;
+}
+
 // initial
 CentralCache::CentralCache() {
-    for (auto& ptr : centralFreeList_) {
-        ptr.store(nullptr, std::memory_order_relaxed);
-    }
     for (auto& lock : locks_) {
         lock.clear();
     }
-    for (auto& count : delayCounts_) {
+    for (auto& count : spanCount_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    for (auto& count : freeBlocks_) {
         count.store(0, std::memory_order_relaxed);
     }
     for (auto& time : lastReturnTime_) {
         time = std::chrono::steady_clock::now();
     }
-    spanCount_.store(0, std::memory_order_relaxed);
 }
 
 
-// 从中心缓存获取内存块 传入 index 查找 list 中是否有空闲
+// 从中心缓存获取内存块 传入 index 查找是否有还有空闲块的 span
 // 如果没有那么进入 页缓存 申请
-void* CentralCache::fetchRange(size_t index) {
-    if (index >= FREE_LIST_SIZE) {
-        return nullptr;
+size_t CentralCache::fetchRange(void*& start, size_t batchNum, size_t index, uint16_t owner) {
+    start = nullptr;
+    if (index >= FREE_LIST_SIZE || batchNum == 0) {
+        return 0;
+    }
+
+    size_t size = SizeClass::SizeForIndex(index);
+
+    // 整批申请 先尝试无锁的 transfer cache
+    if (batchNum == SizeClass::numMoveSize(size)) {
+        if (void* batch = transferCaches_[index].pop()) {
+            if (RemoteFree::isEnabled()) {
+                disownBatch(batch, owner);
+            }
+            start = batch;
+            return batchNum;
+        }
     }
 
     // 自旋锁保护
@@ -44,108 +75,99 @@ void* CentralCache::fetchRange(size_t index) {
         std::this_thread::yield();
     }
 
-    void* result = nullptr;
+    size_t count = 0;
+    void* head = nullptr;
+    void** tail = &head;
     try {
-        // 尝试从 centralFreeList 获取内存块
-        result = centralFreeList_[index].load(std::memory_order_relaxed);
-
-        if (!result) {
-            size_t size = (index + 1) * ALIGNMENT;
-            // 从 PageCache 中获取内存块
-            result = fetchFromPageCache(size);
-
-            // 失败
-            if (!result) {
-                locks_[index].clear(std::memory_order_release);
-                return nullptr;
+        // 一个 span 不够时接着取下一个
+        while (count < batchNum) {
+            Span* span = partialSpans_[index];
+            if (!span && (span = emptySpan_[index])) {
+                emptySpan_[index] = nullptr;
+                pushSpan(span, index);
             }
-
-            char* start = static_cast<char*>(result);
-            // 计算分配页数
-            // 如果大于 最小的标准 即 SPAN_PAGES * PageCache::PAGE_SIZE
-            // 那么将 size / PAGE_SIZE 向上取整
-            size_t numPages = (size <= SPAN_PAGES * PageCache::PAGE_SIZE) ? 
-                                SPAN_PAGES : (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
-
-            size_t blockNum = (numPages * PageCache::PAGE_SIZE) / size;
-
-            if (blockNum > 1) {
-                // 构建链表
-                for (size_t i = 1; i < blockNum; ++i) {
-                    void* current = start + (i - 1) * size;
-                    void* next = start + i * size;
-                    *reinterpret_cast<void**>(current) = next;
-                }
-                // 链表末尾
-                *reinterpret_cast<void**>(start + (blockNum - 1) * size) = nullptr;
-
-                void* next = *reinterpret_cast<void**>(result);
-                *reinterpret_cast<void**>(result) = nullptr;
-
-                // 更新中心缓存 释放锁
-                centralFreeList_[index].store(
-                    next,
-                    std::memory_order_release
-                );
-
-                size_t trackerIndex = spanCount_++;
-                if (trackerIndex < spanTrackers_.size()) {
-                    spanTrackers_[trackerIndex].spanAddr.store(start, std::memory_order_release);
-                    spanTrackers_[trackerIndex].numPages.store(numPages, std::memory_order_release);
-                    spanTrackers_[trackerIndex].blockCount.store(blockNum, std::memory_order_release);
-                    spanTrackers_[trackerIndex].freeCount.store(blockNum - 1, std::memory_order_release);
-                }
+            if (!span && !(span = allocateSpan(index, owner))) {
+                // 失败 已经取到的照常返回
+                break;
             }
-        } else {
-            void* next = *reinterpret_cast<void**>(result);
-            *reinterpret_cast<void**>(result) = nullptr;
-
-            centralFreeList_[index].store(next, std::memory_order_release);
 
-            SpanTracker* tracker = getSpanTracker(result);
-            if (tracker) {
-                tracker->freeCount.fetch_sub(1, std::memory_order_release);
+            claimSpan(span, owner);
+            count += takeFromSpan(span, batchNum - count, tail);
+            if (span->freeCount == 0) {
+                unlinkSpan(span, index);
             }
         }
+        *tail = nullptr;
+        addRelaxed(freeBlocks_[index], 0 - count);
     } catch (...) {
+        // 已经取下的块放回去
+        *tail = nullptr;
+        addRelaxed(freeBlocks_[index], 0 - count);
+        for (void* block = head; block; ) {
+            void* next = *reinterpret_cast<void**>(block);
+            returnToSpan(PageCache::getSpan(block), block, index);
+            block = next;
+        }
         locks_[index].clear(std::memory_order_release);
         throw;
     }
 
     locks_[index].clear(std::memory_order_release);
-    return result;
+    start = head;
+    return count;
 }
 
 // 接受从 threadCache 中归还的内存块
 void CentralCache::returnRange(void* start, size_t size, size_t index) {
     if (!start || index >= FREE_LIST_SIZE) return;
 
-    size_t blockSize = (index + 1) * ALIGNMENT;
+    size_t blockSize = SizeClass::SizeForIndex(index);
     size_t blockCount = size / blockSize;
+    size_t batchNum = SizeClass::numMoveSize(blockSize);
+
+    // 先把整批的块放进 transfer cache 这一步不需要加锁
+    bool full = false;
+    while (start && blockCount >= batchNum) {
+        void* end = start;
+        for (size_t i = 1; i < batchNum && *reinterpret_cast<void**>(end) != nullptr; ++i) {
+            end = *reinterpret_cast<void**>(end);
+        }
+
+        void* rest = *reinterpret_cast<void**>(end);
+        *reinterpret_cast<void**>(end) = nullptr;
+
+        if (!transferCaches_[index].push(start)) {
+            // 满了 剩下的走加锁的路径
+            *reinterpret_cast<void**>(end) = rest;
+            full = true;
+            break;
+        }
+
+        start = rest;
+        blockCount -= batchNum;
+    }
+
+    if (!start) return;
 
     while (locks_[index].test_and_set(std::memory_order_acquire)) {
         std::this_thread::yield();
     }
 
     try {
-        void* end = start;
-        size_t count = 1;
-        while (*reinterpret_cast<void**>(end) != nullptr) {
-            end = *reinterpret_cast<void**>(end);
-            count++;
+        // 队列满了说明归还的比取走的多 已经排着的批也放回 span
+        // 不然没有后台线程时 这些块所在的 span 永远不会变成全空
+        if (full) {
+            drainTransferCache(index);
         }
 
-        // 头插法
-        void* current = centralFreeList_[index].load(std::memory_order_relaxed); // 这里只是读取 所以用 relaxed 
-        *reinterpret_cast<void**>(end) = current;
-        centralFreeList_[index].store(start, std::memory_order_release); // 这里是写操作 在写操作之后 保证数据都是最新的
-
-        size_t currentCount = delayCounts_[index].fetch_add(1, std::memory_order_relaxed) + 1;
-        auto currentTime = std::chrono::steady_clock::now();
-
-        if (shouldPerformDelayedReturn(index, currentCount, currentTime)) {
-            performDelayReturn(index);
+        // 通过 PageMap O(1) 找到每个块所属的 span 置位
+        // span 全空时立刻就能知道 不需要再回头扫描
+        for (void* block = start; block; ) {
+            void* next = *reinterpret_cast<void**>(block);
+            returnToSpan(PageCache::getSpan(block), block, index);
+            block = next;
         }
+        lastReturnTime_[index] = std::chrono::steady_clock::now();
     } catch(...) {
         locks_[index].clear(std::memory_order_release);
         throw;
@@ -154,99 +176,265 @@ void CentralCache::returnRange(void* start, size_t size, size_t index) {
     locks_[index].clear(std::memory_order_release);
 }
 
-// 判断是否应该延迟退还
-bool CentralCache::shouldPerformDelayedReturn(size_t index, size_t currentCount, 
-        std::chrono::steady_clock::time_point currentTime) {
-    if (currentCount >= MAX_DELAY_COUNT) {
-        return true;
+// 线程缓存里的块来自哪个节点都有可能 (别的节点的线程分配 本线程释放)
+// 只有一个节点时不需要查 PageMap
+void CentralCache::returnRangeToOwners(void* start, size_t count, size_t index) {
+    size_t blockSize = SizeClass::SizeForIndex(index);
+    if (Numa::numNodes() == 1) {
+        getInstance(0).returnRange(start, count * blockSize, index);
+        return;
     }
 
-    auto lastTime = lastReturnTime_[index];
-    return (currentTime - lastTime) >= DELAY_INTERVAL;
+    void* heads[MAX_NUMA_NODES] = {};
+    size_t counts[MAX_NUMA_NODES] = {};
+    for (void* block = start; block; ) {
+        void* next = *reinterpret_cast<void**>(block);
+        size_t node = PageCache::getSpan(block)->node;
+        *reinterpret_cast<void**>(block) = heads[node];
+        heads[node] = block;
+        ++counts[node];
+        block = next;
+    }
+
+    for (size_t node = 0; node < MAX_NUMA_NODES; ++node) {
+        if (heads[node]) {
+            getInstance(node).returnRange(heads[node], counts[node] * blockSize, index);
+        }
+    }
 }
 
-// 执行延迟归还
-void CentralCache::performDelayReturn(size_t index) {
-    delayCounts_[index].store(0, std::memory_order_relaxed);
-    lastReturnTime_[index] = std::chrono::steady_clock::now();
+// 全空的 span 没有块在任何线程手里 归取块的线程所有
+// 否则这个 span 已经有块交给了原来的所有者 再交给别的线程之后谁也不是唯一的持有者 清掉
+// 不这样做 后来的线程释放自己手里的块 也会被推到原来的所有者那里
+void CentralCache::claimSpan(Span* span, uint16_t owner) {
+    uint16_t current = __atomic_load_n(&span->owner, __ATOMIC_RELAXED);
+    if (span->freeCount == span->blockCount) {
+        if (current != owner) __atomic_store_n(&span->owner, owner, __ATOMIC_RELAXED);
+    } else if (current != owner && current != RemoteFree::NO_OWNER) {
+        __atomic_store_n(&span->owner, RemoteFree::NO_OWNER, __ATOMIC_RELAXED);
+    }
+}
 
-    // 统计每一个 span 中 freeBlock 块数
-    std::unordered_map<SpanTracker*, size_t> spanFreeCounts;
-    void* currentBlock = centralFreeList_[index].load(std::memory_order_relaxed);
+// 整批取走的块不经过 span 它们的 span 都还有块在别人手里 (至少是这一批)
+// 所以只会清掉别的所有者 不会认领 不持有 locks_ 所以 owner 的读写都是原子的
+// 一批中相邻的块多半来自同一个 span 同一个 span 只看一次
+void CentralCache::disownBatch(void* batch, uint16_t owner) {
+    const Span* last = nullptr;
+    for (void* block = batch; block; block = *reinterpret_cast<void**>(block)) {
+        Span* span = PageCache::getSpan(block);
+        if (span == last) continue;
+        last = span;
+
+        uint16_t current = __atomic_load_n(&span->owner, __ATOMIC_RELAXED);
+        if (current != owner && current != RemoteFree::NO_OWNER) {
+            __atomic_store_n(&span->owner, RemoteFree::NO_OWNER, __ATOMIC_RELAXED);
+        }
+    }
+}
 
-    while (currentBlock) {
-        SpanTracker* tracker = getSpanTracker(currentBlock);
-        if (tracker) {
-            ++spanFreeCounts[tracker];
+// 新 span 的块还没有被碰过 位图全为 0 块从 carved 开始按顺序切分
+// 原来一次把所有块串成链表 8 字节的块要写 4096 个指针 碰遍整个 span
+Span* CentralCache::allocateSpan(size_t index, uint16_t owner) {
+    size_t size = SizeClass::SizeForIndex(index);
+    void* memory = fetchFromPageCache(size);
+    if (!memory) return nullptr;
+
+    // 在 span 上记录切分信息 之后通过 PageMap 找回
+    Span* span = PageCache::getSpan(memory);
+    span->sizeClass = index;
+    span->blockSize = size;
+    span->blockCount = getSpanPages(size) * PageCache::PAGE_SIZE / size;
+    __atomic_store_n(&span->owner, owner, __ATOMIC_RELAXED);
+
+    while (bitmapLock_.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    void* bitmap = bitmapAllocator_.allocate(bitmapBytes(span));
+    bitmapLock_.clear(std::memory_order_release);
+
+    if (!bitmap) {
+        PageCache::getInstance(node_).deallocateSpan(memory, span->numPages);
+        return nullptr;
+    }
+
+    std::memset(bitmap, 0, bitmapBytes(span));
+    span->freeBitmap = static_cast<uint64_t*>(bitmap);
+    span->carved = 0;
+    span->scanHint = 0;
+    span->freeCount = span->blockCount;
+    addRelaxed(spanCount_[index], 1);
+    addRelaxed(freeBlocks_[index], span->blockCount);
+
+    pushSpan(span, index);
+    return span;
+}
+
+// 先从位图中找还回来的块 (多半还在缓存里) 每个字用 ctz 依次取最低的 1
+// 不够再切分新的块 新块的地址是连续的
+size_t CentralCache::takeFromSpan(Span* span, size_t num, void**& tail) {
+    char* base = static_cast<char*>(span->pageAddr);
+    size_t size = span->blockSize;
+    size_t taken = 0;
+
+    size_t words = (span->carved + 63) / 64;
+    size_t word = span->scanHint;
+    for (; word < words && taken < num; ++word) {
+        uint64_t bits = span->freeBitmap[word];
+        while (bits && taken < num) {
+            char* block = base + (word * 64 + __builtin_ctzll(bits)) * size;
+            bits &= bits - 1;
+            *tail = block;
+            tail = reinterpret_cast<void**>(block);
+            ++taken;
         }
-        currentBlock = *reinterpret_cast<void**>(currentBlock);
+        span->freeBitmap[word] = bits;
+        if (bits) break;
     }
+    span->scanHint = word;
 
-    for (const auto& [tracker, newFreeBlocks] : spanFreeCounts) {
-        updateSpanFreeCount(tracker, newFreeBlocks, index);
+    while (taken < num && span->carved < span->blockCount) {
+        char* block = base + span->carved++ * size;
+        *tail = block;
+        tail = reinterpret_cast<void**>(block);
+        ++taken;
     }
+
+    span->freeCount -= taken;
+    return taken;
 }
 
-// 更新 span 的空闲块数
-void CentralCache::updateSpanFreeCount(SpanTracker* tracker, size_t newFreeBlocks, size_t index) {
-    size_t oldFreeCount = tracker->freeCount.load(std::memory_order_relaxed);
-    size_t newFreeCount = oldFreeCount + newFreeBlocks;
+void CentralCache::returnToSpan(Span* span, void* block, size_t index) {
+    size_t offset = static_cast<char*>(block) - static_cast<char*>(span->pageAddr);
+    size_t i = SizeClass::blockIndex(offset, index);
+    uint64_t bit = uint64_t(1) << (i % 64);
+    // 不是这个 span 切分出去的块 或者重复释放
+    assert(i < span->carved && !(span->freeBitmap[i / 64] & bit));
 
-    tracker->freeCount.store(newFreeCount, std::memory_order_release);
+    span->freeBitmap[i / 64] |= bit;
+    span->scanHint = std::min(span->scanHint, i / 64);
+    addRelaxed(freeBlocks_[index], 1);
 
-    if (newFreeCount == tracker->blockCount.load(std::memory_order_relaxed)) {
-        void* spanAddr = tracker->spanAddr.load(std::memory_order_relaxed);
-        size_t numPages = tracker->numPages.load(std::memory_order_relaxed);
+    // 之前所有块都分配出去了 不在链表中
+    if (span->freeCount++ == 0) {
+        pushSpan(span, index);
+    }
+    if (span->freeCount < span->blockCount) return;
 
-        void* head = centralFreeList_[index].load(std::memory_order_relaxed);
-        void* newHead = nullptr;
-        void* prev = nullptr;
-        void* current = head;
+    // 全空 位图中 1 的个数正好是切分过的块数
+    assert(countFreeBits(span) == span->carved);
 
-        while (current) {
-            void* next = *reinterpret_cast<void**>(current);
-            if (current >= spanAddr && 
-                current < static_cast<char*>(spanAddr) + numPages * PageCache::PAGE_SIZE) {
-                if (prev) {
-                    *reinterpret_cast<void**>(prev) = next;
-                } else {
-                    newHead = next;
-                }
-            } else {
-                prev = current;
-            }
-            current = next;
-        }
+    unlinkSpan(span, index);
+    if (emptySpan_[index]) {
+        releaseSpan(span, index);
+        return;
+    }
 
-        centralFreeList_[index].store(newHead, std::memory_order_release);
-        PageCache::getInstance().deallocateSpan(spanAddr, numPages);
+    // 留下来 下次从头重新切分
+    std::memset(span->freeBitmap, 0, bitmapBytes(span));
+    span->carved = 0;
+    span->scanHint = 0;
+    emptySpan_[index] = span;
+}
+
+void CentralCache::drainTransferCache(size_t index) {
+    while (void* batch = transferCaches_[index].pop()) {
+        for (void* block = batch; block; ) {
+            void* next = *reinterpret_cast<void**>(block);
+            returnToSpan(PageCache::getSpan(block), block, index);
+            block = next;
+        }
     }
 }
 
-// 从页缓存中攫取 Cache
-void* CentralCache::fetchFromPageCache(size_t size) {
-    size_t numPages = (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+void CentralCache::releaseSpan(Span* span, size_t index) {
+    addRelaxed(spanCount_[index], size_t(-1));
+    addRelaxed(freeBlocks_[index], 0 - span->blockCount);
 
-    size_t pagesToAlloc = std::max(numPages, PageCache::PAGE_SIZE);
+    while (bitmapLock_.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    bitmapAllocator_.deallocate(span->freeBitmap, bitmapBytes(span));
+    bitmapLock_.clear(std::memory_order_release);
 
-    return PageCache::getInstance().allocateSpan(pagesToAlloc);
+    span->freeBitmap = nullptr;
+    span->carved = 0;
+    span->scanHint = 0;
+    PageCache::getInstance(node_).deallocateSpan(span->pageAddr, span->numPages);
 }
 
+void CentralCache::pushSpan(Span* span, size_t index) {
+    span->prev = nullptr;
+    span->next = partialSpans_[index];
+    if (span->next) {
+        span->next->prev = span;
+    }
+    partialSpans_[index] = span;
+}
+
+void CentralCache::unlinkSpan(Span* span, size_t index) {
+    if (span->prev) {
+        span->prev->next = span->next;
+    } else {
+        partialSpans_[index] = span->next;
+    }
+    if (span->next) {
+        span->next->prev = span->prev;
+    }
+    span->next = nullptr;
+    span->prev = nullptr;
+}
 
-// 根据 block 返回他所在的 span
-SpanTracker* CentralCache::getSpanTracker(void* blockAddr) {
-    for (size_t i = 0; i < spanCount_.load(std::memory_order_relaxed); ++i) {
-        void* spanAddr = spanTrackers_[i].spanAddr.load(std::memory_order_relaxed);
-        size_t numPages = spanTrackers_[i].numPages;
+// 后台线程周期性调用 不用等到下一次有人 free 才归还
+// transfer cache 中没有排满的批也放回 span (排满时 returnRange 自己会放回)
+// 锁被占用说明这个 size class 正忙 直接跳过
+void CentralCache::flushDelayedReturns() {
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        if (locks_[index].test_and_set(std::memory_order_acquire)) {
+            continue;
+        }
+
+        auto currentTime = std::chrono::steady_clock::now();
+        if (currentTime - lastReturnTime_[index] >= DELAY_INTERVAL) {
+            drainTransferCache(index);
 
-        // 通过起始地址 和 span总的内存大小算出区间 
-        // 然后判断 block 的地址是否在这个区间之内
-        if (blockAddr >= spanAddr &&
-            blockAddr < static_cast<char*>(spanAddr) + numPages * PageCache::PAGE_SIZE) {
-                return &spanTrackers_[i];
+            if (Span* span = emptySpan_[index]) {
+                emptySpan_[index] = nullptr;
+                releaseSpan(span, index);
             }
+            lastReturnTime_[index] = currentTime;
+        }
+
+        locks_[index].clear(std::memory_order_release);
     }
-    return nullptr;
 }
 
-} // namespace Pool
\ No newline at end of file
+// TransferCache 中的整批块也算在中心缓存里
+void CentralCache::collectStats(PoolStats& stats) {
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        size_t size = SizeClass::SizeForIndex(index);
+        size_t spans = spanCount_[index].load(std::memory_order_relaxed);
+        size_t blocks = freeBlocks_[index].load(std::memory_order_relaxed) +
+                        transferCaches_[index].size() * SizeClass::numMoveSize(size);
+
+        SizeClassStats& sc = stats.sizeClasses[index];
+        sc.spans += spans;
+        sc.spanBytes += spans * getSpanPages(size) * PageCache::PAGE_SIZE;
+        sc.centralCachedBytes += blocks * size;
+    }
+}
+
+// 给定块大小 计算一次申请的页数
+// 如果大于 最小的标准 即 SPAN_PAGES * PageCache::PAGE_SIZE
+// 那么将 size / PAGE_SIZE 向上取整
+size_t CentralCache::getSpanPages(size_t size) {
+    return (size <= SPAN_PAGES * PageCache::PAGE_SIZE) ? 
+            SPAN_PAGES : (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+}
+
+// 从页缓存中攫取 Cache
+// 页数必须与 fetchRange 中切分时使用的页数一致 否则 span 的记录会出错
+void* CentralCache::fetchFromPageCache(size_t size) {
+    return PageCache::getInstance(node_).allocateSpan(getSpanPages(size));
+}
+
+} // namespace Pool
@@ -0,0 +1,237 @@
+#include <mutex>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
+
+#include "../include/CentralCache.h"
+#include "../include/CpuCache.h"
+#include "../include/LargeCache.h"
+#include "../include/PageCache.h"
+#include "../include/Stats.h"
+#include "../include/ThreadCache.h"
+
+#ifdef TIEREDPOOL_HAVE_RSEQ
+// 老的 glibc 没有这两个符号 弱引用时地址为 nullptr
+#pragma weak __rseq_offset
+#pragma weak __rseq_size
+#endif
+
+namespace Pool
+{
+
+char*               CpuCache::slabs_ = nullptr;
+std::atomic<bool>   CpuCache::active_{false};
+
+bool CpuCache::enable() {
+#ifdef TIEREDPOOL_HAVE_RSEQ
+    static const bool available = [] {
+        // glibc 没有注册 rseq (太老 或者 GLIBC_TUNABLES=glibc.pthread.rseq=0)
+        if (&__rseq_size == nullptr || &__rseq_offset == nullptr || __rseq_size == 0) {
+            return false;
+        }
+        if (static_cast<int32_t>(rseqArea()->cpu_id) < 0) return false;
+
+        // 所有可能出现的 CPU 都要有 slab 只预留地址空间 没有用到的 CPU 不占物理内存
+        long cpus = get_nprocs_conf();
+        if (cpus <= 0) return false;
+        void* slabs = mmap(nullptr, static_cast<size_t>(cpus) * SLAB_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (slabs == MAP_FAILED) return false;
+        slabs_ = static_cast<char*>(slabs);
+        return true;
+    }();
+
+    if (available) {
+        active_.store(true, std::memory_order_release);
+    }
+    return available;
+#else
+    return false;
+#endif
+}
+
+void CpuCache::deallocate(void* ptr) {
+    if (ptr == nullptr) return;
+
+    Span* span = PageCache::getSpan(ptr);
+    if (!span) {
+        ThreadCache::deallocateWithoutCache(ptr, 0);
+        return;
+    }
+
+    size_t index = span->sizeClass;
+    if (index == LARGE_SIZE_CLASS) {
+        LargeCache::deallocate(ptr);
+        return;
+    }
+    if (!push(index, ptr)) {
+        deallocateSlow(index, ptr);
+    }
+}
+
+// 从来没有用过的 CPU 读到的是零页 不会分配物理内存
+void CpuCache::collectStats(PoolStats& stats) {
+    if (!slabs_) return;
+
+    long cpus = get_nprocs_conf();
+    for (long cpu = 0; cpu < cpus; ++cpu) {
+        uint32_t* counts = reinterpret_cast<uint32_t*>(slabs_ + static_cast<size_t>(cpu) * SLAB_SIZE);
+        for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            uint32_t count = __atomic_load_n(&counts[index], __ATOMIC_RELAXED);
+            stats.sizeClasses[index].cpuCachedBytes += count * SizeClass::SizeForIndex(index);
+        }
+    }
+}
+
+#ifdef TIEREDPOOL_HAVE_RSEQ
+namespace
+{
+
+// 各个 size class 计数的签名 全空时为 0
+// 两次 drain 之间签名不变 就当作这个 CPU 上没有分配释放 (近似)
+uint64_t countSignature(const uint32_t* counts) {
+    uint64_t signature = 0;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        signature = signature * 1000003 + __atomic_load_n(&counts[index], __ATOMIC_RELAXED);
+    }
+    return signature;
+}
+
+} // namespace
+#endif
+
+size_t CpuCache::drain(bool idleOnly) {
+#ifdef TIEREDPOOL_HAVE_RSEQ
+    if (!slabs_) return 0;
+
+    // 同一时间只有一个线程在清 签名也只由它读写
+    static std::mutex drainMutex;
+    std::lock_guard<std::mutex> lock(drainMutex);
+
+    // 不用 CPU_ALLOC 它会调用 malloc 超过 CPU_SETSIZE 的 CPU 不处理
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return 0;
+
+    long cpus = get_nprocs_conf();
+    size_t drained = 0;
+    bool pinned = false;
+    for (long cpu = 0; cpu < cpus && cpu < CPU_SETSIZE; ++cpu) {
+        char* slab = slabs_ + static_cast<size_t>(cpu) * SLAB_SIZE;
+        uint64_t* mark = reinterpret_cast<uint64_t*>(slab + CPU_CACHE_MARK_OFFSET);
+        uint64_t signature = countSignature(reinterpret_cast<uint32_t*>(slab));
+
+        // 没有缓存任何块 签名为 0 时不写 从来没有用过的 CPU 不会因此分配物理页
+        if (signature == 0) {
+            if (*mark != 0) *mark = 0;
+            continue;
+        }
+        if (idleOnly && *mark != signature) {
+            *mark = signature;
+            continue;
+        }
+
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        cpu_set_t target;
+        CPU_ZERO(&target);
+        CPU_SET(cpu, &target);
+        // 返回时已经迁移到了目标 CPU 上
+        if (sched_setaffinity(0, sizeof(target), &target) != 0) continue;
+        pinned = true;
+
+        drained += drainCurrent();
+        *mark = 0;
+    }
+
+    if (pinned) {
+        sched_setaffinity(0, sizeof(allowed), &allowed);
+    }
+    return drained;
+#else
+    (void)idleOnly;
+    return 0;
+#endif
+}
+
+// 一批一批地取出来还给 CentralCache
+// 和快速路径一样是 rseq 临界区 同一个 CPU 上的其他线程随时可以插进来 不会弄乱计数
+size_t CpuCache::drainCurrent() {
+    size_t drained = 0;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        size_t size = SizeClass::SizeForIndex(index);
+        size_t batchNum = SizeClass::numMoveSize(size);
+        for (;;) {
+            void* list = nullptr;
+            size_t count = 0;
+            while (count < batchNum) {
+                void* block = pop(index);
+                if (!block) break;
+                *reinterpret_cast<void**>(block) = list;
+                list = block;
+                ++count;
+            }
+            if (count == 0) break;
+
+            CentralCache::returnRangeToOwners(list, count, index);
+            drained += count * size;
+            if (count < batchNum) break;
+        }
+    }
+    return drained;
+}
+
+// 取一批 第一块直接返回
+// 放回 slab 的途中可能被迁移到别的 CPU 放进哪个 CPU 都没有关系 放不下的还给 CentralCache
+void* CpuCache::allocateSlow(size_t index) {
+    size_t batchNum = SizeClass::numMoveSize(SizeClass::SizeForIndex(index));
+
+    void* start = nullptr;
+    size_t count = CentralCache::getInstance().fetchRange(start, batchNum, index);
+    if (count == 0 || !start) return nullptr;
+
+    void* result = start;
+    void* block = *reinterpret_cast<void**>(start);
+
+    void* rest = nullptr;
+    size_t restCount = 0;
+    while (block) {
+        void* next = *reinterpret_cast<void**>(block);
+        if (!push(index, block)) {
+            *reinterpret_cast<void**>(block) = rest;
+            rest = block;
+            ++restCount;
+        }
+        block = next;
+    }
+
+    if (rest) {
+        CentralCache::returnRangeToOwners(rest, restCount, index);
+    }
+    return result;
+}
+
+// 满了 再取出大约一批 和 ptr 串在一起归还 这样下一次释放不会马上又满
+void CpuCache::deallocateSlow(size_t index, void* ptr) {
+    size_t batchNum = SizeClass::numMoveSize(SizeClass::SizeForIndex(index));
+
+    *reinterpret_cast<void**>(ptr) = nullptr;
+    size_t count = 1;
+    while (count < batchNum) {
+        void* block = pop(index);
+        if (!block) break;
+        *reinterpret_cast<void**>(block) = ptr;
+        ptr = block;
+        ++count;
+    }
+
+    CentralCache::returnRangeToOwners(ptr, count, index);
+}
+
+void* CpuCache::allocateLarge(size_t size) {
+    return LargeCache::allocate(size);
+}
+
+void CpuCache::deallocateLarge(void* ptr, size_t) {
+    LargeCache::deallocate(ptr);
+}
+
+} // namespace Pool
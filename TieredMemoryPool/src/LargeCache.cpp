@@ -0,0 +1,109 @@
+#include <cstdint>
+
+#include "../include/LargeCache.h"
+#include "../include/PageCache.h"
+#include "../include/Stats.h"
+
+namespace Pool
+{
+
+std::atomic<uint64_t>   LargeCache::allocs_{0};
+std::atomic<uint64_t>   LargeCache::frees_{0};
+std::atomic<size_t>     LargeCache::inUseBytes_{0};
+
+void* LargeCache::allocate(size_t size) {
+    // 接近 SIZE_MAX 的大小按页取整会回绕成 0 页或者几页 这么大本来也映射不出来
+    if (size == 0 || size > static_cast<size_t>(PTRDIFF_MAX)) return nullptr;
+    size_t numPages = (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+
+    Span* span = getInstance().take(numPages);
+    if (!span) {
+        void* ptr = PageCache::getInstance().allocateSpan(numPages);
+        if (!ptr) return nullptr;
+
+        span = PageCache::getSpan(ptr);
+        span->sizeClass = LARGE_SIZE_CLASS;
+        span->blockSize = span->numPages * PageCache::PAGE_SIZE;
+    }
+
+    allocs_.fetch_add(1, std::memory_order_relaxed);
+    inUseBytes_.fetch_add(span->blockSize, std::memory_order_relaxed);
+    return span->pageAddr;
+}
+
+void LargeCache::deallocate(void* ptr) {
+    Span* span = PageCache::getSpan(ptr);
+    if (!span || span->pageAddr != ptr || span->sizeClass != LARGE_SIZE_CLASS) return;
+
+    frees_.fetch_add(1, std::memory_order_relaxed);
+    inUseBytes_.fetch_sub(span->blockSize, std::memory_order_relaxed);
+
+    if (span->numPages * PageCache::PAGE_SIZE > MAX_CACHEABLE_BYTES) {
+        PageCache::getInstance(span->node).deallocateSpan(ptr, span->numPages, true);
+        return;
+    }
+    getInstance(span->node).put(span);
+}
+
+void LargeCache::collectStats(PoolStats& stats) {
+    stats.largeAllocs += allocs_.load(std::memory_order_relaxed);
+    stats.largeFrees += frees_.load(std::memory_order_relaxed);
+    stats.largeInUseBytes += inUseBytes_.load(std::memory_order_relaxed);
+
+    for (size_t node = 0; node < Numa::numNodes(); ++node) {
+        LargeCache& cache = getInstance(node);
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        stats.largeCachedBytes += cache.bytes_;
+    }
+}
+
+// 缓存的 span 很少 线性查找就够了
+// 允许多出 1/8 避免 300KB 和 304KB 这种相差一点的申请互相用不上
+Span* LargeCache::take(size_t numPages) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t best = count_;
+    for (size_t i = 0; i < count_; ++i) {
+        size_t pages = spans_[i]->numPages;
+        if (pages >= numPages && pages <= numPages + numPages / 8 &&
+                (best == count_ || pages < spans_[best]->numPages)) {
+            best = i;
+        }
+    }
+    if (best == count_) return nullptr;
+
+    Span* span = spans_[best];
+    for (size_t i = best + 1; i < count_; ++i) {
+        spans_[i - 1] = spans_[i];
+    }
+    --count_;
+    bytes_ -= span->numPages * PageCache::PAGE_SIZE;
+    return span;
+}
+
+// 超出预算时从最早放进来的开始淘汰 在锁外还给 PageCache
+void LargeCache::put(Span* span) {
+    Span* evicted[MAX_CACHED_SPANS];
+    size_t numEvicted = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        size_t bytes = span->numPages * PageCache::PAGE_SIZE;
+        while (count_ > 0 && (count_ == MAX_CACHED_SPANS || bytes_ + bytes > MAX_CACHED_BYTES)) {
+            evicted[numEvicted++] = spans_[0];
+            bytes_ -= spans_[0]->numPages * PageCache::PAGE_SIZE;
+            for (size_t i = 1; i < count_; ++i) {
+                spans_[i - 1] = spans_[i];
+            }
+            --count_;
+        }
+        spans_[count_++] = span;
+        bytes_ += bytes;
+    }
+
+    for (size_t i = 0; i < numEvicted; ++i) {
+        PageCache::getInstance(node_).deallocateSpan(evicted[i]->pageAddr, evicted[i]->numPages, true);
+    }
+}
+
+} // namespace Pool
@@ -0,0 +1,390 @@
+// 用内存池替换 malloc / free / new / delete
+// 编译成 libtieredpool.so 之后可以通过 LD_PRELOAD 注入到任意程序中
+//
+// 需要注意两件事：
+// 1. 内存池内部自己也可能申请内存 (例如标准库在后台线程里的申请)
+//    如果这些申请再走进内存池就会递归甚至死锁在 PageCache::mutex_ 上
+//    所以用一个线程局部的标记记录 当前线程是否已经在内存池内部 重入时直接交给 glibc
+// 2. 不是内存池分配的指针 (PageMap 中查不到) 一律交给 glibc 释放
+//
+// 设置环境变量 TIEREDPOOL_RETAINED_MB=<n> 会在加载时启动后台释放线程 空闲页最多保留 n MB
+// TIEREDPOOL_HUGEPAGES=none|thp|hugetlb 选择 arena 使用的页 默认 thp
+// TIEREDPOOL_NUMA_NODES=<n> 在单节点的机器上模拟 n 个 NUMA 节点 见 Numa.h
+// TIEREDPOOL_PERCPU=1 改用每个 CPU 一份的前端缓存 (需要 rseq) 见 CpuCache.h
+// TIEREDPOOL_REMOTE_FREE=1 跨线程释放的块推回分配它的线程 见 RemoteFree.h
+// TIEREDPOOL_HEAP_PROFILE=<file> 打开采样的堆分析器 退出时把存活的分配写到 file (pprof 格式)
+// TIEREDPOOL_HEAP_SAMPLE=<bytes> 平均采样间隔 默认 2MB 见 HeapProfiler.h
+// TIEREDPOOL_TRACE=<file> 把每一次分配释放记录到 file 用 pool_replay 重放 见 Trace.h
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <new>
+
+#include "../include/MemoryPool.h"
+#include "../include/PageCache.h"
+#include "../include/RemoteFree.h"
+#include "../include/Scavenger.h"
+#include "../include/Trace.h"
+#include "HeapProfiler.h"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void* ptr);
+}
+
+namespace Pool
+{
+namespace
+{
+
+// malloc 要求返回的地址满足 alignof(max_align_t)
+constexpr size_t MALLOC_ALIGNMENT = 16;
+// 和 glibc 一样 超过 PTRDIFF_MAX 的申请直接失败
+// 必须在取整之前挡住 否则接近 SIZE_MAX 的大小取整之后回绕成很小的值
+constexpr size_t MAX_MALLOC_SIZE = PTRDIFF_MAX;
+
+// initial-exec 模型的 TLS 不会在第一次访问时调用 malloc
+// 进程刚启动 thread_local 的 ThreadCache 还没有构造时也可以安全访问
+__attribute__((tls_model("initial-exec"))) thread_local bool inPool = false;
+
+// 进入内存池时置位 离开时复位
+class ReentryGuard {
+public:
+    ReentryGuard() : reentered_(inPool) { inPool = true; }
+    ~ReentryGuard() { inPool = reentered_; }
+
+    bool reentered() const { return reentered_; }
+
+private:
+    bool reentered_;
+};
+
+size_t roundUpMalloc(size_t size) {
+    return (size + MALLOC_ALIGNMENT - 1) & ~(MALLOC_ALIGNMENT - 1);
+}
+
+// 由内存池分配的块返回其所在 span 否则返回 nullptr
+Span* findSpan(void* ptr) {
+    Span* span = PageCache::getSpan(ptr);
+    return (span && span->isUsed && span->blockSize != 0) ? span : nullptr;
+}
+
+// 返回 nullptr 时都要设置 errno 重入时 glibc 自己会设置
+void* poolMalloc(size_t size) {
+    if (size > MAX_MALLOC_SIZE) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    ReentryGuard guard;
+    if (guard.reentered()) {
+        return __libc_malloc(size);
+    }
+    if (size == 0) size = 1;
+    void* ptr = MemoryPool::allocate(roundUpMalloc(size));
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+void poolFree(void* ptr) {
+    if (ptr == nullptr) return;
+
+    ReentryGuard guard;
+    if (guard.reentered() || !findSpan(ptr)) {
+        __libc_free(ptr);
+        return;
+    }
+    MemoryPool::deallocate(ptr);
+}
+
+// new 一侧知道大小 但大小只用来得到 size class PageMap 照样要查
+// 重入时从 glibc 拿到的内存 (例如在内存池里面创建的 std::function) 之后可能在外面用 sized delete 释放
+// 大小和 span 上的 size class 对不上时 以 span 为准
+void poolSizedFree(void* ptr, size_t size) {
+    if (ptr == nullptr) return;
+
+    if (size == 0 || size > MAX_BYTES) {
+        poolFree(ptr);
+        return;
+    }
+
+    ReentryGuard guard;
+    Span* span = guard.reentered() ? nullptr : findSpan(ptr);
+    if (!span) {
+        __libc_free(ptr);
+        return;
+    }
+
+    size = roundUpMalloc(size);
+    if (span->sizeClass != SizeClass::getIndex(size)) {
+        MemoryPool::deallocate(ptr);
+        return;
+    }
+    MemoryPool::deallocate(ptr, size);
+}
+
+// 对齐分配 找块大小是 alignment 倍数的 size class 见 SizeClass::alignedSize
+void* poolMemalign(size_t alignment, size_t size) {
+    if (alignment <= MALLOC_ALIGNMENT) {
+        return poolMalloc(size);
+    }
+
+    if (size > MAX_MALLOC_SIZE) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    ReentryGuard guard;
+    if (guard.reentered() || alignment > PageCache::PAGE_SIZE) {
+        return __libc_memalign(alignment, size);
+    }
+
+    // 大块直接占整页 起始地址本来就按页对齐
+    size_t classSize = size;
+    if (size <= MAX_BYTES) {
+        classSize = SizeClass::alignedSize(size, alignment);
+    }
+    if (classSize == 0) {
+        return __libc_memalign(alignment, size);
+    }
+    void* ptr = MemoryPool::allocate(classSize);
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+size_t poolUsableSize(void* ptr) {
+    if (ptr == nullptr) return 0;
+
+    ReentryGuard guard;
+    if (!guard.reentered()) {
+        if (Span* span = findSpan(ptr)) {
+            return span->blockSize;
+        }
+    }
+
+    using UsableSizeFn = size_t (*)(void*);
+    static UsableSizeFn libcUsableSize =
+        reinterpret_cast<UsableSizeFn>(dlsym(RTLD_NEXT, "malloc_usable_size"));
+    return libcUsableSize ? libcUsableSize(ptr) : 0;
+}
+
+void* poolRealloc(void* ptr, size_t size) {
+    if (ptr == nullptr) return poolMalloc(size);
+    if (size == 0) {
+        poolFree(ptr);
+        return nullptr;
+    }
+
+    {
+        ReentryGuard guard;
+        if (guard.reentered()) {
+            return __libc_realloc(ptr, size);
+        }
+        if (!findSpan(ptr)) {
+            // glibc 分配的 (重入时或者加载之前分配的) 继续由 glibc 管理
+            return __libc_realloc(ptr, size);
+        }
+    }
+
+    size_t oldSize = poolUsableSize(ptr);
+    if (size <= oldSize && size > oldSize / 2) {
+        return ptr;
+    }
+
+    void* result = poolMalloc(size);
+    if (result) {
+        memcpy(result, ptr, std::min(oldSize, size));
+        poolFree(ptr);
+    }
+    return result;
+}
+
+void* poolNew(size_t size) {
+    void* ptr = poolMalloc(size);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* poolAlignedNew(size_t size, size_t alignment) {
+    void* ptr = poolMemalign(alignment, size);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+// 程序本身不知道内存池的存在 只能通过环境变量配置
+__attribute__((constructor)) void configureFromEnv() {
+    if (const char* hugePages = getenv("TIEREDPOOL_HUGEPAGES")) {
+        if (strcmp(hugePages, "none") == 0) {
+            PageCache::setHugePagePolicy(HugePagePolicy::None);
+        } else if (strcmp(hugePages, "hugetlb") == 0) {
+            PageCache::setHugePagePolicy(HugePagePolicy::HugeTLB);
+        }
+    }
+
+    if (const char* perCpu = getenv("TIEREDPOOL_PERCPU")) {
+        if (strcmp(perCpu, "1") == 0) {
+            CpuCache::enable();
+        }
+    }
+
+    // 之后创建的线程缓存才有队列 在这之前已经存在的线程照旧
+    if (const char* remoteFree = getenv("TIEREDPOOL_REMOTE_FREE")) {
+        if (strcmp(remoteFree, "1") == 0) {
+            RemoteFree::enable();
+        }
+    }
+
+    const char* profile = getenv("TIEREDPOOL_HEAP_PROFILE");
+    if (profile && *profile) {
+        const char* sample = getenv("TIEREDPOOL_HEAP_SAMPLE");
+        HeapProfiler::start(sample ? strtoull(sample, nullptr, 10) : HeapProfiler::DEFAULT_SAMPLE_BYTES);
+    }
+
+    const char* trace = getenv("TIEREDPOOL_TRACE");
+    if (trace && *trace) {
+        TraceRecorder::start(trace);
+    }
+
+    const char* retained = getenv("TIEREDPOOL_RETAINED_MB");
+    if (!retained || !*retained) return;
+
+    ScavengerOptions options;
+    options.retainedBytes = strtoull(retained, nullptr, 10) * 1024 * 1024;
+    Scavenger::getInstance().start(options);
+}
+
+// 缓冲区里剩下的记录在退出前写完
+__attribute__((destructor)) void stopTrace() {
+    TraceRecorder::stop();
+}
+
+// 退出时还没有释放的就是泄漏或者一直持有的内存
+__attribute__((destructor)) void dumpHeapProfile() {
+    const char* profile = getenv("TIEREDPOOL_HEAP_PROFILE");
+    if (!profile || !*profile || !HeapProfiler::isRunning()) return;
+
+    HeapProfiler::stop();
+    if (FILE* out = fopen(profile, "w")) {
+        HeapProfiler::dump(out, ProfileFormat::Pprof);
+        fclose(out);
+    }
+}
+
+} // namespace
+} // namespace Pool
+
+extern "C" {
+
+__attribute__((visibility("default"))) void* malloc(size_t size) {
+    return Pool::poolMalloc(size);
+}
+
+__attribute__((visibility("default"))) void free(void* ptr) {
+    Pool::poolFree(ptr);
+}
+
+__attribute__((visibility("default"))) void* calloc(size_t num, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(num, size, &total)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    void* ptr = Pool::poolMalloc(total);
+    if (ptr) memset(ptr, 0, total);
+    return ptr;
+}
+
+__attribute__((visibility("default"))) void* realloc(void* ptr, size_t size) {
+    return Pool::poolRealloc(ptr, size);
+}
+
+__attribute__((visibility("default"))) int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = Pool::poolMemalign(alignment, size);
+    if (!ptr) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+__attribute__((visibility("default"))) void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return Pool::poolMemalign(alignment, size);
+}
+
+__attribute__((visibility("default"))) void* memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+__attribute__((visibility("default"))) size_t malloc_usable_size(void* ptr) {
+    return Pool::poolUsableSize(ptr);
+}
+
+} // extern "C"
+
+__attribute__((visibility("default"))) void* operator new(size_t size) {
+    return Pool::poolNew(size);
+}
+
+__attribute__((visibility("default"))) void* operator new[](size_t size) {
+    return Pool::poolNew(size);
+}
+
+__attribute__((visibility("default"))) void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return Pool::poolMalloc(size);
+}
+
+__attribute__((visibility("default"))) void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return Pool::poolMalloc(size);
+}
+
+__attribute__((visibility("default"))) void* operator new(size_t size, std::align_val_t alignment) {
+    return Pool::poolAlignedNew(size, static_cast<size_t>(alignment));
+}
+
+__attribute__((visibility("default"))) void* operator new[](size_t size, std::align_val_t alignment) {
+    return Pool::poolAlignedNew(size, static_cast<size_t>(alignment));
+}
+
+__attribute__((visibility("default"))) void operator delete(void* ptr) noexcept {
+    Pool::poolFree(ptr);
+}
+
+__attribute__((visibility("default"))) void operator delete[](void* ptr) noexcept {
+    Pool::poolFree(ptr);
+}
+
+__attribute__((visibility("default"))) void operator delete(void* ptr, size_t size) noexcept {
+    Pool::poolSizedFree(ptr, size);
+}
+
+__attribute__((visibility("default"))) void operator delete[](void* ptr, size_t size) noexcept {
+    Pool::poolSizedFree(ptr, size);
+}
+
+__attribute__((visibility("default"))) void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    Pool::poolFree(ptr);
+}
+
+__attribute__((visibility("default"))) void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    Pool::poolFree(ptr);
+}
+
+__attribute__((visibility("default"))) void operator delete(void* ptr, std::align_val_t) noexcept {
+    Pool::poolFree(ptr);
+}
+
+__attribute__((visibility("default"))) void operator delete[](void* ptr, std::align_val_t) noexcept {
+    Pool::poolFree(ptr);
+}
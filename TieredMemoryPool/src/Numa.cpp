@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../include/Numa.h"
+
+namespace Pool
+{
+
+namespace
+{
+
+const size_t MAX_CPUS = 1024;
+
+struct Topology {
+    size_t  numNodes = 1;
+    uint8_t cpuToNode[MAX_CPUS] = {};
+};
+
+// 这里可能在 malloc 内部第一次被调用 不能用 fopen / std::string 这类会申请内存的接口
+size_t readFile(const char* path, char* buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) n = 0;
+    buf[n] = '\0';
+    return static_cast<size_t>(n);
+}
+
+// 解析 "0-3,8-11" 这种格式 对每一个区间调用 fn(first, last)
+template <typename Fn>
+void parseList(const char* s, Fn fn) {
+    while (*s) {
+        char* end;
+        size_t first = strtoul(s, &end, 10);
+        if (end == s) break;
+        size_t last = first;
+        s = end;
+        if (*s == '-') {
+            last = strtoul(s + 1, &end, 10);
+            s = end;
+        }
+        fn(first, last);
+        while (*s == ',' || *s == '\n') ++s;
+    }
+}
+
+Topology detect() {
+    Topology topology;
+    char buf[4096];
+
+    if (readFile("/sys/devices/system/node/online", buf, sizeof(buf)) == 0) {
+        return topology;
+    }
+    size_t maxNode = 0;
+    parseList(buf, [&](size_t, size_t last) { maxNode = std::max(maxNode, last); });
+    topology.numNodes = std::min(maxNode + 1, MAX_NUMA_NODES);
+    if (topology.numNodes == 1) return topology;
+
+    for (size_t node = 0; node < topology.numNodes; ++node) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+        if (readFile(path, buf, sizeof(buf)) == 0) continue;
+        parseList(buf, [&](size_t first, size_t last) {
+            for (size_t cpu = first; cpu <= last && cpu < MAX_CPUS; ++cpu) {
+                topology.cpuToNode[cpu] = static_cast<uint8_t>(node);
+            }
+        });
+    }
+    return topology;
+}
+
+const Topology& topology() {
+    static const Topology instance = detect();
+    return instance;
+}
+
+size_t envSimulatedNodes() {
+    const char* env = getenv("TIEREDPOOL_NUMA_NODES");
+    return env ? strtoul(env, nullptr, 10) : 0;
+}
+
+// 0 表示没有模拟
+std::atomic<size_t> simulatedNodes{0};
+std::atomic<bool>   envChecked{false};
+// 模拟模式下下一个线程分到的节点
+std::atomic<size_t> nextNode{0};
+
+// -1 表示还没有固定节点
+__attribute__((tls_model("initial-exec"))) thread_local int threadNode = -1;
+
+size_t simulated() {
+    if (!envChecked.load(std::memory_order_acquire)) {
+        size_t n = envSimulatedNodes();
+        if (n > 1) {
+            size_t expected = 0;
+            simulatedNodes.compare_exchange_strong(expected, std::min(n, MAX_NUMA_NODES));
+        }
+        envChecked.store(true, std::memory_order_release);
+    }
+    return simulatedNodes.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+size_t Numa::numNodes() {
+    size_t n = simulated();
+    return n ? n : topology().numNodes;
+}
+
+size_t Numa::currentNode() {
+    if (size_t n = simulated()) {
+        if (threadNode < 0) {
+            threadNode = static_cast<int>(nextNode.fetch_add(1, std::memory_order_relaxed) % n);
+        }
+        return static_cast<size_t>(threadNode) % n;
+    }
+
+    const Topology& t = topology();
+    if (t.numNodes == 1) return 0;
+    if (threadNode >= 0) return static_cast<size_t>(threadNode) % t.numNodes;
+
+    int cpu = sched_getcpu();
+    return (cpu >= 0 && static_cast<size_t>(cpu) < MAX_CPUS) ? t.cpuToNode[cpu] : 0;
+}
+
+void Numa::setSimulatedNodes(size_t n) {
+    simulated();
+    simulatedNodes.store(n > 1 ? std::min(n, MAX_NUMA_NODES) : 0, std::memory_order_relaxed);
+}
+
+bool Numa::isSimulated() {
+    return simulated() != 0;
+}
+
+void Numa::setThreadNode(size_t node) {
+    threadNode = static_cast<int>(node);
+}
+
+// MPOL_PREFERRED 而不是 MPOL_BIND: 节点内存耗尽时可以退回到其他节点 不至于直接 OOM
+void Numa::bindToNode(void* ptr, size_t size, size_t node) {
+    if (isSimulated() || topology().numNodes == 1) return;
+
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &mask, MAX_NUMA_NODES + 1, 0);
+}
+
+} // namespace Pool
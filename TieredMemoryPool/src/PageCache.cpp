@@ -1,41 +1,44 @@
+#include <cassert>
 #include <cstddef>
-#include <cstring>
+#include <cstdint>
 #include <mutex>
 #include <sys/mman.h>
 
 #include "../include/PageCache.h"
+#include "../include/Stats.h"
 
 namespace Pool 
 {
+
+PageMap                         PageCache::pageMap_;
+std::atomic<HugePagePolicy>     PageCache::hugePagePolicy_{HugePagePolicy::Transparent};
+
 void* PageCache::allocateSpan(std::size_t numPages) {
+    // 0 页时 systemAlloc 不移动 arenaCur_ 返回的 span 和下一次申请重叠
+    assert(numPages > 0);
     std::lock_guard<std::mutex> lock(mutex_);
 
-    auto it = freeSpans_.lower_bound(numPages);
-    if (it != freeSpans_.end()) {
-        Span* span = it->second;
-
-        if (span->next) {
-            freeSpans_[it->first] = span->next;
-        } else {
-            freeSpans_.erase(it);
-        }
+    if (Span* span = findFreeSpan(numPages)) {
+        removeFreeSpan(span);
 
         // 如果找的的 span 有多余的 那就只分配需要的部分
-        if (span->numPages > numPages) {
-            Span* newSpan = new Span;
+        // 元数据申请失败时 就把整个 span 分配出去
+        Span* newSpan = span->numPages > numPages ? spanAllocator_.create() : nullptr;
+        if (newSpan) {
             newSpan->pageAddr = static_cast<char*>(span->pageAddr) + 
                                 numPages * PAGE_SIZE;
             newSpan->numPages = span->numPages - numPages;
-            newSpan->next = nullptr;
-
-            auto& list = freeSpans_[newSpan->numPages];
-            newSpan->next = list;
-            list = newSpan;
+            newSpan->isReleased = span->isReleased;
+            newSpan->node = span->node;
+            insertFreeSpan(newSpan);
 
             span->numPages = numPages;
         }
 
-        spanMap_[span->pageAddr] = span;
+        // 已经 madvise 过的页不需要做任何处理 第一次访问时内核会重新分配清零的页
+        span->isUsed = true;
+        span->isReleased = false;
+        registerSpan(span);
         return span->pageAddr;
     }
 
@@ -43,64 +46,312 @@ void* PageCache::allocateSpan(std::size_t numPages) {
 
     if (!memory) return nullptr;
 
-    Span* span = new Span;
+    Span* span = spanAllocator_.create();
+    if (!span) {
+        munmap(memory, numPages * PAGE_SIZE);
+        return nullptr;
+    }
     span->pageAddr = memory;
     span->numPages = numPages;
-    span->next = nullptr;
+    span->isUsed = true;
+    span->node = static_cast<uint8_t>(node_);
 
-    spanMap_[memory] = span;
+    if (!registerSpan(span)) {
+        munmap(memory, numPages * PAGE_SIZE);
+        spanAllocator_.destroy(span);
+        return nullptr;
+    }
     return memory;
 }
 
-void PageCache::deallocateSpan(void* ptr, size_t numPages) {
+// 空闲 span 的首尾两页都登记在 pageMap_ 中
+// 所以 前一页 和 后一页 查出来的就是左右相邻的 span 两边都能 O(1) 合并
+// 相邻的 span 可能属于另一个节点 (两个节点的 arena 恰好挨着) 这种不能合并
+void PageCache::deallocateSpan(void* ptr, size_t numPages, bool release) {
+    // span 在使用中 node 字段不会变 不加锁读取
+    Span* span = getSpan(ptr);
+    if (span && span->node != node_) {
+        getInstance(span->node).deallocateSpan(ptr, numPages, release);
+        return;
+    }
+
+    if (!span || span->pageAddr != ptr) return;
+    assert(span->numPages == numPages);
+
+    // 调用者还拥有这个 span madvise 不需要持有锁
+    bool released = release && releaseToSystem(ptr, numPages * PAGE_SIZE, false);
+
     std::lock_guard<std::mutex> lock(mutex_);
 
-    auto it = spanMap_.find(ptr);
-    if (it == spanMap_.end()) return;
+    if (!span->isUsed) return;
 
-    // 因为上面分配逻辑中写了找到大于 numPages 的span 然后分配一部分 所以这里通过 合并减少碎片
-    Span* span = it->second;
-    void* nextAddr = static_cast<char*>(ptr) + numPages * PAGE_SIZE;
-    auto nextIt = spanMap_.find(nextAddr);
+    span->isUsed = false;
+    span->sizeClass = 0;
+    span->blockSize = 0;
+    span->blockCount = 0;
+    span->freeCount = 0;
+    span->owner = 0;
+    span->isReleased = released;
 
-    if (nextIt != spanMap_.end()) {
-        Span* nextSpan = nextIt->second;
+    // 两边都已经释放过才算释放 否则整个 span 都按常驻计算 已经释放过的那部分再 madvise 一次也没有问题
+    size_t pageId = reinterpret_cast<uintptr_t>(ptr) >> PAGE_SHIFT;
+    Span* prevSpan = pageId > 0 ? pageMap_.get(pageId - 1) : nullptr;
+    if (prevSpan && !prevSpan->isUsed && prevSpan->node == node_ &&
+            static_cast<char*>(prevSpan->pageAddr) + prevSpan->numPages * PAGE_SIZE == ptr) {
+        removeFreeSpan(prevSpan);
+        span->pageAddr = prevSpan->pageAddr;
+        span->numPages += prevSpan->numPages;
+        span->isReleased = span->isReleased && prevSpan->isReleased;
+        spanAllocator_.destroy(prevSpan);
+    }
 
-        bool found = false;
-        auto& nextList = freeSpans_[nextSpan->numPages];
-        Span* dummy;
-        dummy->next = nextList;
-        Span* prev = dummy;
+    void* end = static_cast<char*>(span->pageAddr) + span->numPages * PAGE_SIZE;
+    Span* nextSpan = pageMap_.get(reinterpret_cast<uintptr_t>(end) >> PAGE_SHIFT);
+    if (nextSpan && !nextSpan->isUsed && nextSpan->node == node_ && nextSpan->pageAddr == end) {
+        removeFreeSpan(nextSpan);
+        span->numPages += nextSpan->numPages;
+        span->isReleased = span->isReleased && nextSpan->isReleased;
+        spanAllocator_.destroy(nextSpan);
+    }
 
-        while (prev->next) {
-            if (prev->next == nextSpan) {
-                found = true;
-                prev->next = nextSpan->next;
-            }
-            prev = prev->next;
+    insertFreeSpan(span);
+}
+
+void PageCache::collectStats(PoolStats& stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.pageCacheFreeSpans += freeSpans_;
+    stats.pageCacheFreeBytes += freeBytes_;
+    stats.pageCacheFreeResidentBytes += freeResidentBytes_;
+    stats.mappedBytes += mappedBytes_;
+    stats.arenaUnusedBytes += arenaEnd_ - arenaCur_;
+}
+
+size_t PageCache::getFreeResidentBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return freeResidentBytes_;
+}
+
+// 从最大的 span 开始释放 大 span 被再次申请的可能性最小 一次 madvise 能还回去的也最多
+size_t PageCache::releaseFreePages(size_t maxBytes, bool useMadvFree) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t released = 0;
+    auto release = [&](Span* span) {
+        if (span->isReleased) return;
+
+        size_t bytes = span->numPages * PAGE_SIZE;
+        if (!releaseToSystem(span->pageAddr, bytes, useMadvFree)) return;
+
+        span->isReleased = true;
+        freeResidentBytes_ -= bytes;
+        released += bytes;
+    };
+
+    for (auto it = largeSpans_.rbegin(); it != largeSpans_.rend() && released < maxBytes; ++it) {
+        release(*it);
+    }
+    for (size_t pages = MAX_SMALL_PAGES; pages > 0 && released < maxBytes; --pages) {
+        for (Span* span = smallSpans_[pages]; span && released < maxBytes; span = span->next) {
+            release(span);
         }
+    }
+    return released;
+}
+
+void PageCache::insertFreeSpan(Span* span) {
+    registerSpanEdges(span);
+    ++freeSpans_;
+    freeBytes_ += span->numPages * PAGE_SIZE;
+    if (!span->isReleased) {
+        freeResidentBytes_ += span->numPages * PAGE_SIZE;
+    }
+
+    if (span->numPages > MAX_SMALL_PAGES) {
+        span->next = span->prev = nullptr;
+        largeSpans_.insert(span);
+        return;
+    }
+
+    Span*& head = smallSpans_[span->numPages];
+    span->prev = nullptr;
+    span->next = head;
+    if (head) head->prev = span;
+    head = span;
+
+    size_t bit = span->numPages - 1;
+    smallBitmap_[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+void PageCache::removeFreeSpan(Span* span) {
+    --freeSpans_;
+    freeBytes_ -= span->numPages * PAGE_SIZE;
+    if (!span->isReleased) {
+        freeResidentBytes_ -= span->numPages * PAGE_SIZE;
+    }
+
+    if (span->numPages > MAX_SMALL_PAGES) {
+        largeSpans_.erase(span);
+        return;
+    }
+
+    if (span->prev) {
+        span->prev->next = span->next;
+    } else {
+        smallSpans_[span->numPages] = span->next;
+    }
+    if (span->next) {
+        span->next->prev = span->prev;
+    }
+    span->next = span->prev = nullptr;
+
+    if (!smallSpans_[span->numPages]) {
+        size_t bit = span->numPages - 1;
+        smallBitmap_[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+    }
+}
 
-        nextList = dummy->next;
+Span* PageCache::findFreeSpan(size_t numPages) {
+    if (numPages == 0) numPages = 1;
 
-        if (found) {
-            span->numPages += nextSpan->numPages;
-            spanMap_.erase(nextAddr);
-            delete nextSpan;
+    if (numPages <= MAX_SMALL_PAGES) {
+        size_t bit = numPages - 1;
+        for (size_t word = bit / 64; word < BITMAP_WORDS; ++word) {
+            uint64_t bits = smallBitmap_[word];
+            if (word == bit / 64) {
+                bits &= ~uint64_t(0) << (bit % 64);
+            }
+            if (bits) {
+                return smallSpans_[word * 64 + __builtin_ctzll(bits) + 1];
+            }
         }
     }
-    auto& list = freeSpans_[span->numPages];
-    span->next = list;
-    list = span;
+
+    auto it = largeSpans_.lower_bound(numPages);
+    return it != largeSpans_.end() ? *it : nullptr;
+}
+
+// MADV_DONTNEED 立即归还 之后访问得到的是清零的新页
+// MADV_FREE 只是告诉内核可以回收 内存紧张时才真正回收 开销更小 但 RSS 不会马上下降
+// 老内核不支持 MADV_FREE 时退回 MADV_DONTNEED
+bool PageCache::releaseToSystem(void* ptr, size_t bytes, bool useMadvFree) {
+#ifdef MADV_FREE
+    if (useMadvFree && madvise(ptr, bytes, MADV_FREE) == 0) {
+        return true;
+    }
+#else
+    (void)useMadvFree;
+#endif
+    return madvise(ptr, bytes, MADV_DONTNEED) == 0;
+}
+
+bool PageCache::registerSpan(Span* span) {
+    size_t pageId = reinterpret_cast<uintptr_t>(span->pageAddr) >> PAGE_SHIFT;
+    if (!pageMap_.ensure(pageId, span->numPages)) return false;
+
+    for (size_t i = 0; i < span->numPages; ++i) {
+        pageMap_.set(pageId + i, span);
+    }
+    return true;
+}
+
+bool PageCache::registerSpanEdges(Span* span) {
+    size_t pageId = reinterpret_cast<uintptr_t>(span->pageAddr) >> PAGE_SHIFT;
+    if (!pageMap_.ensure(pageId, span->numPages)) return false;
+
+    pageMap_.set(pageId, span);
+    pageMap_.set(pageId + span->numPages - 1, span);
+    return true;
 }
 
-void* PageCache::systemAlloc(size_t numPages) {
+void PageCache::setHugePagePolicy(HugePagePolicy policy) {
+    hugePagePolicy_.store(policy, std::memory_order_relaxed);
+}
+
+// 原来每次都 mmap 恰好 numPages 页再 memset 一遍
+// 现在一次预留 ARENA_SIZE 的地址空间 之后只是移动指针 新映射的匿名页本来就是零 不需要 memset
+// 物理页在第一次访问时才分配 预留本身几乎没有开销
+void* PageCache::systemAlloc(size_t& numPages) {
     size_t size = numPages * PAGE_SIZE;
 
-    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
-                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (ptr == MAP_FAILED) return nullptr;
+    // 特别大的请求单独映射 不占用 arena
+    // 映射按大页取整 多出来的尾巴也算在这个 span 里 否则既没有登记也不会被释放
+    if (size > ARENA_SIZE / 8) {
+        size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        numPages = size / PAGE_SIZE;
+        return mapRegion(size);
+    }
+
+    if (static_cast<size_t>(arenaEnd_ - arenaCur_) < size) {
+        // 旧 arena 剩下的尾巴作为空闲 span 这些页从来没有被访问过 所以不算常驻
+        if (arenaCur_ != arenaEnd_) {
+            if (Span* tail = spanAllocator_.create()) {
+                tail->pageAddr = arenaCur_;
+                tail->numPages = (arenaEnd_ - arenaCur_) / PAGE_SIZE;
+                tail->isReleased = true;
+                tail->node = static_cast<uint8_t>(node_);
+                insertFreeSpan(tail);
+            }
+        }
+
+        char* arena = static_cast<char*>(mapRegion(ARENA_SIZE));
+        if (!arena) {
+            // 地址空间不够 (例如关闭了 overcommit) 退回按需映射
+            arenaCur_ = arenaEnd_ = nullptr;
+            void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) return nullptr;
+            Numa::bindToNode(ptr, size, node_);
+            mappedBytes_ += size;
+            return ptr;
+        }
+        arenaCur_ = arena;
+        arenaEnd_ = arena + ARENA_SIZE;
+    }
+
+    void* result = arenaCur_;
+    arenaCur_ += size;
+    return result;
+}
+
+// 映射之后还没有被访问过 mbind 在第一次缺页之前生效 物理页直接分配在本节点上
+void* PageCache::mapRegion(size_t size) {
+    size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    HugePagePolicy policy = hugePagePolicy_.load(std::memory_order_relaxed);
+
+#ifdef MAP_HUGETLB
+    if (policy == HugePagePolicy::HugeTLB) {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            Numa::bindToNode(ptr, size, node_);
+            mappedBytes_ += size;
+            return ptr;
+        }
+    }
+#endif
 
-    memset(ptr, 0, size);
+    // 多映射一个大页 再把首尾不对齐的部分还回去 保证起始地址按 2M 对齐 透明大页才能生效
+    void* raw = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) return nullptr;
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (aligned > start) {
+        munmap(raw, aligned - start);
+    }
+    if (start + HUGE_PAGE_SIZE > aligned) {
+        munmap(reinterpret_cast<void*>(aligned + size), start + HUGE_PAGE_SIZE - aligned);
+    }
+
+    void* ptr = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+    if (policy != HugePagePolicy::None) {
+        madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#endif
+    Numa::bindToNode(ptr, size, node_);
+    mappedBytes_ += size;
     return ptr;
 }
 
@@ -0,0 +1,42 @@
+#include <mutex>
+
+#include "../include/RemoteFree.h"
+
+namespace Pool
+{
+
+RemoteFree::Slot        RemoteFree::slots_[RemoteFree::MAX_OWNERS];
+std::atomic<bool>       RemoteFree::enabled_{false};
+
+namespace
+{
+// 只在线程创建和退出时使用
+std::mutex  slotMutex;
+size_t      nextSlot = 1;
+}
+
+uint16_t RemoteFree::acquire() {
+    std::lock_guard<std::mutex> lock(slotMutex);
+    for (size_t i = 0; i < MAX_OWNERS - 1; ++i) {
+        size_t owner = nextSlot;
+        nextSlot = nextSlot + 1 < MAX_OWNERS ? nextSlot + 1 : 1;
+        if (!slots_[owner].used) {
+            slots_[owner].used = true;
+            slots_[owner].head.store(nullptr, std::memory_order_release);
+            return static_cast<uint16_t>(owner);
+        }
+    }
+    return NO_OWNER;
+}
+
+void* RemoteFree::release(uint16_t owner) {
+    if (owner == NO_OWNER) return nullptr;
+
+    void* rest = slots_[owner].head.exchange(reinterpret_cast<void*>(CLOSED), std::memory_order_acquire);
+
+    std::lock_guard<std::mutex> lock(slotMutex);
+    slots_[owner].used = false;
+    return rest;
+}
+
+} // namespace Pool
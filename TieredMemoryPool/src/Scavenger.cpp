@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <pthread.h>
+
+#include "../include/Arena.h"
+#include "../include/CentralCache.h"
+#include "../include/PageCache.h"
+#include "../include/Scavenger.h"
+#include "../include/ThreadCache.h"
+
+namespace Pool
+{
+
+// 先构造 PageCache 和 CentralCache 保证进程退出时 Scavenger 先析构
+// 否则后台线程可能在它们析构之后还在访问
+Scavenger& Scavenger::getInstance() {
+    PageCache::getInstance();
+    CentralCache::getInstance();
+    static Scavenger instance;
+    return instance;
+}
+
+Scavenger::~Scavenger() {
+    stop();
+    if (cv_) {
+        cvAllocator_.destroy(cv_);
+    }
+}
+
+void Scavenger::start(const ScavengerOptions& options) {
+    static const bool forkHandlers = [] {
+        return pthread_atfork(&Scavenger::prepareFork, &Scavenger::parentAfterFork,
+                              &Scavenger::childAfterFork) == 0;
+    }();
+    (void)forkHandlers;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    options_ = options;
+    if (running_ || !cv_) return;
+    running_ = true;
+    thread_ = std::thread(&Scavenger::run, this);
+}
+
+void Scavenger::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cv_->notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool Scavenger::isRunning() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_;
+}
+
+size_t Scavenger::runOnce(size_t maxReleaseBytes) {
+    std::lock_guard<std::mutex> run(runMutex_);
+
+    ScavengerOptions options;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        options = options_;
+    }
+
+    if (options.reclaimThreadCaches) {
+        ThreadCache::reclaimIdleCaches();
+        Arena::releaseSpareSpans();
+    }
+    // 全空的 span 回到 PageCache 之后才有可能被释放
+    size_t numNodes = Numa::numNodes();
+    for (size_t node = 0; node < numNodes; ++node) {
+        CentralCache::getInstance(node).flushDelayedReturns();
+    }
+
+    // retainedBytes 是所有节点合计的 超出的部分按各节点的常驻字节数依次释放
+    size_t resident = 0;
+    for (size_t node = 0; node < numNodes; ++node) {
+        resident += PageCache::getInstance(node).getFreeResidentBytes();
+    }
+    if (resident <= options.retainedBytes) {
+        return 0;
+    }
+
+    size_t budget = std::min(resident - options.retainedBytes, maxReleaseBytes);
+    size_t released = 0;
+    for (size_t node = 0; node < numNodes && released < budget; ++node) {
+        released += PageCache::getInstance(node).releaseFreePages(budget - released,
+                                                                 options.useMadvFree);
+    }
+    return released;
+}
+
+void Scavenger::prepareFork() {
+    Scavenger& instance = getInstance();
+    instance.runMutex_.lock();
+    instance.mutex_.lock();
+}
+
+void Scavenger::parentAfterFork() {
+    Scavenger& instance = getInstance();
+    instance.mutex_.unlock();
+    instance.runMutex_.unlock();
+}
+
+// 子进程中只有调用 fork 的线程 后台线程并不存在
+// 不 detach 的话子进程退出时析构函数里的 join 会永远等下去
+// cv_ 上还记着父进程里那个线程在等待 析构时 glibc 会等它醒来
+// 所以旧的不析构也不复用 (几十字节的元数据) 在新的位置上构造一个
+void Scavenger::childAfterFork() {
+    Scavenger& instance = getInstance();
+    if (instance.thread_.joinable()) {
+        instance.thread_.detach();
+    }
+    instance.running_ = false;
+    instance.cv_ = instance.cvAllocator_.create();
+    instance.mutex_.unlock();
+    instance.runMutex_.unlock();
+}
+
+void Scavenger::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        auto interval = options_.interval;
+        // 每一轮的释放额度 = 速率 * 间隔 至少一页
+        size_t budget = std::max<size_t>(
+            options_.releaseBytesPerSecond / 1000 * static_cast<size_t>(interval.count()),
+            size_t(PageCache::PAGE_SIZE));
+
+        lock.unlock();
+        runOnce(budget);
+        lock.lock();
+
+        cv_->wait_for(lock, interval, [this] { return !running_; });
+    }
+}
+
+} // namespace Pool
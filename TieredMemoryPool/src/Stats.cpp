@@ -0,0 +1,120 @@
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../include/CentralCache.h"
+#include "../include/CpuCache.h"
+#include "../include/LargeCache.h"
+#include "../include/Numa.h"
+#include "../include/PageCache.h"
+#include "../include/Stats.h"
+#include "../include/ThreadCache.h"
+
+namespace Pool
+{
+
+namespace
+{
+
+// /proc/self/statm 的第二项是常驻页数
+// 可能在 LD_PRELOAD 的进程里被调用 不用会申请内存的 fopen
+size_t processResidentBytes() {
+    char buf[128];
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+
+    char* end;
+    strtoul(buf, &end, 10);
+    size_t pages = strtoul(end, nullptr, 10);
+    return pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+double percent(size_t part, size_t whole) {
+    return whole ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+}
+
+} // namespace
+
+// 每一层只累加自己的计数 使用中的字节数最后由 span 的容量减去各层缓存的块算出来
+// CpuCache 的快速路径没有计数 这样算出来的在两种前端下都成立
+PoolStats getStats() {
+    PoolStats stats;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        stats.sizeClasses[index].size = SizeClass::SizeForIndex(index);
+    }
+
+    ThreadCache::collectStats(stats);
+    CpuCache::collectStats(stats);
+    LargeCache::collectStats(stats);
+    for (size_t node = 0; node < Numa::numNodes(); ++node) {
+        CentralCache::getInstance(node).collectStats(stats);
+        PageCache::getInstance(node).collectStats(stats);
+    }
+
+    for (SizeClassStats& sc : stats.sizeClasses) {
+        size_t blocksPerSpan = sc.spans ? sc.spanBytes / sc.spans / sc.size : 0;
+        size_t capacity = sc.spans * blocksPerSpan * sc.size;
+        size_t cached = sc.threadCachedBytes + sc.cpuCachedBytes + sc.centralCachedBytes;
+        // 各项不是同一时刻读到的 块正在两层之间移动时可能算出负数
+        sc.inUseBytes = capacity > cached ? capacity - cached : 0;
+
+        stats.allocs += sc.allocs;
+        stats.frees += sc.frees;
+        stats.threadCacheMisses += sc.misses;
+        stats.inUseBytes += sc.inUseBytes;
+        stats.threadCachedBytes += sc.threadCachedBytes;
+        stats.cpuCachedBytes += sc.cpuCachedBytes;
+        stats.centralCachedBytes += sc.centralCachedBytes;
+    }
+    stats.threadCacheHits = stats.allocs > stats.threadCacheMisses ? stats.allocs - stats.threadCacheMisses : 0;
+
+    size_t notResident = stats.arenaUnusedBytes + (stats.pageCacheFreeBytes - stats.pageCacheFreeResidentBytes);
+    stats.residentBytes = stats.mappedBytes > notResident ? stats.mappedBytes - notResident : 0;
+    stats.processResidentBytes = processResidentBytes();
+
+    size_t used = stats.inUseBytes + stats.largeInUseBytes;
+    stats.fragmentation = stats.residentBytes > used
+        ? 1.0 - static_cast<double>(used) / static_cast<double>(stats.residentBytes) : 0.0;
+    return stats;
+}
+
+void dumpStats(FILE* out) {
+    PoolStats stats = getStats();
+
+    fprintf(out, "------------------------------------------------\n");
+    fprintf(out, "MALLOC: %14zu 程序正在使用 (小块)\n", stats.inUseBytes);
+    fprintf(out, "MALLOC: %14zu 程序正在使用 (大块)\n", stats.largeInUseBytes);
+    fprintf(out, "MALLOC: %14zu ThreadCache 缓存 (%zu 个线程)\n", stats.threadCachedBytes, stats.threadCaches);
+    fprintf(out, "MALLOC: %14zu CpuCache 缓存\n", stats.cpuCachedBytes);
+    fprintf(out, "MALLOC: %14zu CentralCache 缓存\n", stats.centralCachedBytes);
+    fprintf(out, "MALLOC: %14zu LargeCache 缓存\n", stats.largeCachedBytes);
+    fprintf(out, "MALLOC: %14zu PageCache 空闲 span (%zu 个) 其中常驻 %zu\n",
+            stats.pageCacheFreeBytes, stats.pageCacheFreeSpans, stats.pageCacheFreeResidentBytes);
+    fprintf(out, "MALLOC: %14zu 映射的地址空间 其中 arena 未使用 %zu\n", stats.mappedBytes, stats.arenaUnusedBytes);
+    fprintf(out, "MALLOC: %14zu 内存池常驻 (估计)\n", stats.residentBytes);
+    fprintf(out, "MALLOC: %14zu 进程 RSS\n", stats.processResidentBytes);
+    fprintf(out, "MALLOC: %13.1f%% 碎片 (1 - 使用中 / 内存池常驻)\n", stats.fragmentation * 100);
+    fprintf(out, "MALLOC: %14llu 次分配 %llu 次释放 命中 %.1f%%\n",
+            static_cast<unsigned long long>(stats.allocs), static_cast<unsigned long long>(stats.frees),
+            percent(stats.threadCacheHits, stats.allocs));
+    fprintf(out, "MALLOC: %14llu 次大块分配 %llu 次大块释放\n",
+            static_cast<unsigned long long>(stats.largeAllocs), static_cast<unsigned long long>(stats.largeFrees));
+    fprintf(out, "------------------------------------------------\n");
+    fprintf(out, "%8s %12s %12s %10s %8s %12s %12s %12s %8s\n",
+            "size", "allocs", "frees", "misses", "spans", "in use", "cached", "span bytes", "frag%");
+
+    for (const SizeClassStats& sc : stats.sizeClasses) {
+        if (sc.spans == 0 && sc.allocs == 0) continue;
+        size_t cached = sc.threadCachedBytes + sc.cpuCachedBytes + sc.centralCachedBytes;
+        fprintf(out, "%8zu %12llu %12llu %10llu %8zu %12zu %12zu %12zu %7.1f%%\n",
+                sc.size, static_cast<unsigned long long>(sc.allocs), static_cast<unsigned long long>(sc.frees),
+                static_cast<unsigned long long>(sc.misses), sc.spans, sc.inUseBytes, cached, sc.spanBytes,
+                100.0 - percent(sc.inUseBytes, sc.spanBytes));
+    }
+}
+
+} // namespace Pool
@@ -1,50 +1,202 @@
 #include "../include/ThreadCache.h"
 #include "../include/CentralCache.h"
+#include "../include/CpuCache.h"
+#include "../include/LargeCache.h"
+#include "../include/PageCache.h"
+#include "../include/RemoteFree.h"
+#include "../include/Stats.h"
 
+#include <cassert>
 #include <cstddef>
 #include <cstdlib>
+#include <stdexcept>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace Pool
 {
 
+ThreadCache*            ThreadCache::registryHead_ = nullptr;
+std::mutex              ThreadCache::registryMutex_;
+thread_local bool       ThreadCache::destroyed_ = false;
+std::array<uint64_t, FREE_LIST_SIZE> ThreadCache::retiredAllocs_{};
+std::array<uint64_t, FREE_LIST_SIZE> ThreadCache::retiredFrees_{};
+std::array<uint64_t, FREE_LIST_SIZE> ThreadCache::retiredMisses_{};
+
+ThreadCache::ThreadCache() {
+    freeList_.fill(nullptr);
+    freeListSize_.fill(0);
+    // 慢启动 每个 size class 一开始只缓存 1 块
+    maxLength_.fill(1);
+    lengthOverages_.fill(0);
+    lowWater_.fill(0);
+    allocCount_.fill(0);
+    freeCount_.fill(0);
+    missCount_.fill(0);
+
+    if (RemoteFree::isEnabled()) {
+        owner_ = RemoteFree::acquire();
+    }
+
+    // 登记到存活线程缓存的链表中
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    next_ = registryHead_;
+    if (registryHead_) {
+        registryHead_->prev_ = this;
+    }
+    registryHead_ = this;
+}
+
+ThreadCache::~ThreadCache() {
+    {
+        // 先摘下 之后 reclaimIdleCaches 就不会再访问这个线程缓存
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        if (prev_) {
+            prev_->next_ = next_;
+        } else {
+            registryHead_ = next_;
+        }
+        if (next_) {
+            next_->prev_ = prev_;
+        }
+
+        for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            retiredAllocs_[index] += allocCount_[index];
+            retiredFrees_[index] += freeCount_[index];
+            retiredMisses_[index] += missCount_[index];
+        }
+    }
+
+    // 关闭队列 之后别的线程释放的块自己处理 队列里剩下的一起归还
+    if (owner_ != RemoteFree::NO_OWNER) {
+        void* rest = RemoteFree::release(owner_);
+        owner_ = RemoteFree::NO_OWNER;
+        absorbRemoteFrees(rest);
+    }
+
+    // 已经不在链表中 不会再有其他线程访问
+    releaseAll();
+    destroyed_ = true;
+}
+
 void* ThreadCache::allocate(size_t size) {
-    // 
+    if (size == 0) {
     #ifdef DEBUG_MODE
         throw std::invalid_argument("ThreadCache::allocate(): size cannot be 0");
     #else
         size = ALIGNMENT;
     #endif
-
-    if (size == 0) {
-        size = ALIGNMENT;
     }
 
     if (size > MAX_BYTES) {
-        malloc(size);
+        return LargeCache::allocate(size);
     }
 
     size_t index = SizeClass::getIndex(size);
 
-    --freeListSize_[index];
+    UseGuard guard(*this);
+    ++allocCount_[index];
+    if (freeList_[index]) {
+        return popFreeList(index);
+    }
 
-    if (void* ptr = freeList_[index]) {
+    return fetchFromCentralCache(index);
+}
 
-        freeList_[index] = *reinterpret_cast<void**>(ptr);
-        return ptr;
+void* ThreadCache::popFreeList(size_t index) {
+    void* ptr = freeList_[index];
+    --freeListSize_[index];
+    totalBytes_ -= SizeClass::SizeForIndex(index);
+    if (freeListSize_[index] < lowWater_[index]) {
+        lowWater_[index] = static_cast<uint32_t>(freeListSize_[index]);
     }
 
-    return fetchFromCentralCache(index);
+    freeList_[index] = *reinterpret_cast<void**>(ptr);
+    return ptr;
 }
 
 // ptr --> address
 // 释放指定地点 指定大小的内存
 void ThreadCache::deallocate(void* ptr, size_t size) {
     if (size > MAX_BYTES) {
-        free(ptr);
+        LargeCache::deallocate(ptr);
         return;
     }
 
+    // 已知大小的路径本来不查 PageMap 只有打开 RemoteFree 时才需要 span 上的 owner
     size_t index = SizeClass::getIndex(size);
+    if (RemoteFree::isEnabled() && pushRemote(ptr, PageCache::getSpan(ptr))) {
+        UseGuard guard(*this);
+        ++freeCount_[index];
+        return;
+    }
+
+    deallocateByIndex(ptr, index);
+}
+
+// 不知道大小的释放
+// 通过 PageMap 找到 ptr 所在的 span 由 span 上记录的 size class 得到 index
+void ThreadCache::deallocate(void* ptr) {
+    if (ptr == nullptr) return;
+
+    Span* span = PageCache::getSpan(ptr);
+
+    // 不在任何 span 中 不是内存池分配的
+    if (!span) {
+        free(ptr);
+        return;
+    }
+
+    assert(span->isUsed && span->blockSize != 0);
+    if (span->sizeClass == LARGE_SIZE_CLASS) {
+        LargeCache::deallocate(ptr);
+        return;
+    }
+    if (RemoteFree::isEnabled() && pushRemote(ptr, span)) {
+        UseGuard guard(*this);
+        ++freeCount_[span->sizeClass];
+        return;
+    }
+    deallocateByIndex(ptr, span->sizeClass);
+}
+
+bool ThreadCache::pushRemote(void* ptr, const Span* span) {
+    uint16_t owner = span ? __atomic_load_n(&span->owner, __ATOMIC_RELAXED) : RemoteFree::NO_OWNER;
+    if (owner == RemoteFree::NO_OWNER || owner == owner_) return false;
+    return RemoteFree::push(owner, ptr);
+}
+
+// 队列里的块来自各个 size class 逐块查 span 放回对应的 freeList_
+// 不经过 deallocateByIndex: 那里的 scavenge 可能把刚放进来的块又还回去 这里最后统一调整
+void ThreadCache::absorbRemoteFrees(void* list) {
+    if (list == nullptr) return;
+
+    while (list) {
+        void* next = *reinterpret_cast<void**>(list);
+        size_t index = PageCache::getSpan(list)->sizeClass;
+
+        *reinterpret_cast<void**>(list) = freeList_[index];
+        freeList_[index] = list;
+        ++freeListSize_[index];
+        totalBytes_ += SizeClass::SizeForIndex(index);
+
+        list = next;
+    }
+
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        if (freeListSize_[index] > maxLength_[index]) {
+            returnToCentralCache(index, freeListSize_[index] - maxLength_[index]);
+        }
+    }
+    if (totalBytes_ > MAX_CACHE_BYTES) {
+        scavenge();
+    }
+}
+
+void ThreadCache::deallocateByIndex(void* ptr, size_t index) {
+    UseGuard guard(*this);
+    ++freeCount_[index];
 
     // 头插法
     // 将 ptr 变成一个指向指针的指针 
@@ -54,115 +206,296 @@ void ThreadCache::deallocate(void* ptr, size_t size) {
     freeList_[index] = ptr;
 
     ++freeListSize_[index];
+    totalBytes_ += SizeClass::SizeForIndex(index);
 
     // 是否需要将这一个内存块回收
     if (shouldReturnToCentralCache(index)) {
-        returnToCentralCache(freeList_[index], size);
+        listTooLong(index);
+    } else if (totalBytes_ > MAX_CACHE_BYTES) {
+        scavenge();
     }
 }
 
-// 这里动态标准的效果似乎并不好
+// 线程缓存已经析构 一次只向 CentralCache 要一块
+void* ThreadCache::allocateWithoutCache(size_t size) {
+    if (size == 0) size = ALIGNMENT;
+    if (size > MAX_BYTES) return LargeCache::allocate(size);
+
+    size_t index = SizeClass::getIndex(size);
+    void* ptr = nullptr;
+    CentralCache::getInstance().fetchRange(ptr, 1, index);
+
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    ++retiredAllocs_[index];
+    ++retiredMisses_[index];
+    return ptr;
+}
+
+void ThreadCache::deallocateWithoutCache(void* ptr, size_t size) {
+    if (ptr == nullptr) return;
+
+    size_t index;
+    if (size == 0) {
+        Span* span = PageCache::getSpan(ptr);
+        if (!span) {
+            free(ptr);
+            return;
+        }
+        index = span->sizeClass;
+    } else {
+        index = size > MAX_BYTES ? LARGE_SIZE_CLASS : SizeClass::getIndex(size);
+    }
+
+    if (index == LARGE_SIZE_CLASS) {
+        LargeCache::deallocate(ptr);
+        return;
+    }
+
+    *reinterpret_cast<void**>(ptr) = nullptr;
+    CentralCache::returnRangeToOwners(ptr, 1, index);
+
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    ++retiredFrees_[index];
+}
+
+// 让进程内所有正在运行的线程都执行一次完整的内存屏障
+// 优先使用 PRIVATE_EXPEDITED 不支持时退回到 GLOBAL 都不支持时返回 false
+static bool processWideBarrier() {
+    static const int command = [] {
+        int supported = static_cast<int>(syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0));
+        if (supported < 0) return -1;
+        if ((supported & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+            syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+            return static_cast<int>(MEMBARRIER_CMD_PRIVATE_EXPEDITED);
+        }
+        if (supported & MEMBARRIER_CMD_GLOBAL) {
+            return static_cast<int>(MEMBARRIER_CMD_GLOBAL);
+        }
+        return -1;
+    }();
+
+    return command >= 0 && syscall(__NR_membarrier, command, 0) == 0;
+}
+
+// 非对称的 Dekker 的另一半 见 UseGuard
+// 1. 先把所有线程缓存标记为正在回收
+// 2. 屏障之后 每个线程要么已经把 inUse_ 写成 true 并且我们能看到
+//    要么之后进入 UseGuard 时一定能看到 reclaiming_ 从而等待
+// 3. 没有在使用的线程缓存 此时可以安全访问 正在使用的最多再执行完这一次分配释放
+// 不支持 membarrier 时不访问任何线程缓存
+template <typename Fn>
+void ThreadCache::forEachQuiescent(bool wait, Fn fn) {
+    for (ThreadCache* cache = registryHead_; cache; cache = cache->next_) {
+        cache->reclaiming_.store(true, std::memory_order_relaxed);
+    }
+
+    bool barrier = processWideBarrier();
+
+    for (ThreadCache* cache = registryHead_; cache; cache = cache->next_) {
+        if (barrier && wait) {
+            while (cache->inUse_.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+        if (barrier && !cache->inUse_.load(std::memory_order_acquire)) {
+            fn(*cache);
+        }
+        cache->reclaiming_.store(false, std::memory_order_release);
+    }
+}
+
+// 回收空闲线程的缓存
+// active_ 在每次分配释放时置位 这里清零 两次调用之间一直没有置位说明线程空闲
+// 按 CPU 缓存时块囤在 slab 里 空闲 CPU 的 slab 同样分两次清空
+size_t ThreadCache::reclaimIdleCaches() {
+    size_t reclaimed = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        forEachQuiescent(false, [&](ThreadCache& cache) {
+            if (!cache.active_) {
+                reclaimed += cache.releaseAll();
+            }
+            cache.active_ = false;
+        });
+    }
+    reclaimed += CpuCache::drain(true);
+    return reclaimed;
+}
+
+void ThreadCache::collectStats(PoolStats& stats) {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        SizeClassStats& sc = stats.sizeClasses[index];
+        sc.allocs += retiredAllocs_[index];
+        sc.frees += retiredFrees_[index];
+        sc.misses += retiredMisses_[index];
+    }
+
+    forEachQuiescent(true, [&](ThreadCache& cache) {
+        ++stats.threadCaches;
+        for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            SizeClassStats& sc = stats.sizeClasses[index];
+            sc.allocs += cache.allocCount_[index];
+            sc.frees += cache.freeCount_[index];
+            sc.misses += cache.missCount_[index];
+            sc.threadCachedBytes += cache.freeListSize_[index] * SizeClass::SizeForIndex(index);
+        }
+    });
+}
+
+// 归还所有 freeList_ returnRange 会按批拆分
+// maxLength_ 回到慢启动的初始状态
+size_t ThreadCache::releaseAll() {
+    if (owner_ != RemoteFree::NO_OWNER) {
+        absorbRemoteFrees(RemoteFree::drain(owner_));
+    }
+
+    size_t released = totalBytes_;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        returnToCentralCache(index, freeListSize_[index]);
+        maxLength_[index] = 1;
+        lengthOverages_[index] = 0;
+        lowWater_[index] = 0;
+    }
+    return released;
+}
+
 // 判断是否需要将内存回收给中心缓存
-// bool ThreadCache::shouldReturnToCentralCache(size_t index)
-// {
-//     // 基准阈值（可调）
-//     constexpr size_t baseThreshold = 64;
-
-//     // 动态阈值：base + recent_access / factor
-//     // recent_access 越大，阈值越高（表示该 size-class 更热，应保留更多）
-//     size_t dynamicThreshold = baseThreshold + (allocCount_[index] / 64);
-
-//     // 为避免过大，可以加个上限（可选）
-//     constexpr size_t maxThreshold = 1024;
-//     if (dynamicThreshold > maxThreshold) dynamicThreshold = maxThreshold;
-
-//     return (freeListSize_[index] > dynamicThreshold);
-// }
-// 我使用了 struct 为 list 记录了 初始化计数
-// 最大的 freelist 大小
-// 但是在实际应用中 小块的缓存list 应该更大一些
+// 每个 size class 的上限 maxLength_ 是动态的 见 fetchFromCentralCache 和 listTooLong
 bool ThreadCache::shouldReturnToCentralCache(size_t index) {
-    size_t maxListSize = 256;
-    return (freeListSize_[index] > maxListSize);
+    return (freeListSize_[index] > maxLength_[index]);
 }
 
-// 从中心缓存获取内存
-void* ThreadCache::fetchFromCentralCache(size_t index) {
-    // 从中心缓存获取内存块 传入 index 查找 list 中是否有空闲
-    void* start = CentralCache::getInstance().fetchRange(index);
+// freeList_ 溢出 归还一批
+// maxLength_ 还没到一批时继续慢启动 否则连续溢出几次后缩小一批
+void ThreadCache::listTooLong(size_t index) {
+    size_t batchNum = SizeClass::numMoveSize(SizeClass::SizeForIndex(index));
 
-    // 再上层封装的时候 注意可以捕捉 nullptr 然后停止程序
-    if (!start) return nullptr;
+    returnToCentralCache(index, std::min(batchNum, freeListSize_[index]));
 
-    // 取一个返回 剩余的放入 freelist
-    void* result = start;
-    freeList_[index] = *reinterpret_cast<void**>(start);
+    if (maxLength_[index] < batchNum) {
+        ++maxLength_[index];
+    } else if (maxLength_[index] > batchNum) {
+        if (++lengthOverages_[index] > MAX_OVERAGES) {
+            maxLength_[index] -= static_cast<uint32_t>(batchNum);
+            lengthOverages_[index] = 0;
+        }
+    }
+}
 
-    // 计算
-    size_t batchNum = 0;
-    void* current = start;
+// 线程缓存超出预算 从冷的 size class 偷回容量
+// lowWater_ 大于 0 的 size class 自上次 scavenge 以来一直有块闲置 归还其中一半
+void ThreadCache::scavenge() {
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        if (freeListSize_[index] == 0) continue;
 
-    while (current != nullptr) {
-        ++batchNum;
-        current = *reinterpret_cast<void**>(current);
+        size_t lowWater = lowWater_[index];
+        if (lowWater > 0) {
+            size_t batchNum = SizeClass::numMoveSize(SizeClass::SizeForIndex(index));
+
+            returnToCentralCache(index, std::max<size_t>(lowWater / 2, 1));
+
+            if (maxLength_[index] > batchNum) {
+                maxLength_[index] = static_cast<uint32_t>(
+                    std::max(maxLength_[index] - batchNum, batchNum));
+            }
+        }
+        lowWater_[index] = static_cast<uint32_t>(freeListSize_[index]);
     }
 
-    // TODO: batchNum 可以改进 在 fetchRange 时可以直接告知
-    // freeListSize_ 是记录总的申请的块的数量
-    freeListSize_[index] += batchNum;
+    // 所有 size class 都是热的 只能从最大的那些里归还一半
+    // 一直降到预算的 3/4 以下 避免下一次 deallocate 又立刻触发 scavenge
+    while (totalBytes_ > MAX_CACHE_BYTES / 4 * 3) {
+        size_t victim = 0;
+        size_t victimBytes = 0;
+        for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            size_t bytes = freeListSize_[index] * SizeClass::SizeForIndex(index);
+            if (bytes > victimBytes) {
+                victim = index;
+                victimBytes = bytes;
+            }
+        }
+        if (victimBytes == 0) break;
 
-    return result;
-}   
+        returnToCentralCache(victim, std::max<size_t>(freeListSize_[victim] / 2, 1));
+        lowWater_[victim] = static_cast<uint32_t>(freeListSize_[victim]);
+    }
+}
 
-// 将内存块还给 CentralCache
-void ThreadCache::returnToCentralCache(void* start, size_t size) {
-    if (start == nullptr) return;
+// 从中心缓存获取内存
+// 慢启动: 一次取 min(maxLength_, 一批) 块 每次 miss 都让 maxLength_ 增长
+// 取一个返回 剩余的放入 freelist
+// 打开 RemoteFree 时先取回别的线程还回来的块 命中就不用去 CentralCache
+void* ThreadCache::fetchFromCentralCache(size_t index) {
+    ++missCount_[index];
+    if (owner_ != RemoteFree::NO_OWNER) {
+        if (void* remote = RemoteFree::drain(owner_)) {
+            absorbRemoteFrees(remote);
+            if (freeList_[index]) {
+                return popFreeList(index);
+            }
+        }
+    }
 
-    size_t index = SizeClass::getIndex(size);
+    size_t size = SizeClass::SizeForIndex(index);
+    size_t batchNum = SizeClass::numMoveSize(size);
+    size_t num = std::min<size_t>(maxLength_[index], batchNum);
 
-    // 对齐后的实际块大小
-    size_t alignedSize = SizeClass::roundUp(size);
+    // 从当前节点的中心缓存获取内存块 传入 index 查找 list 中是否有空闲
+    void* start = nullptr;
+    size_t fetchNum = CentralCache::getInstance().fetchRange(start, num, index, owner_);
 
-    size_t actualCount = 0;
-    void* cur = start;
-    while (cur != nullptr) {
-        ++actualCount;
-        cur = *reinterpret_cast<void**>(cur);
+    // 再上层封装的时候 注意可以捕捉 nullptr 然后停止程序
+    if (fetchNum == 0 || !start) return nullptr;
+
+    if (maxLength_[index] < batchNum) {
+        ++maxLength_[index];
+    } else {
+        size_t newLength = std::min<size_t>(maxLength_[index] + batchNum, size_t(MAX_FREE_LIST_LENGTH));
+        newLength -= newLength % batchNum;
+        maxLength_[index] = static_cast<uint32_t>(newLength);
     }
 
-    size_t batchNum = actualCount;
-    
-    // 如果只有一个块 则不归还
-    if (batchNum <= 1) return; 
+    void* result = start;
+    freeList_[index] = *reinterpret_cast<void**>(start);
+
+    // fetchRange 直接告知了块数 不需要再遍历链表
+    // freeListSize_ 是记录 freeList_ 中块的数量
+    freeListSize_[index] += fetchNum - 1;
+    totalBytes_ += (fetchNum - 1) * size;
+    lowWater_[index] = 0;
+
+    return result;
+}   
+
+// 将 freeList_[index] 头部的 num 块还给 CentralCache
+void ThreadCache::returnToCentralCache(size_t index, size_t num) {
+    num = std::min(num, freeListSize_[index]);
+    if (num == 0) return;
 
-    // 保留 1 / 4 
-    size_t keepNum = std::max(batchNum / 4, size_t(1));
+    size_t size = SizeClass::SizeForIndex(index);
 
-    // 将内存块串成 list 并找到分割点
+    // 找到分割点
+    void* start = freeList_[index];
     void* splitNode = start;
-    for (size_t i = 0; i < keepNum - 1; ++i) {
-        // 这里是不应该 return 的
-        if (splitNode == nullptr) {
-            return;
-        }
+    for (size_t i = 0; i < num - 1; ++i) {
         splitNode = *reinterpret_cast<void**>(splitNode);
     }
 
-    if (splitNode == nullptr) {
-        return;
-    }
-
-    void* nextNode = *reinterpret_cast<void**>(splitNode);
     // 断开连接
+    freeList_[index] = *reinterpret_cast<void**>(splitNode);
     *reinterpret_cast<void**>(splitNode) = nullptr;
-    // 头插法
-    freeList_[index] = start;
-    freeListSize_[index] = keepNum;
 
-    size_t returnNum = batchNum - keepNum;
-    if (returnNum > 0 && nextNode != nullptr) {
-        CentralCache::getInstance().returnRange(nextNode, returnNum * alignedSize, index);
+    freeListSize_[index] -= num;
+    totalBytes_ -= num * size;
+    if (freeListSize_[index] < lowWater_[index]) {
+        lowWater_[index] = static_cast<uint32_t>(freeListSize_[index]);
     }
+
+    // 别的节点分配的块送回它所属的节点
+    CentralCache::returnRangeToOwners(start, num, index);
 }
 
-} // namespace Pool
\ No newline at end of file
+} // namespace Pool
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../include/Trace.h"
+
+namespace Pool
+{
+
+std::atomic<bool> TraceRecorder::running_{false};
+
+namespace
+{
+
+const size_t CAPACITY = TraceRecorder::RING_CAPACITY;
+const std::chrono::milliseconds FLUSH_INTERVAL{10};
+
+// 每个线程一个 只有所属线程移动 head 只有后台线程移动 tail
+// head 和 tail 放在不同的缓存行上 两边互不干扰
+struct TraceRing {
+    alignas(64) std::atomic<uint64_t>   head{0};
+    alignas(64) std::atomic<uint64_t>   tail{0};
+    // 所属线程退出时清除 新线程可以接着用 里面还没有写出的记录照常写出
+    std::atomic<bool>                   owned{true};
+    TraceRing*                          next = nullptr;
+    uint16_t                            thread = 0;
+    TraceRecord                         records[CAPACITY];
+};
+
+// 只增不减 缓冲区一直留到进程退出
+std::atomic<TraceRing*> rings{nullptr};
+std::atomic<uint32_t>   nextThread{0};
+std::atomic<uint64_t>   recorded{0};
+std::atomic<uint64_t>   stalls{0};
+
+// start / stop 之间互斥
+std::mutex              controlMutex;
+int                     traceFd = -1;
+// Malloc.cpp 的 constructor 可能在这个文件的动态初始化之前调用 start
+// 所以这里只用常量初始化的类型 不用 std::thread
+pthread_t               writer;
+std::atomic<bool>       writerStop{false};
+
+std::once_flag          ringKeyOnce;
+pthread_key_t           ringKey;
+
+// initial-exec 的 TLS 在 LD_PRELOAD 的 malloc 里也可以安全访问
+__attribute__((tls_model("initial-exec"))) thread_local TraceRing* currentRing = nullptr;
+// 后台线程自己的分配释放不记录
+__attribute__((tls_model("initial-exec"))) thread_local bool isWriter = false;
+
+uint64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// 写失败 (磁盘满) 时丢掉这一段 不影响程序本身
+void writeAll(const void* data, size_t bytes) {
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t n = write(traceFd, p, bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        p += n;
+        bytes -= static_cast<size_t>(n);
+    }
+}
+
+// 线程退出时由 pthread 调用
+void releaseRing(void* ring) {
+    currentRing = nullptr;
+    static_cast<TraceRing*>(ring)->owned.store(false, std::memory_order_release);
+}
+
+// 优先复用已经退出的线程留下的缓冲区 没有再 mmap 一个新的
+TraceRing* claimRing() {
+    TraceRing* ring = nullptr;
+    for (TraceRing* r = rings.load(std::memory_order_acquire); r; r = r->next) {
+        bool expected = false;
+        if (!r->owned.load(std::memory_order_relaxed) &&
+            r->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            ring = r;
+            break;
+        }
+    }
+
+    if (!ring) {
+        void* memory = mmap(nullptr, sizeof(TraceRing), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return nullptr;
+        ring = new (memory) TraceRing;
+
+        TraceRing* head = rings.load(std::memory_order_relaxed);
+        do {
+            ring->next = head;
+        } while (!rings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    ring->thread = static_cast<uint16_t>(nextThread.fetch_add(1, std::memory_order_relaxed));
+    pthread_setspecific(ringKey, ring);
+    currentRing = ring;
+    return ring;
+}
+
+// 把一个缓冲区中已经提交的记录写进文件 回绕时分两段
+void drainRing(TraceRing* ring) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    if (tail == head) return;
+
+    uint64_t start = tail;
+    while (tail != head) {
+        size_t offset = static_cast<size_t>(tail % CAPACITY);
+        size_t count = std::min(static_cast<size_t>(head - tail), CAPACITY - offset);
+        writeAll(&ring->records[offset], count * sizeof(TraceRecord));
+        tail += count;
+    }
+    recorded.fetch_add(head - start, std::memory_order_relaxed);
+    ring->tail.store(tail, std::memory_order_release);
+}
+
+void drainAll() {
+    for (TraceRing* ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        drainRing(ring);
+    }
+}
+
+void* writerMain(void*) {
+    isWriter = true;
+    while (!writerStop.load(std::memory_order_acquire)) {
+        drainAll();
+        std::this_thread::sleep_for(FLUSH_INTERVAL);
+    }
+    return nullptr;
+}
+
+} // namespace
+
+bool TraceRecorder::start(const char* path) {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    if (isRunning()) return false;
+
+    std::call_once(ringKeyOnce, [] {
+        pthread_key_create(&ringKey, releaseRing);
+        pthread_atfork(&TraceRecorder::prepareFork, &TraceRecorder::parentAfterFork,
+                       &TraceRecorder::childAfterFork);
+    });
+
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (traceFd < 0) return false;
+
+    TraceHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "POOLTRC", 8);
+    header.version = VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    writeAll(&header, sizeof(header));
+
+    // 上一次 stop 之后才提交的记录不属于这个文件
+    for (TraceRing* ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+    recorded.store(0, std::memory_order_relaxed);
+    stalls.store(0, std::memory_order_relaxed);
+
+    writerStop.store(false, std::memory_order_relaxed);
+    if (pthread_create(&writer, nullptr, writerMain, nullptr) != 0) {
+        close(traceFd);
+        traceFd = -1;
+        return false;
+    }
+    running_.store(true, std::memory_order_release);
+    return true;
+}
+
+void TraceRecorder::stop() {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    if (!isRunning()) return;
+
+    running_.store(false, std::memory_order_relaxed);
+    writerStop.store(true, std::memory_order_release);
+    pthread_join(writer, nullptr);
+
+    // 后台线程已经退出 剩下的由这里写出
+    drainAll();
+    close(traceFd);
+    traceFd = -1;
+}
+
+// fork 时不能有别的线程正拿着 controlMutex
+void TraceRecorder::prepareFork() {
+    controlMutex.lock();
+}
+
+void TraceRecorder::parentAfterFork() {
+    controlMutex.unlock();
+}
+
+// 子进程中后台线程并不存在 不再记录 之后的 stop 直接返回 不会去 join 它
+// 文件和父进程共用 缓冲区中剩下的记录由父进程写出
+void TraceRecorder::childAfterFork() {
+    if (isRunning()) {
+        close(traceFd);
+        traceFd = -1;
+    }
+    running_.store(false, std::memory_order_relaxed);
+    controlMutex.unlock();
+}
+
+uint64_t TraceRecorder::recordCount() {
+    return recorded.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceRecorder::stallCount() {
+    return stalls.load(std::memory_order_relaxed);
+}
+
+void TraceRecorder::append(TraceOp op, void* ptr, size_t size) {
+    if (isWriter) return;
+
+    TraceRing* ring = currentRing;
+    if (ring == nullptr && (ring = claimRing()) == nullptr) return;
+
+    // 后台线程跟不上 等它取走一部分 停止记录时放弃这一条
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= CAPACITY) {
+        stalls.fetch_add(1, std::memory_order_relaxed);
+        while (head - ring->tail.load(std::memory_order_acquire) >= CAPACITY) {
+            if (!isRunning()) return;
+            sched_yield();
+        }
+    }
+
+    TraceRecord& record = ring->records[head % CAPACITY];
+    record.timestamp = now();
+    record.ptr = reinterpret_cast<uint64_t>(ptr);
+    record.size = static_cast<uint32_t>(std::min<size_t>(size, UINT32_MAX));
+    record.thread = ring->thread;
+    record.op = op;
+    record.reserved = 0;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+} // namespace Pool
@@ -0,0 +1,168 @@
+// PoolAllocator / PoolResource 的正确性检查 以及和 std::allocator 的对比
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MemoryPool.h"
+#include "PoolAllocator.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+// map 插入删除反复进行
+template<typename Map>
+long map_churn(Map& m) {
+    const int nkeys = 10000;
+    const int nrounds = 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < nrounds; ++round) {
+        for (int i = 0; i < nkeys; ++i) {
+            m.emplace((i * 7919 + round) % (nkeys * 2), i);
+        }
+        for (int i = 0; i < nkeys; ++i) {
+            m.erase((i * 104729 + round) % (nkeys * 2));
+        }
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void map_churn_test() {
+    std::cout << "=== map 插入删除 ===" << std::endl;
+
+    using Alloc = Pool::PoolAllocator<std::pair<const int, int>>;
+    std::map<int, int> stdMap;
+    std::map<int, int, std::less<int>, Alloc> poolMap;
+    std::pmr::map<int, int> pmrMap(Pool::PoolResource::getInstance());
+
+    std::cout << "std::map + std::allocator: " << map_churn(stdMap) << " ms" << std::endl;
+    std::cout << "std::map + PoolAllocator: " << map_churn(poolMap) << " ms" << std::endl;
+    std::cout << "std::pmr::map + PoolResource: " << map_churn(pmrMap) << " ms" << std::endl;
+
+    CHECK((stdMap == std::map<int, int>(poolMap.begin(), poolMap.end())));
+    CHECK((stdMap == std::map<int, int>(pmrMap.begin(), pmrMap.end())));
+}
+
+void container_test() {
+    std::cout << "=== 其他容器 ===" << std::endl;
+
+    std::unordered_map<int, std::string, std::hash<int>, std::equal_to<int>,
+                       Pool::PoolAllocator<std::pair<const int, std::string>>> hashMap;
+    std::list<int, Pool::PoolAllocator<int>> list;
+    std::vector<double, Pool::PoolAllocator<double>> vec;  // 长大之后超过 MAX_BYTES
+    std::pmr::vector<std::pmr::string> strings(Pool::PoolResource::getInstance());
+
+    for (int i = 0; i < 100000; ++i) {
+        hashMap[i] = std::string(i % 50, 'a');
+        list.push_back(i);
+        vec.push_back(i);
+        strings.emplace_back(i % 100, 'b');
+    }
+    for (int i = 0; i < 100000; i += 2) {
+        hashMap.erase(i);
+    }
+
+    CHECK(hashMap.size() == 50000);
+    CHECK(hashMap[99].size() == 49);
+    CHECK(list.size() == 100000 && list.back() == 99999);
+    CHECK(vec[99999] == 99999);
+    CHECK(strings[250] == std::pmr::string(50, 'b'));
+}
+
+// 对齐要求超过 8 的类型
+void aligned_test() {
+    std::cout << "=== 对齐 ===" << std::endl;
+
+    struct alignas(64) Aligned { char data[72]; };
+    std::vector<Aligned*> objs;
+    Pool::PoolAllocator<Aligned> alloc;
+    for (int i = 0; i < 1000; ++i) {
+        objs.push_back(alloc.allocate(1 + i % 3));
+        CHECK(reinterpret_cast<uintptr_t>(objs.back()) % 64 == 0);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        alloc.deallocate(objs[i], 1 + i % 3);
+    }
+
+    auto* resource = Pool::PoolResource::getInstance();
+    for (size_t align = 8; align <= 8192; align *= 2) {
+        void* p = resource->allocate(100, align);
+        CHECK(reinterpret_cast<uintptr_t>(p) % align == 0);
+        resource->deallocate(p, 100, align);
+    }
+}
+
+// 300KB ~ 16MB 的缓冲区反复申请释放 每页写一个字节
+template<typename Alloc, typename Free>
+long buffer_churn(Alloc alloc, Free release) {
+    const size_t sizes[] = {300 << 10, 1 << 20, 700 << 10, 4 << 20, 16 << 20, 2 << 20};
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < 500; ++round) {
+        size_t size = sizes[round % 6];
+        auto* p = static_cast<char*>(alloc(size));
+        for (size_t offset = 0; offset < size; offset += 4096) {
+            p[offset] = static_cast<char>(round);
+        }
+        release(p, size);
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void large_buffer_test() {
+    std::cout << "=== 大块缓冲区 ===" << std::endl;
+
+    long mallocTime = buffer_churn([](size_t size) { return malloc(size); },
+                                   [](void* p, size_t) { free(p); });
+    long poolTime = buffer_churn([](size_t size) { return Pool::MemoryPool::allocate(size); },
+                                 [](void* p, size_t size) { Pool::MemoryPool::deallocate(p, size); });
+    std::cout << "malloc: " << mallocTime << " ms, MemoryPool: " << poolTime << " ms" << std::endl;
+
+    // 不知道大小的释放 以及页对齐
+    void* p = Pool::MemoryPool::allocate(Pool::MAX_BYTES + 1);
+    CHECK(reinterpret_cast<uintptr_t>(p) % 4096 == 0);
+    std::memset(p, 1, Pool::MAX_BYTES + 1);
+    Pool::MemoryPool::deallocate(p);
+
+    // 按页取整会回绕的大小直接失败 不能变成 0 页的 span 和之后的申请重叠
+    for (size_t size : {SIZE_MAX, SIZE_MAX - 100, SIZE_MAX - 5000, size_t(PTRDIFF_MAX) + 1}) {
+        CHECK(Pool::MemoryPool::allocate(size) == nullptr);
+    }
+    char* a = static_cast<char*>(Pool::MemoryPool::allocate(Pool::MAX_BYTES + 1));
+    char* b = static_cast<char*>(Pool::MemoryPool::allocate(Pool::MAX_BYTES + 1));
+    CHECK(a && b && (a + Pool::MAX_BYTES < b || b + Pool::MAX_BYTES < a));
+    Pool::MemoryPool::deallocate(a);
+    Pool::MemoryPool::deallocate(b);
+
+    std::vector<char, Pool::PoolAllocator<char>> big(8 << 20, 'x');
+    CHECK(big.back() == 'x');
+}
+
+int main() {
+    map_churn_test();
+    container_test();
+    aligned_test();
+    large_buffer_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Arena 的检查点 / 回滚 / reset 以及和逐个分配释放的对比
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Arena.h"
+#include "MemoryPool.h"
+#include "PageCache.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+struct Message {
+    int     id;
+    double  value;
+    char    payload[40];
+};
+
+void checkpoint_test() {
+    std::cout << "=== 检查点与回滚 ===" << std::endl;
+
+    Pool::Arena arena;
+    std::vector<Message*> kept;
+    for (int i = 0; i < 1000; ++i) {
+        kept.push_back(arena.create<Message>(Message{i, i * 0.5, {}}));
+    }
+    size_t spans = arena.spanCount();
+
+    // 嵌套检查点 内层回滚之后外层仍然有效
+    auto outer = arena.checkpoint();
+    for (int i = 0; i < 5000; ++i) {
+        std::memset(arena.allocate(100), 0xab, 100);
+    }
+    auto inner = arena.checkpoint();
+    void* big = arena.allocate(1 << 20);  // 单独占一个 span
+    std::memset(big, 0xcd, 1 << 20);
+    arena.rollback(inner);
+    void* again = arena.allocate(64);
+    CHECK(again != nullptr);
+    arena.rollback(outer);
+    CHECK(arena.spanCount() == spans);
+
+    for (int i = 0; i < 1000; ++i) {
+        CHECK(kept[i]->id == i && kept[i]->value == i * 0.5);
+    }
+
+    // 各种对齐
+    for (size_t align = 1; align <= 4096; align *= 2) {
+        void* p = arena.allocate(align * 3, align);
+        CHECK(reinterpret_cast<uintptr_t>(p) % align == 0);
+    }
+
+    arena.reset();
+    CHECK(arena.spanCount() == 0);
+}
+
+// 每个请求分配上千个小对象 处理完整体释放
+void request_benchmark() {
+    std::cout << "=== 请求内的临时对象 ===" << std::endl;
+    const int nrequests = 2000;
+    const int nobjects = 2000;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<void*> objs(nobjects);
+    for (int r = 0; r < nrequests; ++r) {
+        for (int i = 0; i < nobjects; ++i) {
+            objs[i] = Pool::MemoryPool::allocate(sizeof(Message));
+        }
+        for (int i = 0; i < nobjects; ++i) {
+            Pool::MemoryPool::deallocate(objs[i], sizeof(Message));
+        }
+    }
+    auto poolTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    Pool::Arena arena;
+    for (int r = 0; r < nrequests; ++r) {
+        for (int i = 0; i < nobjects; ++i) {
+            objs[i] = arena.create<Message>();
+        }
+        arena.reset();
+    }
+    auto arenaTime = std::chrono::steady_clock::now() - start;
+
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    std::cout << "MemoryPool 逐个分配释放: " << duration_cast<milliseconds>(poolTime).count() << " ms" << std::endl;
+    std::cout << "Arena + reset: " << duration_cast<milliseconds>(arenaTime).count() << " ms" << std::endl;
+}
+
+// 多个线程各自使用自己的 Arena 线程退出时备用 span 归还 PageCache
+void thread_test() {
+    std::cout << "=== 多线程 ===" << std::endl;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([t] {
+            Pool::Arena arena;
+            for (int round = 0; round < 200; ++round) {
+                std::vector<int*> ints;
+                for (int i = 0; i < 3000; ++i) {
+                    ints.push_back(arena.create<int>(t * 100000 + i));
+                }
+                for (int i = 0; i < 3000; ++i) {
+                    CHECK(*ints[i] == t * 100000 + i);
+                }
+                arena.reset();
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+}
+
+static size_t pageCacheFreeBytes() {
+    return Pool::getStats().pageCacheFreeBytes;
+}
+
+// 备用 span 不限于默认大小 但有字节数上限 空闲线程的备用 span 可以还给 PageCache
+void spare_test() {
+    std::cout << "=== 备用 span ===" << std::endl;
+    const size_t big = 300 * 1024;
+    const size_t huge = 3 * 1024 * 1024;
+    Pool::Arena arena;
+
+    // 之前的测试留下的先全部放掉
+    Pool::Arena::releaseSpareSpans();
+    Pool::Arena::releaseSpareSpans();
+
+    // 检查点之后的大 span 留在本线程 下次同样的申请直接复用
+    void* first = arena.allocate(big);
+    size_t bigBytes = Pool::PageCache::getSpan(first)->numPages * Pool::PageCache::PAGE_SIZE;
+    size_t before = pageCacheFreeBytes();
+    arena.reset();
+    CHECK(pageCacheFreeBytes() == before);
+    CHECK(arena.allocate(big) == first);
+
+    // 两个 3MB 的 span 超过上限 后还回去的那个直接回到 PageCache
+    Pool::Arena::Checkpoint checkpoint = arena.checkpoint();
+    void* a = arena.allocate(huge);
+    void* b = arena.allocate(huge);
+    size_t bytesA = Pool::PageCache::getSpan(a)->numPages * Pool::PageCache::PAGE_SIZE;
+    size_t bytesB = Pool::PageCache::getSpan(b)->numPages * Pool::PageCache::PAGE_SIZE;
+    before = pageCacheFreeBytes();
+    arena.rollback(checkpoint);
+    CHECK(pageCacheFreeBytes() == before + bytesA);
+    arena.reset();
+    CHECK(pageCacheFreeBytes() == before + bytesA);
+
+    // 第一次只是清掉使用标记 第二次仍然没有用过才释放
+    CHECK(Pool::Arena::releaseSpareSpans() == 0);
+    CHECK(Pool::Arena::releaseSpareSpans() == bigBytes + bytesB);
+    CHECK(pageCacheFreeBytes() == before + bytesA + bigBytes + bytesB);
+}
+
+int main() {
+    checkpoint_test();
+    request_benchmark();
+    thread_test();
+    spare_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,159 @@
+// 每个 CPU 一份的前端缓存 (rseq)
+// 内核或者 glibc 不支持 rseq 时 enable 返回 false 跳过
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "CpuCache.h"
+#include "MemoryPool.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static long long churn(int rounds) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<void*> ptrs(256);
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < ptrs.size(); ++i) {
+            ptrs[i] = Pool::MemoryPool::allocate(16 + (i % 16) * 16);
+        }
+        for (size_t i = 0; i < ptrs.size(); ++i) {
+            Pool::MemoryPool::deallocate(ptrs[i], 16 + (i % 16) * 16);
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+// 多线程随机大小 写入后检查内容 一半交给另一个线程释放
+void stress_test() {
+    std::cout << "=== 多线程随机分配 ===" << std::endl;
+    const int nthreads = 16;
+    std::vector<std::vector<std::pair<unsigned char*, size_t>>> handoff(nthreads);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([t, &handoff] {
+            std::mt19937 rng(t);
+            std::vector<std::pair<unsigned char*, size_t>> live;
+            for (int i = 0; i < 50000; ++i) {
+                if (live.empty() || rng() % 3 != 0) {
+                    size_t size = 1 + rng() % 2048;
+                    auto* p = static_cast<unsigned char*>(Pool::MemoryPool::allocate(size));
+                    std::memset(p, static_cast<unsigned char>(size), size);
+                    live.push_back({p, size});
+                } else {
+                    size_t k = rng() % live.size();
+                    auto [p, size] = live[k];
+                    CHECK(p[0] == static_cast<unsigned char>(size) && p[size - 1] == p[0]);
+                    Pool::MemoryPool::deallocate(p, size);
+                    live[k] = live.back();
+                    live.pop_back();
+                }
+            }
+            handoff[t] = std::move(live);
+        });
+    }
+    for (auto& t : threads) t.join();
+    threads.clear();
+
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([t, &handoff] {
+            for (auto [p, size] : handoff[(t + 1) % nthreads]) {
+                CHECK(p[0] == static_cast<unsigned char>(size));
+                // 一半走不知道大小的路径
+                if (size % 2) {
+                    Pool::MemoryPool::deallocate(p);
+                } else {
+                    Pool::MemoryPool::deallocate(p, size);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+}
+
+// 超过 MAX_BYTES 的申请不经过 slab
+void large_test() {
+    std::cout << "=== 大块 ===" << std::endl;
+    void* p = Pool::MemoryPool::allocate(Pool::MAX_BYTES + 1);
+    CHECK(p != nullptr);
+    std::memset(p, 1, Pool::MAX_BYTES + 1);
+    Pool::MemoryPool::deallocate(p, Pool::MAX_BYTES + 1);
+}
+
+static size_t cpuCachedBytes() {
+    return Pool::getStats().cpuCachedBytes;
+}
+
+// slab 里缓存的块可以还给 CentralCache 空闲的 CPU 由 reclaimIdleCaches 分两次清空
+void drain_test() {
+    std::cout << "=== 清空 slab ===" << std::endl;
+    churn(10);
+    size_t cached = cpuCachedBytes();
+    CHECK(cached > 0);
+    CHECK(Pool::CpuCache::drain() == cached);
+    CHECK(cpuCachedBytes() == 0);
+
+    // 清空之后照常分配
+    churn(10);
+    CHECK(cpuCachedBytes() > 0);
+
+    // 第一次只记下计数 第二次仍然没有变化才清空
+    Pool::ThreadCache::reclaimIdleCaches();
+    cached = cpuCachedBytes();
+    CHECK(cached > 0);
+    CHECK(Pool::ThreadCache::reclaimIdleCaches() >= cached);
+    CHECK(cpuCachedBytes() == 0);
+
+    // 两次之间有分配释放 计数变了 不清空
+    churn(10);
+    Pool::ThreadCache::reclaimIdleCaches();
+    void* p = Pool::MemoryPool::allocate(16);
+    Pool::ThreadCache::reclaimIdleCaches();
+    CHECK(cpuCachedBytes() > 0);
+    Pool::MemoryPool::deallocate(p, 16);
+}
+
+int main() {
+    // 切换之前由 ThreadCache 分配的块 切换之后释放
+    std::vector<void*> before;
+    for (int i = 0; i < 1000; ++i) {
+        before.push_back(Pool::MemoryPool::allocate(64));
+    }
+    long long threadCacheTime = churn(20000);
+
+    if (!Pool::CpuCache::enable()) {
+        std::cout << "不支持 rseq 跳过" << std::endl;
+        return 0;
+    }
+    CHECK(Pool::CpuCache::isActive());
+
+    for (void* p : before) {
+        Pool::MemoryPool::deallocate(p, 64);
+    }
+    long long cpuCacheTime = churn(20000);
+    std::cout << "ThreadCache: " << threadCacheTime << " ms, CpuCache: " << cpuCacheTime << " ms" << std::endl;
+
+    stress_test();
+    large_test();
+    drain_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
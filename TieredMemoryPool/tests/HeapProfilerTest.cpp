@@ -0,0 +1,116 @@
+// 采样的堆分析器
+// 一个调用点一直持有内存 另一个调用点分配之后马上释放
+// 存活的分析结果中只应该有前者 并且按采样还原的字节数和实际的相差不大
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "HeapProfiler.h"
+#include "MemoryPool.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t BLOCK = 1024;
+static const size_t HELD_BYTES = 32 * 1024 * 1024;
+
+// 符号需要能被 dladdr 找到 不能是 static 也不能被内联
+__attribute__((noinline)) void holdingSite(std::vector<void*>& held) {
+    for (size_t i = 0; i < HELD_BYTES / BLOCK; ++i) {
+        held.push_back(Pool::MemoryPool::allocate(BLOCK));
+    }
+}
+
+__attribute__((noinline)) void churningSite() {
+    for (size_t i = 0; i < HELD_BYTES / BLOCK; ++i) {
+        Pool::MemoryPool::deallocate(Pool::MemoryPool::allocate(BLOCK), BLOCK);
+    }
+}
+
+static std::string dumpToString(Pool::ProfileFormat format, bool cumulative) {
+    char* buf = nullptr;
+    size_t len = 0;
+    FILE* out = open_memstream(&buf, &len);
+    Pool::HeapProfiler::dump(out, format, cumulative);
+    fclose(out);
+    std::string result(buf, len);
+    free(buf);
+    return result;
+}
+
+// 折叠栈中包含 site 的那些行的字节数之和
+static double bytesAt(const std::string& folded, const std::string& site) {
+    double total = 0;
+    size_t pos = 0;
+    while (pos < folded.size()) {
+        size_t end = folded.find('\n', pos);
+        if (end == std::string::npos) end = folded.size();
+        std::string line = folded.substr(pos, end - pos);
+        if (line.find(site) != std::string::npos) {
+            total += std::stod(line.substr(line.rfind(' ') + 1));
+        }
+        pos = end + 1;
+    }
+    return total;
+}
+
+static long long allocLoop() {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<void*> ptrs(256);
+    for (int round = 0; round < 20000; ++round) {
+        for (size_t i = 0; i < ptrs.size(); ++i) ptrs[i] = Pool::MemoryPool::allocate(16 + (i % 16) * 16);
+        for (size_t i = 0; i < ptrs.size(); ++i) Pool::MemoryPool::deallocate(ptrs[i], 16 + (i % 16) * 16);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+void live_profile_test() {
+    std::cout << "=== 存活的分配 ===" << std::endl;
+    std::vector<void*> held;
+    holdingSite(held);
+    churningSite();
+
+    std::string live = dumpToString(Pool::ProfileFormat::Folded, false);
+    double heldBytes = bytesAt(live, "holdingSite");
+    std::cout << "holdingSite 估计 " << heldBytes / 1024 / 1024 << " MB / 实际 " << HELD_BYTES / 1024 / 1024 << " MB" << std::endl;
+    CHECK(heldBytes > HELD_BYTES * 0.7 && heldBytes < HELD_BYTES * 1.3);
+    CHECK(bytesAt(live, "churningSite") == 0);
+
+    std::string cumulative = dumpToString(Pool::ProfileFormat::Folded, true);
+    CHECK(bytesAt(cumulative, "churningSite") > HELD_BYTES * 0.7);
+
+    std::string pprof = dumpToString(Pool::ProfileFormat::Pprof, false);
+    CHECK(pprof.compare(0, 13, "heap profile:") == 0);
+    CHECK(pprof.find("@ heap_v2/") != std::string::npos);
+    CHECK(pprof.find("MAPPED_LIBRARIES:") != std::string::npos);
+
+    for (void* p : held) Pool::MemoryPool::deallocate(p, BLOCK);
+    CHECK(bytesAt(dumpToString(Pool::ProfileFormat::Folded, false), "holdingSite") == 0);
+}
+
+int main() {
+    long long off = allocLoop();
+    Pool::HeapProfiler::start(64 * 1024);
+    long long on = allocLoop();
+    std::cout << "关闭分析器: " << off << " ms, 打开 (64KB 采样一次): " << on << " ms" << std::endl;
+
+    live_profile_test();
+    Pool::HeapProfiler::stop();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,143 @@
+// arena 与大页
+// span 从按 2M 对齐的 arena 中顺序切分 特别大的请求单独映射 释放之后整个映射都能再用上
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "PageCache.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t PAGE = Pool::PageCache::PAGE_SIZE;
+static const size_t HUGE_PAGE = Pool::PageCache::HUGE_PAGE_SIZE;
+
+// 内核没有透明大页时 smaps 里不会有 hg 标记 跳过这部分检查
+static bool hasTransparentHugePages() {
+    return std::ifstream("/sys/kernel/mm/transparent_hugepage/enabled").good();
+}
+
+// addr 所在映射的 VmFlags 中有没有 hg (madvise(MADV_HUGEPAGE))
+static bool markedHugePage(void* addr) {
+    std::ifstream smaps("/proc/self/smaps");
+    uintptr_t target = reinterpret_cast<uintptr_t>(addr);
+    bool inside = false;
+    std::string line;
+    while (std::getline(smaps, line)) {
+        unsigned long start, end;
+        if (std::sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+            inside = start <= target && target < end;
+        } else if (inside && line.compare(0, 8, "VmFlags:") == 0) {
+            std::istringstream flags(line.substr(8));
+            std::string flag;
+            while (flags >> flag) {
+                if (flag == "hg") return true;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+void arena_test() {
+    std::cout << "=== arena 切分 ===" << std::endl;
+    Pool::PageCache& pageCache = Pool::PageCache::getInstance();
+    Pool::PoolStats before = Pool::getStats();
+
+    // 第一次申请预留整个 arena 起始地址按大页对齐
+    char* first = static_cast<char*>(pageCache.allocateSpan(8));
+    CHECK(reinterpret_cast<uintptr_t>(first) % HUGE_PAGE == 0);
+    Pool::PoolStats after = Pool::getStats();
+    CHECK(after.mappedBytes == before.mappedBytes + Pool::PageCache::ARENA_SIZE);
+    CHECK(after.arenaUnusedBytes == Pool::PageCache::ARENA_SIZE - 8 * PAGE);
+
+    // 之后只是移动指针 不再映射
+    char* second = static_cast<char*>(pageCache.allocateSpan(24));
+    CHECK(second == first + 8 * PAGE);
+    CHECK(Pool::getStats().mappedBytes == after.mappedBytes);
+    CHECK(Pool::getStats().arenaUnusedBytes == Pool::PageCache::ARENA_SIZE - 32 * PAGE);
+
+    // 新映射的页本来就是零
+    CHECK(first[0] == 0 && second[24 * PAGE - 1] == 0);
+    if (hasTransparentHugePages()) {
+        CHECK(markedHugePage(first));
+    }
+
+    pageCache.deallocateSpan(second, 24);
+    pageCache.deallocateSpan(first, 8);
+}
+
+// 超过 ARENA_SIZE / 8 的请求单独映射 按大页取整 整个映射都记在 span 上
+void huge_test() {
+    std::cout << "=== 单独映射 ===" << std::endl;
+    Pool::PageCache& pageCache = Pool::PageCache::getInstance();
+    size_t numPages = (129 << 20) / PAGE + 1;
+    size_t mapped = 130 << 20;
+
+    Pool::PoolStats before = Pool::getStats();
+    char* ptr = static_cast<char*>(pageCache.allocateSpan(numPages));
+    CHECK(ptr != nullptr);
+    CHECK(reinterpret_cast<uintptr_t>(ptr) % HUGE_PAGE == 0);
+    Pool::Span* span = Pool::PageCache::getSpan(ptr);
+    CHECK(span->numPages * PAGE == mapped);
+    CHECK(Pool::PageCache::getSpan(ptr + mapped - 1) == span);
+    CHECK(Pool::getStats().mappedBytes == before.mappedBytes + mapped);
+
+    // 写一下首尾 释放之后整个映射都回到空闲 span 中
+    ptr[0] = 1;
+    ptr[mapped - 1] = 1;
+    pageCache.deallocateSpan(ptr, span->numPages, true);
+    Pool::PoolStats freed = Pool::getStats();
+    CHECK(freed.pageCacheFreeBytes == before.pageCacheFreeBytes + mapped);
+
+    // 同样的请求用回原来的映射 不再 mmap
+    char* again = static_cast<char*>(pageCache.allocateSpan(numPages));
+    CHECK(again == ptr);
+    CHECK(Pool::getStats().mappedBytes == before.mappedBytes + mapped);
+    CHECK(again[0] == 0);
+    pageCache.deallocateSpan(again, Pool::PageCache::getSpan(again)->numPages, true);
+}
+
+// 关闭大页之后新的映射不再 madvise(MADV_HUGEPAGE)
+void policy_test() {
+    std::cout << "=== 大页策略 ===" << std::endl;
+    if (!hasTransparentHugePages()) return;
+    Pool::PageCache& pageCache = Pool::PageCache::getInstance();
+    size_t numPages = (200 << 20) / PAGE;
+
+    Pool::PageCache::setHugePagePolicy(Pool::HugePagePolicy::None);
+    void* plain = pageCache.allocateSpan(numPages);
+    CHECK(!markedHugePage(plain));
+
+    Pool::PageCache::setHugePagePolicy(Pool::HugePagePolicy::Transparent);
+    void* huge = pageCache.allocateSpan(numPages);
+    CHECK(markedHugePage(huge));
+
+    pageCache.deallocateSpan(plain, numPages, true);
+    pageCache.deallocateSpan(huge, numPages, true);
+}
+
+int main() {
+    arena_test();
+    huge_test();
+    policy_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
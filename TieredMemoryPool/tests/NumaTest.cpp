@@ -0,0 +1,117 @@
+// 在单节点的机器上模拟 4 个 NUMA 节点
+// 检查每个线程拿到的都是本节点的内存 跨节点释放的块和 span 都回到所属的节点
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "CentralCache.h"
+#include "MemoryPool.h"
+#include "Numa.h"
+#include "PageCache.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t NODES = 4;
+static const size_t SIZES[] = {8, 64, 200, 1024, 5000, 40000};
+
+static size_t nodeOf(void* ptr) {
+    return Pool::PageCache::getSpan(ptr)->node;
+}
+
+struct Allocation {
+    void*   ptr;
+    size_t  size;
+};
+
+static std::vector<Allocation> allocateOnNode(size_t node, size_t count) {
+    std::vector<Allocation> result;
+    for (size_t i = 0; i < count; ++i) {
+        size_t size = SIZES[i % (sizeof(SIZES) / sizeof(SIZES[0]))];
+        void* p = Pool::MemoryPool::allocate(size);
+        CHECK(p != nullptr && nodeOf(p) == node);
+        result.push_back({p, size});
+    }
+    return result;
+}
+
+// 每个节点的线程分配 交给下一个节点的线程释放
+// 释放的线程退出时 线程缓存里别的节点的块必须按节点拆开归还
+// 之后每个节点的新线程再分配 拿到的仍然只有本节点的块
+void cross_node_free_test() {
+    std::cout << "=== 跨节点释放 ===" << std::endl;
+    std::vector<std::vector<Allocation>> allocations(NODES);
+
+    std::vector<std::thread> threads;
+    for (size_t node = 0; node < NODES; ++node) {
+        threads.emplace_back([&, node] {
+            Pool::Numa::setThreadNode(node);
+            CHECK(Pool::Numa::currentNode() == node);
+            allocations[node] = allocateOnNode(node, 20000);
+        });
+    }
+    for (auto& t : threads) t.join();
+    threads.clear();
+
+    for (size_t node = 0; node < NODES; ++node) {
+        threads.emplace_back([&, node] {
+            Pool::Numa::setThreadNode(node);
+            for (auto& a : allocations[(node + 1) % NODES]) {
+                Pool::MemoryPool::deallocate(a.ptr, a.size);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    threads.clear();
+
+    for (size_t round = 0; round < 3; ++round) {
+        for (size_t node = 0; node < NODES; ++node) {
+            threads.emplace_back([node] {
+                Pool::Numa::setThreadNode(node);
+                for (auto& a : allocateOnNode(node, 20000)) {
+                    Pool::MemoryPool::deallocate(a.ptr, a.size);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        threads.clear();
+    }
+}
+
+// 整个 span 在另一个节点上释放 回到所属节点的空闲索引
+void span_routing_test() {
+    std::cout << "=== span 送回所属节点 ===" << std::endl;
+    const size_t pages = 64;
+
+    Pool::Numa::setThreadNode(1);
+    void* span = Pool::PageCache::getInstance().allocateSpan(pages);
+    CHECK(span != nullptr && nodeOf(span) == 1);
+    size_t before = Pool::PageCache::getInstance(1).getFreeResidentBytes();
+
+    Pool::Numa::setThreadNode(2);
+    Pool::PageCache::getInstance().deallocateSpan(span, pages);
+    CHECK(Pool::PageCache::getInstance(1).getFreeResidentBytes() >= before + pages * Pool::PageCache::PAGE_SIZE);
+}
+
+int main() {
+    // 必须在第一次分配之前
+    Pool::Numa::setSimulatedNodes(NODES);
+    CHECK(Pool::Numa::isSimulated() && Pool::Numa::numNodes() == NODES);
+
+    cross_node_free_test();
+    span_routing_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,262 @@
+// 通过 LD_PRELOAD=libtieredpool.so 运行
+// 程序本身只使用 malloc/free/new/delete 不知道内存池的存在
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <string>
+#include <map>
+#include <set>
+#include <atomic>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <new>
+#include <dlfcn.h>
+#include <malloc.h>
+
+extern "C" void* __libc_malloc(size_t size);
+
+static std::atomic<bool> failed{false};
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed.store(true); \
+        } \
+    } while (0)
+
+// 确认 malloc 确实来自 libtieredpool.so
+bool preload_check() {
+    Dl_info info;
+    void* sym = dlsym(RTLD_DEFAULT, "malloc");
+    if (!sym || !dladdr(sym, &info) || !info.dli_fname) {
+        return false;
+    }
+    std::cout << "malloc 来自: " << info.dli_fname << std::endl;
+    return std::strstr(info.dli_fname, "libtieredpool") != nullptr;
+}
+
+// 用指针本身作为填充内容 释放前检查有没有被别人覆盖
+void fill(void* p, size_t size) {
+    std::memset(p, static_cast<unsigned char>(reinterpret_cast<uintptr_t>(p) >> 4), size);
+}
+
+bool verify(void* p, size_t size) {
+    auto* bytes = static_cast<unsigned char*>(p);
+    unsigned char expected = static_cast<unsigned char>(reinterpret_cast<uintptr_t>(p) >> 4);
+    for (size_t i = 0; i < size; ++i) {
+        if (bytes[i] != expected) return false;
+    }
+    return true;
+}
+
+// malloc / calloc / realloc / 对齐分配 混合使用
+void malloc_family_worker(int seed) {
+    std::mt19937 rng(seed);
+    std::vector<std::pair<void*, size_t>> live;
+
+    for (int i = 0; i < 20000; ++i) {
+        if (live.empty() || rng() % 3 != 0) {
+            size_t size = 1 + rng() % 2048;
+            if (rng() % 64 == 0) size = 1 + rng() % (512 * 1024);
+
+            void* p = nullptr;
+            switch (rng() % 4) {
+            case 0:
+                p = malloc(size);
+                CHECK(reinterpret_cast<uintptr_t>(p) % 16 == 0);
+                break;
+            case 1:
+                p = calloc(1, size);
+                for (size_t k = 0; k < size; ++k) {
+                    if (static_cast<unsigned char*>(p)[k] != 0) {
+                        CHECK(!"calloc 返回的内存没有清零");
+                        break;
+                    }
+                }
+                break;
+            case 2: {
+                size_t align = size_t(32) << (rng() % 7);
+                CHECK(posix_memalign(&p, align, size) == 0);
+                CHECK(reinterpret_cast<uintptr_t>(p) % align == 0);
+                break;
+            }
+            default: {
+                size_t align = 64;
+                p = aligned_alloc(align, (size + align - 1) / align * align);
+                CHECK(reinterpret_cast<uintptr_t>(p) % align == 0);
+                break;
+            }
+            }
+
+            CHECK(p != nullptr);
+            CHECK(malloc_usable_size(p) >= size);
+            fill(p, size);
+            live.emplace_back(p, size);
+        } else {
+            size_t idx = rng() % live.size();
+            auto [p, size] = live[idx];
+            CHECK(verify(p, size));
+
+            if (rng() % 2) {
+                // realloc 之后原来的内容要保留
+                size_t newSize = 1 + rng() % 4096;
+                void* q = realloc(p, newSize);
+                CHECK(q != nullptr);
+                unsigned char expected = static_cast<unsigned char>(reinterpret_cast<uintptr_t>(p) >> 4);
+                for (size_t k = 0; k < std::min(size, newSize); ++k) {
+                    if (static_cast<unsigned char*>(q)[k] != expected) {
+                        CHECK(!"realloc 没有保留原来的内容");
+                        break;
+                    }
+                }
+                fill(q, newSize);
+                live[idx] = {q, newSize};
+            } else {
+                free(p);
+                live[idx] = live.back();
+                live.pop_back();
+            }
+        }
+    }
+
+    for (auto& [p, size] : live) {
+        CHECK(verify(p, size));
+        free(p);
+    }
+}
+
+// STL 容器走 operator new/delete (包括 sized delete)
+void stl_worker(int seed) {
+    std::map<int, std::string> m;
+    for (int i = 0; i < 20000; ++i) {
+        m[(i * 7919 + seed) % 5000] = std::string(i % 100, 'a' + i % 26);
+        if (i % 3 == 0) m.erase((i * 31) % 5000);
+    }
+    for (auto& [k, v] : m) {
+        for (char c : v) {
+            CHECK(c >= 'a' && c <= 'z');
+        }
+        (void)k;
+    }
+
+    struct alignas(64) Aligned { char data[64]; };
+    std::vector<Aligned*> objs;
+    for (int i = 0; i < 1000; ++i) {
+        objs.push_back(new Aligned);
+        CHECK(reinterpret_cast<uintptr_t>(objs.back()) % 64 == 0);
+    }
+    for (auto* p : objs) delete p;
+}
+
+void multithread_test() {
+    std::cout << "=== 多线程 malloc/new 测试 ===" << std::endl;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back(malloc_family_worker, i);
+        threads.emplace_back(stl_worker, i);
+    }
+    for (auto& t : threads) t.join();
+}
+
+// 大量短命线程 检查线程退出时不会出错
+void short_lived_thread_test() {
+    std::cout << "=== 短命线程测试 ===" << std::endl;
+    for (int round = 0; round < 20; ++round) {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 8; ++i) {
+            threads.emplace_back([i] {
+                std::vector<std::string> v;
+                for (int k = 0; k < 200; ++k) {
+                    v.emplace_back(k + i, 'x');
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+    }
+}
+
+// glibc 分配的内存用 sized delete 释放 (例如内存池重入时创建的对象在外面析构)
+// 要交回 glibc 如果进了内存池的空闲链表 之后同样大小的 new 会拿到这些地址
+void sized_delete_test() {
+    std::cout << "=== sized delete 释放 glibc 的内存 ===" << std::endl;
+    const size_t size = 48;
+
+    std::set<void*> foreign;
+    for (int i = 0; i < 64; ++i) {
+        void* p = __libc_malloc(size);
+        foreign.insert(p);
+        ::operator delete(p, size);
+    }
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 256; ++i) {
+        ptrs.push_back(::operator new(size));
+        CHECK(foreign.count(ptrs.back()) == 0);
+    }
+    for (void* p : ptrs) ::operator delete(p, size);
+}
+
+// 超过 PTRDIFF_MAX 的大小和 glibc 一样返回 nullptr 并设置 errno 不能取整回绕成小块
+// volatile 防止编译器把这些调用直接折叠掉
+void huge_size_test() {
+    std::cout << "=== 超大的申请 ===" << std::endl;
+    volatile size_t huge = SIZE_MAX;
+
+    errno = 0;
+    CHECK(malloc(huge) == nullptr && errno == ENOMEM);
+    errno = 0;
+    CHECK(malloc(huge - 100) == nullptr && errno == ENOMEM);
+    errno = 0;
+    CHECK(malloc(huge / 2 + 1) == nullptr && errno == ENOMEM);
+    // 没有超过 PTRDIFF_MAX 但是映射不出来 同样要设置 errno
+    errno = 0;
+    CHECK(malloc(huge / 2) == nullptr && errno == ENOMEM);
+    errno = 0;
+    CHECK(calloc(1, huge - 8) == nullptr && errno == ENOMEM);
+    errno = 0;
+    CHECK(aligned_alloc(64, huge - 63) == nullptr && errno == ENOMEM);
+    void* aligned = nullptr;
+    CHECK(posix_memalign(&aligned, 64, huge) == ENOMEM && aligned == nullptr);
+
+    // 失败的 realloc 不动原来的块
+    // 经过 volatile 读回来 编译器不知道它就是传给 realloc 的指针 不会误报 use-after-free
+    char* volatile p = static_cast<char*>(malloc(32));
+    std::memset(p, 'x', 32);
+    errno = 0;
+    CHECK(realloc(p, huge) == nullptr && errno == ENOMEM);
+    CHECK(p[0] == 'x' && p[31] == 'x');
+    free(p);
+
+    bool thrown = false;
+    try {
+        char* q = new char[huge - 1];
+        delete[] q;
+    } catch (const std::bad_alloc&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(operator new(huge, std::nothrow) == nullptr);
+}
+
+int main() {
+    if (!preload_check()) {
+        std::cerr << "没有通过 LD_PRELOAD 加载 libtieredpool.so" << std::endl;
+        return 1;
+    }
+
+    multithread_test();
+    short_lived_thread_test();
+    sized_delete_test();
+    huge_size_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
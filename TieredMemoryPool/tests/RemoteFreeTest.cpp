@@ -0,0 +1,289 @@
+// 跨线程释放 (RemoteFree)
+// 生产者线程分配 消费者线程释放 对比关闭和打开 RemoteFree 时的耗时
+// 打开之后消费者释放的块应该回到生产者手里
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "MemoryPool.h"
+#include "PageCache.h"
+#include "RemoteFree.h"
+#include "ThreadCache.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+// 生产者和消费者之间的队列 一次传一批指针
+class BatchQueue {
+public:
+    void push(std::vector<void*> batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return batches_.size() < MAX_BATCHES; });
+        batches_.push_back(std::move(batch));
+        notEmpty_.notify_one();
+    }
+
+    // 所有生产者结束并且队列为空时返回 false
+    bool pop(std::vector<void*>& batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return !batches_.empty() || closed_; });
+        if (batches_.empty()) return false;
+        batch = std::move(batches_.front());
+        batches_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    static const size_t         MAX_BATCHES = 64;
+    std::mutex                  mutex_;
+    std::condition_variable     notEmpty_;
+    std::condition_variable     notFull_;
+    std::deque<std::vector<void*>> batches_;
+    bool                        closed_ = false;
+};
+
+static const size_t SIZES[] = {32, 64, 128, 256, 512};
+static const size_t NUM_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
+
+// 每个生产者分配 batches 批 每批 batchSize 个 写入后交给消费者 消费者检查内容再释放
+static long long pipeline(int producers, int consumers, int batches, size_t batchSize) {
+    auto start = std::chrono::steady_clock::now();
+    BatchQueue queue;
+
+    std::vector<std::thread> consumerThreads;
+    for (int c = 0; c < consumers; ++c) {
+        consumerThreads.emplace_back([&queue] {
+            std::vector<void*> batch;
+            while (queue.pop(batch)) {
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    size_t size = SIZES[i % NUM_SIZES];
+                    auto* p = static_cast<unsigned char*>(batch[i]);
+                    CHECK(p[0] == static_cast<unsigned char>(i) && p[size - 1] == p[0]);
+                    Pool::MemoryPool::deallocate(p, size);
+                }
+            }
+        });
+    }
+
+    std::vector<std::thread> producerThreads;
+    for (int p = 0; p < producers; ++p) {
+        producerThreads.emplace_back([&queue, batches, batchSize] {
+            for (int b = 0; b < batches; ++b) {
+                std::vector<void*> batch(batchSize);
+                for (size_t i = 0; i < batchSize; ++i) {
+                    size_t size = SIZES[i % NUM_SIZES];
+                    batch[i] = Pool::MemoryPool::allocate(size);
+                    std::memset(batch[i], static_cast<unsigned char>(i), size);
+                }
+                queue.push(std::move(batch));
+            }
+        });
+    }
+
+    for (auto& t : producerThreads) t.join();
+    queue.close();
+    for (auto& t : consumerThreads) t.join();
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+// 消费者释放的块推回生产者的队列 生产者下一次 miss 时取回重新使用
+// 生产者退出之后队列关闭 消费者再释放它的块要能正常走本地路径
+void ownership_test() {
+    std::cout << "=== 块回到生产者 ===" << std::endl;
+    const size_t count = 4096;
+    std::vector<void*> first(count);
+    std::mutex mutex;
+    std::condition_variable cv;
+    int stage = 0;
+
+    std::thread producer([&] {
+        for (auto& p : first) p = Pool::MemoryPool::allocate(64);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stage = 1;
+        }
+        cv.notify_all();
+
+        // 等消费者全部释放
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return stage == 2; });
+        }
+
+        std::set<void*> freed(first.begin(), first.end());
+        size_t reused = 0;
+        std::vector<void*> second(count);
+        for (auto& p : second) {
+            p = Pool::MemoryPool::allocate(64);
+            reused += freed.count(p);
+        }
+        CHECK(reused >= count / 2);
+        std::cout << "重新使用: " << reused << " / " << count << std::endl;
+
+        // 交给消费者在生产者退出之后释放
+        first = std::move(second);
+    });
+
+    std::thread consumer([&] {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return stage == 1; });
+        }
+        for (void* p : first) Pool::MemoryPool::deallocate(p, 64);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stage = 2;
+        }
+        cv.notify_all();
+    });
+
+    producer.join();
+    consumer.join();
+
+    std::thread late([&] {
+        for (void* p : first) Pool::MemoryPool::deallocate(p, 64);
+    });
+    late.join();
+}
+
+static uint16_t ownerOf(void* p) {
+    return Pool::PageCache::getSpan(p)->owner;
+}
+
+// 线程 B 用的块来自 A 的 span: 一部分从 A 还没用完的 span 上取 一部分是 A 还回来的整批
+// B 释放自己手里的块不能推到 A 的队列上 而是留在 B 自己的线程缓存里
+void self_free_test() {
+    std::cout << "=== 释放自己的块 ===" << std::endl;
+    const size_t size = 80;
+    const size_t count = 2048;
+    std::vector<void*> held;
+    std::set<void*> released;
+    uint16_t ownerA = Pool::RemoteFree::NO_OWNER;
+    std::mutex mutex;
+    std::condition_variable cv;
+    int stage = 0;
+
+    std::thread a([&] {
+        std::vector<void*> ptrs(count);
+        for (auto& p : ptrs) p = Pool::MemoryPool::allocate(size);
+        ownerA = ownerOf(ptrs[0]);
+
+        // 一半留在手里 span 不会全空 另一半放进线程缓存 之后被回收
+        held.assign(ptrs.begin(), ptrs.begin() + count / 2);
+        for (size_t i = count / 2; i < count; ++i) {
+            Pool::MemoryPool::deallocate(ptrs[i], size);
+            released.insert(ptrs[i]);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        stage = 1;
+        cv.notify_all();
+        cv.wait(lock, [&] { return stage == 2; });
+        lock.unlock();
+
+        // B 释放的块一个都没有推过来
+        CHECK(Pool::RemoteFree::drain(ownerA) == nullptr);
+        for (void* p : held) Pool::MemoryPool::deallocate(p, size);
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return stage == 1; });
+    }
+    CHECK(ownerA != Pool::RemoteFree::NO_OWNER);
+
+    // A 空闲 它的线程缓存回到 CentralCache: 整批进 TransferCache 零头回到还有块在 A 手里的 span
+    Pool::ThreadCache::reclaimIdleCaches();
+    Pool::ThreadCache::reclaimIdleCaches();
+
+    std::thread b([&] {
+        // B 自己的编号 这个大小别的线程没有用过 新切分的 span 记的就是 B
+        void* probe = Pool::MemoryPool::allocate(4000);
+        uint16_t ownerB = ownerOf(probe);
+        CHECK(ownerB != Pool::RemoteFree::NO_OWNER && ownerB != ownerA);
+
+        std::vector<void*> ptrs(count / 2);
+        size_t fromA = 0;
+        for (auto& p : ptrs) {
+            p = Pool::MemoryPool::allocate(size);
+            fromA += released.count(p);
+        }
+        std::cout << "来自 A 的块: " << fromA << " / " << count / 2 << std::endl;
+        CHECK(fromA >= count / 4);
+        // 记着别的线程的块 释放时就会被推走
+        size_t foreign = 0;
+        for (void* p : ptrs) {
+            uint16_t owner = ownerOf(p);
+            foreign += owner != Pool::RemoteFree::NO_OWNER && owner != ownerB;
+        }
+        CHECK(foreign == 0);
+
+        // 释放之后重新分配 拿回的是刚释放的块
+        std::set<void*> freed(ptrs.begin(), ptrs.end());
+        for (void* p : ptrs) Pool::MemoryPool::deallocate(p, size);
+        size_t reused = 0;
+        for (auto& p : ptrs) {
+            p = Pool::MemoryPool::allocate(size);
+            reused += freed.count(p);
+        }
+        std::cout << "重新使用: " << reused << " / " << count / 2 << std::endl;
+        CHECK(reused >= count / 4);
+        for (void* p : ptrs) Pool::MemoryPool::deallocate(p, size);
+        Pool::MemoryPool::deallocate(probe, 4000);
+    });
+    b.join();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stage = 2;
+    }
+    cv.notify_all();
+    a.join();
+}
+
+int main() {
+    const int producers = 2;
+    const int consumers = 2;
+    const int batches = 2000;
+    const size_t batchSize = 256;
+
+    // 线程缓存创建时才分配队列 所以关闭的一轮必须先跑
+    long long off = pipeline(producers, consumers, batches, batchSize);
+    Pool::RemoteFree::enable();
+    long long on = pipeline(producers, consumers, batches, batchSize);
+
+    std::cout << "生产者/消费者 关闭 RemoteFree: " << off << " ms" << std::endl;
+    std::cout << "生产者/消费者 打开 RemoteFree: " << on << " ms" << std::endl;
+
+    ownership_test();
+    self_free_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
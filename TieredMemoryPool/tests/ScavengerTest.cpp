@@ -0,0 +1,112 @@
+// 后台释放线程 (Scavenger)
+// 空闲的页写过一遍之后占着 RSS 打开 Scavenger 之后要真的降下来
+// 后台线程运行时 fork 出的子进程可以正常退出
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "PageCache.h"
+#include "Scavenger.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t SPAN_PAGES = 256;   // 1MB
+static const size_t SPANS = 64;
+
+static size_t residentMb() {
+    return Pool::getStats().processResidentBytes >> 20;
+}
+
+void release_test() {
+    std::cout << "=== 释放空闲页 ===" << std::endl;
+    Pool::PageCache& pageCache = Pool::PageCache::getInstance();
+
+    // 64MB 的 span 写一遍再还给 PageCache 物理页还在
+    std::vector<void*> spans;
+    for (size_t i = 0; i < SPANS; ++i) {
+        void* span = pageCache.allocateSpan(SPAN_PAGES);
+        CHECK(span != nullptr);
+        std::memset(span, 1, SPAN_PAGES * Pool::PageCache::PAGE_SIZE);
+        spans.push_back(span);
+    }
+    for (void* span : spans) pageCache.deallocateSpan(span, SPAN_PAGES);
+
+    size_t before = residentMb();
+    CHECK(pageCache.getFreeResidentBytes() >= SPANS * SPAN_PAGES * Pool::PageCache::PAGE_SIZE);
+
+    Pool::ScavengerOptions options;
+    options.retainedBytes = 0;
+    options.interval = std::chrono::milliseconds(20);
+    Pool::Scavenger::getInstance().start(options);
+    CHECK(Pool::Scavenger::getInstance().isRunning());
+
+    // 每秒至多 256MB 几轮就能放完
+    for (int i = 0; i < 100 && pageCache.getFreeResidentBytes() > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    size_t after = residentMb();
+    std::cout << "RSS: " << before << "MB -> " << after << "MB" << std::endl;
+    CHECK(pageCache.getFreeResidentBytes() == 0);
+    CHECK(before >= after + SPANS * 3 / 4);
+
+    // 释放过的页再次分配照常可用 内容是零
+    void* span = pageCache.allocateSpan(SPAN_PAGES);
+    CHECK(span != nullptr && static_cast<char*>(span)[0] == 0);
+    pageCache.deallocateSpan(span, SPAN_PAGES);
+}
+
+// 子进程里没有后台线程 退出时析构 Scavenger 不能卡住
+void fork_test() {
+    std::cout << "=== fork ===" << std::endl;
+    CHECK(Pool::Scavenger::getInstance().isRunning());
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // 子进程里可以重新启动再停止
+        bool stopped = !Pool::Scavenger::getInstance().isRunning();
+        Pool::Scavenger::getInstance().start();
+        Pool::Scavenger::getInstance().stop();
+        exit(stopped ? 0 : 1);
+    }
+
+    int status = -1;
+    for (int i = 0; i < 500 && waitpid(pid, &status, WNOHANG) == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (status == -1) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // 父进程里的后台线程不受影响
+    CHECK(Pool::Scavenger::getInstance().isRunning());
+    Pool::Scavenger::getInstance().stop();
+    CHECK(!Pool::Scavenger::getInstance().isRunning());
+}
+
+int main() {
+    release_test();
+    fork_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
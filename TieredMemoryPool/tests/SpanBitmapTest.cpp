@@ -0,0 +1,175 @@
+// CentralCache 的 span 用位图记录空闲块
+// 新 span 按顺序切分 还回来的块按地址从低到高优先取走 span 全空时马上就能还给 PageCache
+// TransferCache 满了的时候 排着的块也放回 span
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "CentralCache.h"
+#include "PageCache.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+// 这个测试只通过 CentralCache 取块 每个部分各用一个 size class 互不影响
+static std::vector<char*> fetch(size_t num, size_t index) {
+    std::vector<char*> blocks;
+    while (blocks.size() < num) {
+        void* start = nullptr;
+        size_t count = Pool::CentralCache::getInstance().fetchRange(start, num - blocks.size(), index);
+        if (count == 0) break;
+        for (void* block = start; block; block = *reinterpret_cast<void**>(block)) {
+            blocks.push_back(static_cast<char*>(block));
+        }
+    }
+    return blocks;
+}
+
+// 一次还一块 不满一批 不会进 TransferCache
+static void giveBack(char* block, size_t index) {
+    *reinterpret_cast<void**>(block) = nullptr;
+    Pool::CentralCache::getInstance().returnRange(block, Pool::SizeClass::SizeForIndex(index), index);
+}
+
+static size_t spanCount(size_t index) {
+    return Pool::getStats().sizeClasses[index].spans;
+}
+
+void carve_test() {
+    std::cout << "=== 按顺序切分 ===" << std::endl;
+    size_t index = Pool::SizeClass::getIndex(8);
+
+    std::vector<char*> blocks = fetch(64, index);
+    CHECK(blocks.size() == 64);
+    for (size_t i = 1; i < blocks.size(); ++i) {
+        CHECK(blocks[i] == blocks[i - 1] + 8);
+    }
+
+    // 还回隔一个的块 再取时就是这些块 地址从低到高
+    std::vector<char*> returned;
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        giveBack(blocks[i], index);
+        returned.push_back(blocks[i]);
+    }
+    std::vector<char*> again = fetch(returned.size(), index);
+    CHECK(again == returned);
+
+    // 位图中没有了 接着切分
+    std::vector<char*> next = fetch(1, index);
+    CHECK(next.size() == 1 && next[0] == blocks.back() + 8);
+
+    for (char* block : blocks) giveBack(block, index);
+    giveBack(next[0], index);
+    CHECK(spanCount(index) == 1);
+}
+
+void empty_span_test() {
+    std::cout << "=== 全空的 span ===" << std::endl;
+    size_t index = Pool::SizeClass::getIndex(1024);
+    size_t size = Pool::SizeClass::SizeForIndex(index);
+    size_t perSpan = 8 * 4096 / size;
+
+    std::vector<char*> blocks = fetch(perSpan * 3, index);
+    CHECK(blocks.size() == perSpan * 3);
+    CHECK(spanCount(index) == 3);
+
+    // 一个 span 的块全部回来 留着备用
+    for (size_t i = 0; i < perSpan; ++i) giveBack(blocks[i], index);
+    CHECK(spanCount(index) == 3);
+    // 第二个全空的 span 直接还给 PageCache
+    for (size_t i = perSpan; i < perSpan * 2; ++i) giveBack(blocks[i], index);
+    CHECK(spanCount(index) == 2);
+    for (size_t i = perSpan * 2; i < blocks.size(); ++i) giveBack(blocks[i], index);
+    CHECK(spanCount(index) == 1);
+
+    Pool::PoolStats stats = Pool::getStats();
+    CHECK(stats.sizeClasses[index].centralCachedBytes == perSpan * size);
+
+    // 空闲超过 DELAY_INTERVAL 之后 留着的那个也还回去
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    Pool::CentralCache::getInstance().flushDelayedReturns();
+    CHECK(spanCount(index) == 0);
+    CHECK(Pool::getStats().sizeClasses[index].centralCachedBytes == 0);
+}
+
+// 整批归还时 TransferCache 满了 排着的批也放回 span
+// 不需要后台线程调用 flushDelayedReturns span 也能变成全空
+void transfer_full_test() {
+    std::cout << "=== TransferCache 满了 ===" << std::endl;
+    size_t index = Pool::SizeClass::getIndex(256);
+    size_t size = Pool::SizeClass::SizeForIndex(index);
+    size_t batchNum = Pool::SizeClass::numMoveSize(size);
+    size_t batches = Pool::TransferCache::CAPACITY + 1;
+
+    std::vector<void*> heads;
+    for (size_t i = 0; i < batches; ++i) {
+        void* start = nullptr;
+        CHECK(Pool::CentralCache::getInstance().fetchRange(start, batchNum, index) == batchNum);
+        heads.push_back(start);
+    }
+    size_t spans = spanCount(index);
+    CHECK(spans * (8 * 4096 / size) >= batches * batchNum && spans > 1);
+
+    // 前 CAPACITY 批排进队列 最后一批放不下 全部回到 span
+    for (void* head : heads) {
+        Pool::CentralCache::getInstance().returnRange(head, batchNum * size, index);
+    }
+    CHECK(spanCount(index) == 1);
+    CHECK(Pool::getStats().sizeClasses[index].centralCachedBytes == (8 * 4096 / size) * size);
+}
+
+// 随机取还 同一个块不会同时交出去两次 全部还回去之后最多留一个 span
+void random_test() {
+    std::cout << "=== 随机取还 ===" << std::endl;
+    size_t index = Pool::SizeClass::getIndex(48);
+    size_t size = Pool::SizeClass::SizeForIndex(index);
+
+    std::mt19937 rng(42);
+    std::vector<char*> live;
+    std::set<char*> seen;
+    for (int round = 0; round < 2000; ++round) {
+        for (char* block : fetch(rng() % 40 + 1, index)) {
+            CHECK(seen.insert(block).second);
+            CHECK(Pool::PageCache::getSpan(block)->sizeClass == index);
+            live.push_back(block);
+        }
+        size_t frees = rng() % (live.size() + 1);
+        for (size_t i = 0; i < frees; ++i) {
+            size_t victim = rng() % live.size();
+            seen.erase(live[victim]);
+            giveBack(live[victim], index);
+            live[victim] = live.back();
+            live.pop_back();
+        }
+    }
+    CHECK(Pool::getStats().sizeClasses[index].centralCachedBytes ==
+          spanCount(index) * (8 * 4096 / size) * size - live.size() * size);
+
+    for (char* block : live) giveBack(block, index);
+    CHECK(spanCount(index) == 1);
+}
+
+int main() {
+    carve_test();
+    empty_span_test();
+    transfer_full_test();
+    random_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,132 @@
+// 空闲 span 的双向合并和 best fit
+// 释放一个 span 时 和前一个 后一个空闲的 span 都要合并成一个
+#include <iostream>
+#include <vector>
+
+#include "PageCache.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t PAGE = Pool::PageCache::PAGE_SIZE;
+
+static size_t freeSpans() {
+    return Pool::getStats().pageCacheFreeSpans;
+}
+
+// 从同一个 arena 或者同一个空闲 span 顺序切出来的 span 首尾相接
+static std::vector<char*> carve(size_t count, size_t pages) {
+    std::vector<char*> spans;
+    for (size_t i = 0; i < count; ++i) {
+        spans.push_back(static_cast<char*>(Pool::PageCache::getInstance().allocateSpan(pages)));
+    }
+    return spans;
+}
+
+void merge_test() {
+    std::cout << "=== 双向合并 ===" << std::endl;
+    Pool::PageCache& pageCache = Pool::PageCache::getInstance();
+
+    // 最后一个挡在后面 不让 C 和 arena 剩下的部分相邻
+    std::vector<char*> spans = carve(4, 4);
+    char* a = spans[0];
+    char* b = spans[1];
+    char* c = spans[2];
+    CHECK(b == a + 4 * PAGE && c == b + 4 * PAGE && spans[3] == c + 4 * PAGE);
+
+    size_t before = freeSpans();
+    pageCache.deallocateSpan(a, 4);
+    pageCache.deallocateSpan(c, 4);
+    CHECK(freeSpans() == before + 2);
+
+    // B 两边都是空闲的 三个合成一个
+    pageCache.deallocateSpan(b, 4);
+    CHECK(freeSpans() == before + 1);
+    Pool::Span* merged = Pool::PageCache::getSpan(a);
+    CHECK(merged->pageAddr == a && merged->numPages == 12 && !merged->isUsed);
+    // 首尾两页都登记着合并之后的 span
+    CHECK(Pool::PageCache::getSpan(c + 3 * PAGE) == merged);
+
+    // 整块分配回来 地址不变
+    CHECK(pageCache.allocateSpan(12) == a);
+    CHECK(freeSpans() == before);
+    pageCache.deallocateSpan(a, 12);
+    pageCache.deallocateSpan(spans[3], 4);
+}
+
+// 只和后一个合并 / 只和前一个合并
+void one_side_test() {
+    std::cout << "=== 单边合并 ===" << std::endl;
+    Pool::PageCache& pageCache = Pool::PageCache::getInstance();
+
+    std::vector<char*> spans = carve(4, 8);
+    size_t before = freeSpans();
+
+    pageCache.deallocateSpan(spans[2], 8);
+    pageCache.deallocateSpan(spans[1], 8);
+    CHECK(freeSpans() == before + 1);
+    CHECK(Pool::PageCache::getSpan(spans[1])->numPages == 16);
+
+    pageCache.deallocateSpan(spans[0], 8);
+    CHECK(freeSpans() == before + 1);
+    CHECK(Pool::PageCache::getSpan(spans[0])->numPages == 24);
+
+    // 切出一部分 剩下的仍然是一个空闲 span
+    CHECK(pageCache.allocateSpan(5) == spans[0]);
+    CHECK(freeSpans() == before + 1);
+    Pool::Span* rest = Pool::PageCache::getSpan(spans[0] + 5 * PAGE);
+    CHECK(rest->numPages == 19 && !rest->isUsed);
+    pageCache.deallocateSpan(spans[0], 5);
+    pageCache.deallocateSpan(spans[3], 8);
+}
+
+// 有多个空闲 span 时用能放下的最小的那个
+void best_fit_test() {
+    std::cout << "=== best fit ===" << std::endl;
+    Pool::PageCache& pageCache = Pool::PageCache::getInstance();
+
+    // 中间夹着使用中的 span 互相不会合并
+    std::vector<char*> spans;
+    for (size_t pages : {16, 1, 6, 1, 10, 1}) {
+        spans.push_back(carve(1, pages)[0]);
+    }
+    pageCache.deallocateSpan(spans[0], 16);
+    pageCache.deallocateSpan(spans[2], 6);
+    pageCache.deallocateSpan(spans[4], 10);
+
+    CHECK(pageCache.allocateSpan(5) == spans[2]);
+    CHECK(pageCache.allocateSpan(9) == spans[4]);
+    CHECK(pageCache.allocateSpan(12) == spans[0]);
+
+    // 全部还回去 又合成一整块 之后的测试从它顺序切分
+    size_t before = freeSpans();
+    for (size_t i : {1, 3, 5}) pageCache.deallocateSpan(spans[i], 1);
+    pageCache.deallocateSpan(spans[0], 12);
+    pageCache.deallocateSpan(spans[2], 5);
+    pageCache.deallocateSpan(spans[4], 9);
+    CHECK(freeSpans() == before - 2);
+    CHECK(Pool::PageCache::getSpan(spans[0])->numPages == 35);
+}
+
+// 每个测试结束时把自己的 span 全部还回去 合成一整块
+// 下一个测试从这一块顺序切分 切出来的 span 仍然首尾相接
+int main() {
+    best_fit_test();
+    merge_test();
+    one_side_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+// 统计接口
+// 分配释放之后 getStats 的计数和使用中的字节数要对得上 线程退出之后计数不能丢
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "MemoryPool.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t COUNT = 10000;
+static const size_t SIZE = 64;
+
+static Pool::SizeClassStats classStats(const Pool::PoolStats& stats, size_t size) {
+    return stats.sizeClasses[Pool::SizeClass::getIndex(size)];
+}
+
+void small_block_test() {
+    std::cout << "=== 小块 ===" << std::endl;
+    Pool::PoolStats before = Pool::getStats();
+
+    std::vector<void*> ptrs(COUNT);
+    for (auto& p : ptrs) p = Pool::MemoryPool::allocate(SIZE);
+
+    Pool::PoolStats during = Pool::getStats();
+    CHECK(classStats(during, SIZE).allocs - classStats(before, SIZE).allocs == COUNT);
+    CHECK(classStats(during, SIZE).inUseBytes >= classStats(before, SIZE).inUseBytes + COUNT * SIZE);
+    CHECK(during.threadCacheMisses > before.threadCacheMisses);
+    CHECK(during.threadCacheHits > before.threadCacheHits);
+    CHECK(during.mappedBytes > 0 && during.residentBytes <= during.mappedBytes);
+    CHECK(during.processResidentBytes > 0);
+
+    for (void* p : ptrs) Pool::MemoryPool::deallocate(p, SIZE);
+
+    Pool::PoolStats after = Pool::getStats();
+    CHECK(classStats(after, SIZE).frees - classStats(before, SIZE).frees == COUNT);
+    CHECK(classStats(after, SIZE).inUseBytes == classStats(before, SIZE).inUseBytes);
+    // 一部分留在线程缓存里 全空的 span 可能已经还给了 PageCache
+    CHECK(classStats(after, SIZE).threadCachedBytes > 0);
+    CHECK(after.pageCacheFreeBytes + classStats(after, SIZE).centralCachedBytes > 0);
+}
+
+// 别的线程分配之后退出 计数归到已经退出的线程里 块仍然算在使用中
+void thread_exit_test() {
+    std::cout << "=== 线程退出 ===" << std::endl;
+    Pool::PoolStats before = Pool::getStats();
+
+    std::vector<void*> ptrs(COUNT);
+    std::thread([&] {
+        for (auto& p : ptrs) p = Pool::MemoryPool::allocate(SIZE);
+    }).join();
+
+    Pool::PoolStats after = Pool::getStats();
+    CHECK(classStats(after, SIZE).allocs - classStats(before, SIZE).allocs == COUNT);
+    CHECK(classStats(after, SIZE).inUseBytes >= classStats(before, SIZE).inUseBytes + COUNT * SIZE);
+
+    for (void* p : ptrs) Pool::MemoryPool::deallocate(p, SIZE);
+}
+
+void large_block_test() {
+    std::cout << "=== 大块 ===" << std::endl;
+    const size_t size = 1024 * 1024;
+    Pool::PoolStats before = Pool::getStats();
+
+    void* p = Pool::MemoryPool::allocate(size);
+    Pool::PoolStats during = Pool::getStats();
+    CHECK(during.largeAllocs == before.largeAllocs + 1);
+    CHECK(during.largeInUseBytes >= before.largeInUseBytes + size);
+
+    Pool::MemoryPool::deallocate(p, size);
+    Pool::PoolStats after = Pool::getStats();
+    CHECK(after.largeFrees == before.largeFrees + 1);
+    CHECK(after.largeInUseBytes == before.largeInUseBytes);
+    CHECK(after.largeCachedBytes >= size);
+}
+
+int main() {
+    small_block_test();
+    thread_exit_test();
+    large_block_test();
+
+    Pool::dumpStats(stdout);
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,106 @@
+// 线程退出时归还线程缓存 以及回收空闲线程的缓存
+// 线程退出之后它缓存的块要回到 CentralCache 不能随着线程一起丢掉
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MemoryPool.h"
+#include "Stats.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t COUNT = 20000;
+
+static Pool::SizeClassStats classStats(size_t size) {
+    return Pool::getStats().sizeClasses[Pool::SizeClass::getIndex(size)];
+}
+
+static void churn(size_t size) {
+    std::vector<void*> ptrs(COUNT);
+    for (auto& p : ptrs) p = Pool::MemoryPool::allocate(size);
+    for (void* p : ptrs) Pool::MemoryPool::deallocate(p, size);
+}
+
+// 每一部分用一个主线程没有用过的 size class 线程缓存中的字节数只可能来自工作线程
+void thread_exit_test() {
+    std::cout << "=== 线程退出 ===" << std::endl;
+    const size_t size = 96;
+    size_t threadCaches = Pool::getStats().threadCaches;
+
+    std::thread([size, threadCaches] {
+        churn(size);
+        // 退出之前还缓存着一部分
+        CHECK(classStats(size).threadCachedBytes > 0);
+        CHECK(Pool::getStats().threadCaches == threadCaches + 1);
+    }).join();
+
+    Pool::SizeClassStats after = classStats(size);
+    CHECK(after.threadCachedBytes == 0);
+    CHECK(after.inUseBytes == 0);
+    CHECK(after.frees == COUNT);
+    CHECK(Pool::getStats().threadCaches == threadCaches);
+}
+
+// 空闲的线程 (一直等在条件变量上) 的缓存被别的线程回收
+void reclaim_idle_test() {
+    std::cout << "=== 回收空闲线程 ===" << std::endl;
+    const size_t size = 160;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool filled = false;
+    bool resume = false;
+
+    std::thread worker([&] {
+        churn(size);
+        std::unique_lock<std::mutex> lock(mutex);
+        filled = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return resume; });
+        lock.unlock();
+        // 被回收之后照常分配
+        churn(size);
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return filled; });
+    }
+    CHECK(classStats(size).threadCachedBytes > 0);
+
+    // 第一次只是清掉活跃标记 第二次仍然没有活动才回收
+    Pool::ThreadCache::reclaimIdleCaches();
+    size_t reclaimed = Pool::ThreadCache::reclaimIdleCaches();
+    CHECK(reclaimed > 0);
+    CHECK(classStats(size).threadCachedBytes == 0);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        resume = true;
+    }
+    cv.notify_all();
+    worker.join();
+    CHECK(classStats(size).inUseBytes == 0);
+}
+
+int main() {
+    thread_exit_test();
+    reclaim_idle_test();
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,120 @@
+// 分配释放的跟踪 (TraceRecorder)
+// 记录数要和实际的调用次数一致 每个释放都能找到之前的分配 缓冲区回绕之后也不丢记录
+// 写出的文件留给 ctest 的 ReplaySmoke 用 pool_replay 重放
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "MemoryPool.h"
+#include "Trace.h"
+
+static bool failed = false;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << "检查失败: " #cond " (" << __FILE__ << ":" << __LINE__ << ")" << std::endl; \
+            failed = true; \
+        } \
+    } while (0)
+
+static const size_t SIZES[] = {8, 24, 64, 200, 1024, 4096};
+static const size_t NUM_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
+
+// 每个线程 rounds 轮 每轮分配 batch 个再全部释放 返回调用次数
+static uint64_t churn(size_t rounds, size_t batch) {
+    std::vector<void*> ptrs(batch);
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < batch; ++i) ptrs[i] = Pool::MemoryPool::allocate(SIZES[i % NUM_SIZES]);
+        for (size_t i = 0; i < batch; ++i) Pool::MemoryPool::deallocate(ptrs[i], SIZES[i % NUM_SIZES]);
+    }
+    return rounds * batch * 2;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "trace_test.bin";
+    CHECK(Pool::TraceRecorder::start(path));
+    CHECK(!Pool::TraceRecorder::start(path));
+
+    uint64_t expected = 0;
+
+    // 单个线程远超过缓冲区的容量 后台线程要一边取走一边写
+    expected += churn(400, 512);
+
+    // 多个线程同时记录
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> counts(4);
+    for (size_t t = 0; t < counts.size(); ++t) {
+        threads.emplace_back([&counts, t] { counts[t] = churn(50, 256); });
+    }
+    for (auto& t : threads) t.join();
+    for (uint64_t count : counts) expected += count;
+
+    // 主线程分配 别的线程不带大小释放
+    std::vector<void*> handoff(1000);
+    for (auto& p : handoff) p = Pool::MemoryPool::allocate(48);
+    std::thread([&handoff] {
+        for (void* p : handoff) Pool::MemoryPool::deallocate(p);
+    }).join();
+    expected += handoff.size() * 2;
+
+    Pool::TraceRecorder::stop();
+    // 停止之后不再记录
+    Pool::MemoryPool::deallocate(Pool::MemoryPool::allocate(64), 64);
+
+    std::cout << "记录: " << Pool::TraceRecorder::recordCount() << " 条 等待: "
+              << Pool::TraceRecorder::stallCount() << " 次" << std::endl;
+    CHECK(Pool::TraceRecorder::recordCount() == expected);
+
+    // 读回文件检查
+    std::ifstream in(path, std::ios::binary);
+    Pool::TraceHeader header;
+    CHECK(in.read(reinterpret_cast<char*>(&header), sizeof(header)));
+    CHECK(std::memcmp(header.magic, "POOLTRC", 8) == 0);
+    CHECK(header.version == Pool::TraceRecorder::VERSION && header.recordSize == sizeof(Pool::TraceRecord));
+
+    std::vector<Pool::TraceRecord> records;
+    Pool::TraceRecord record;
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) records.push_back(record);
+    CHECK(records.size() == expected);
+
+    // 同一个线程的记录按程序顺序写出 时间不会倒退
+    std::map<uint16_t, uint64_t> lastTime;
+    for (const auto& r : records) {
+        CHECK(lastTime[r.thread] <= r.timestamp);
+        lastTime[r.thread] = r.timestamp;
+    }
+    // 主线程 4 个工作线程 释放 handoff 的线程
+    CHECK(lastTime.size() == 6);
+
+    // 按时间排序之后每个释放都能配上之前的分配 全部配完
+    std::stable_sort(records.begin(), records.end(), [](const auto& a, const auto& b) {
+        if (a.timestamp != b.timestamp) return a.timestamp < b.timestamp;
+        return a.op == Pool::TraceOp::Free && b.op == Pool::TraceOp::Allocate;
+    });
+    std::set<uint64_t> live;
+    size_t unsizedFrees = 0;
+    for (const auto& r : records) {
+        if (r.op == Pool::TraceOp::Allocate) {
+            CHECK(live.insert(r.ptr).second);
+            CHECK(r.size > 0);
+        } else {
+            CHECK(live.erase(r.ptr) == 1);
+            unsizedFrees += r.size == 0;
+        }
+    }
+    CHECK(live.empty());
+    CHECK(unsizedFrees == handoff.size());
+
+    if (failed) {
+        std::cout << "测试失败!" << std::endl;
+        return 1;
+    }
+    std::cout << "所有测试通过!" << std::endl;
+    return 0;
+}